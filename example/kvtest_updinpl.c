@@ -55,7 +55,7 @@ int main(int argc, const char *argv[]) {
         exit(1);
     }
 
-    pmb_opts opts;
+    pmb_opts opts = PMB_OPTS_INIT;
     opts.max_key_len = KEY_LEN;
     opts.max_val_len = MAX_VAL_LEN;
     opts.write_log_entries = 32;
@@ -44,7 +44,7 @@ int main(int argc, const char *argv[]) {
     }
 
     uint64_t blk_id = strtol(argv[5], NULL, 10);
-    pmb_opts opts;
+    pmb_opts opts = PMB_OPTS_INIT;
     opts.max_key_len = atoi(argv[1]);
     opts.max_val_len = atoi(argv[2]);
     opts.write_log_entries = 32;
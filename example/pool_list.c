@@ -43,7 +43,7 @@ int main(int argc, const char *argv[]) {
         exit(1);
     }
 
-    pmb_opts opts;
+    pmb_opts opts = PMB_OPTS_INIT;
     opts.max_key_len = atoi(argv[1]);
     opts.max_val_len = atoi(argv[2]);
     opts.write_log_entries = 32;
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2014, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY LOG OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * replay_bench.c -- measures time of tx log replay after crash
+ *
+ * Fills every tx slot with committed, but not executed in-place updates,
+ * closes the store and measures time of pmb_open replaying them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "pmbackend.h"
+
+#include "kv.h"
+
+#define NUM 1024
+#define UPD_PER_TX 16
+#define UPD_LEN 256
+#define KEY_LEN 128
+#define VAL_LEN  4UL * 1024
+#define STORE_SIZE 1UL * 1024 * 1024 * 1024
+
+static pmb_handle *
+open_store(pmb_opts *opts)
+{
+    uint8_t error;
+    pmb_handle *handle = pmb_open(opts, &error);
+    if (error != PMB_OK) {
+        printf("!!! ERROR %d !!!\n", error);
+
+        exit(1);
+    }
+    return handle;
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc != 2 && argc != 3) {
+        printf("Usage %s <filename> [recovery threads]\n", argv[0]);
+        exit(1);
+    }
+
+    pmb_opts opts = PMB_OPTS_INIT;
+    opts.max_key_len = KEY_LEN;
+    opts.max_val_len = VAL_LEN;
+    opts.write_log_entries = 32;
+    opts.path = argv[1];
+    opts.data_size = STORE_SIZE;
+    opts.meta_size= STORE_SIZE;
+    opts.meta_max_key_len = KEY_LEN;
+    opts.meta_max_val_len = VAL_LEN;
+    opts.recovery_threads = argc == 3 ? atoi(argv[2]) : 0;
+    pmb_handle *handle = open_store(&opts);
+
+    pmb_pair p;
+    uint64_t blk_ids[NUM];
+    void *key = malloc(KEY_LEN);
+    void *val = malloc(VAL_LEN);
+    memset(key, 0, KEY_LEN);
+    memset(val, 'x', VAL_LEN);
+
+    uint64_t tx_id;
+    for (int i = 0; i < NUM; i++) {
+        snprintf(key, KEY_LEN, "%d", i);
+        p.blk_id = 0;
+        p.offset = 0;
+        p.key = key;
+        p.val = val;
+        p.key_len = KEY_LEN;
+        p.val_len = VAL_LEN;
+        pmb_tx_begin(handle, &tx_id);
+        if (pmb_tput(handle, tx_id, &p) != PMB_OK) {
+            printf("put data failed for: %d\n", i);
+            exit(1);
+        }
+        pmb_tx_commit(handle, tx_id);
+        pmb_tx_execute(handle, tx_id);
+        blk_ids[i] = p.blk_id;
+    }
+
+    // leave every slot committed, but not executed
+    uint32_t nslots = 0;
+    while (pmb_tx_begin(handle, &tx_id) == PMB_OK) {
+        for (int i = 0; i < UPD_PER_TX; i++) {
+            int obj = (nslots * UPD_PER_TX + i) % NUM;
+            p.blk_id = blk_ids[obj];
+            p.offset = (nslots * UPD_LEN) % (VAL_LEN - UPD_LEN);
+            p.key = key;
+            p.val = val;
+            p.key_len = KEY_LEN;
+            p.val_len = UPD_LEN;
+            pmb_tput(handle, tx_id, &p);
+        }
+        pmb_tx_commit(handle, tx_id);
+        nslots++;
+    }
+    pmb_close(handle);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    handle = open_store(&opts);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (end.tv_sec - start.tv_sec) +
+            (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("replayed %u slots with %u threads in %.3f s\n", nslots,
+            opts.recovery_threads, elapsed);
+
+    free(key);
+    free(val);
+
+    pmb_close(handle);
+
+    return 0;
+}
@@ -53,6 +53,9 @@ extern "C" {
 #define PMB_EWRGID    9  // ID of data data block to update with meta function or
                          // ID of meta block to update with data function
 #define PMB_EARGS     10 // Invalid arguement passed
+#define PMB_ECSUM     11 // object checksum doesn't match
+#define PMB_EVERSION  12 // object version differs from expected one
+#define PMB_ENOMEM    13 // cannot allocate memory
 
 #define PMB_DATA 0
 #define PMB_META 1
@@ -66,6 +69,27 @@ extern "C" {
 #define PMB_THSYNC   3
 #define PMB_NOSYNC   4
 
+/*
+ * Recovery mode used when store wasn't closed cleanly and every block has to
+ * be validated:
+ * - PMB_RECOVERY_SYNC: pmb_open returns after all blocks are validated
+ * - PMB_RECOVERY_LAZY: pmb_open returns after transaction log is replayed,
+ *   blocks are validated in background, see pmb_recovery_progress
+ */
+#define PMB_RECOVERY_SYNC 0
+#define PMB_RECOVERY_LAZY 1
+
+/*
+ * Algorithm of block and transaction log checksums, selected when store is
+ * created and saved in superblock:
+ * - PMB_CSUM_FLETCHER64: NVML Fletcher64, used by stores created before the
+ *   option was introduced
+ * - PMB_CSUM_CRC32C:     CRC32C, computed with SSE4.2 instruction when CPU
+ *   supports it
+ */
+#define PMB_CSUM_FLETCHER64 0
+#define PMB_CSUM_CRC32C     1
+
 /*
  * pmb_handle
  *
@@ -90,10 +114,16 @@ typedef struct {
 
 /*
  * Sturucture with pmb_handle options.
- * write_log_entries, max_key_len and max_val_len are saved in superblock. When
- * handle is open function checks if provided data matches saved.
+ * write_log_entries (or tx_slots), tx_log_size, max_key_len and max_val_len
+ * are saved in superblock. When handle is open function checks if provided
+ * block sizes match saved, transaction log always uses saved layout.
+ * Fields following sync_type were added later and are kept at the end of the
+ * structure, so their 0 value selects previous behaviour. Structure has to be
+ * initialized with PMB_OPTS_INIT before fields are set, size tells pmb_open
+ * which fields the caller knows about, fields past it are treated as 0.
  */
 typedef struct {
+    uint32_t    size;          // sizeof(pmb_opts) the caller was built with
     const char* path;
     uint64_t    data_size;
     uint64_t    meta_size;
@@ -103,8 +133,42 @@ typedef struct {
     uint32_t    meta_max_key_len;
     uint32_t    meta_max_val_len;
     uint8_t     sync_type;
+    uint8_t     recovery_mode; // PMB_RECOVERY_SYNC or PMB_RECOVERY_LAZY
+    uint32_t    recovery_threads; // threads validating blocks in full recovery,
+                                  // 0 - number of online CPUs
+    uint8_t     checksum;      // PMB_CSUM_*, used only when store is created
+    uint8_t     chunk_csum;    // 1 - checksum values of data region in 4 KiB
+                               // chunks, so in-place updates rehash only
+                               // touched chunks, used only when store is created
+    uint32_t    group_commit_us;  // commits arriving within the window are
+                                  // persisted together, 0 - disabled
+    uint32_t    group_commit_max; // maximal number of commits persisted
+                                  // together, 0 - number of tx slots
+    uint32_t    execute_threads;  // threads executing transactions queued by
+                                  // pmb_tx_execute, 0 - executed by caller
+    uint64_t    tx_log_size;      // bytes shared by write log entries, saved in
+                                  // superblock, 0 - 128 MiB
+    uint8_t     tx_slot_cache;    // 1 - free tx slots are cached per CPU, so
+                                  // begin and execute don't take shared lock
+                                  // and slot is reused by the same CPU
+    uint32_t    inplace_max_len;  // updates shorter than this are logged and
+                                  // written in place, longer are copied to new
+                                  // block, 0 - half of max_val_len
+    uint32_t    execute_batch;    // with execute_threads, up to this many
+                                  // queued transactions are executed together
+                                  // and their in-place updates are applied
+                                  // ordered by block id by single thread,
+                                  // 0 or 1 - one by one
+    uint8_t     key_index;        // 1 - keep persistent index of data region
+                                  // keys for pmb_get_by_key, used only when
+                                  // store is created
+    uint32_t    tx_slots;         // number of write log entries, overrides
+                                  // write_log_entries to allow more than 255,
+                                  // 0 - write_log_entries
 } pmb_opts;
 
+#define PMB_OPTS_INIT { sizeof(pmb_opts) }
+
 /*
  * Parameters:
  * path              - path to handle
@@ -139,6 +203,10 @@ uint8_t pmb_tx_begin(pmb_handle* handle, uint64_t* tx_slot);
  * Finishes transaction:
  * - changes transaction state from 'processing' to 'commited',
  * - checksums whole transaction slot.
+ * Transaction which doesn't fit into its slot continues in overflow slots
+ * taken from the free ones, they are persisted before the commit record.
+ * With group commit enabled it returns after committer thread persists the
+ * slot along with other commits from the same window.
  */
 uint8_t pmb_tx_commit(pmb_handle* handle, uint64_t tx_slot);
 
@@ -149,6 +217,23 @@ uint8_t pmb_tx_commit(pmb_handle* handle, uint64_t tx_slot);
  */
 uint8_t pmb_tx_execute(pmb_handle* handle, uint64_t tx_slot);
 
+/*
+ * With execute_threads set pmb_tx_execute only queues committed transaction
+ * and returns, cleanup is done in background and the slot is released after
+ * it. pmb_tx_wait returns when the slot has no execute queued or running,
+ * once it's released it could be already taken and queued by another
+ * transaction, which is waited for as well. pmb_tx_begin waits for executor
+ * when all slots are queued. Without executor threads pmb_tx_wait returns
+ * immediately.
+ * Until queued transaction is executed pmb_get, pmb_tdel, pmb_tput_cas and
+ * copying pmb_tput of blocks it changes wait for it, so readers never see
+ * block older than the last executed transaction. Transactions changing the
+ * same block are executed one after another in the order they were queued.
+ * With execute_batch above 1 committed in-place updates are applied to their
+ * blocks in batches ordered by block id.
+ */
+uint8_t pmb_tx_wait(pmb_handle* handle, uint64_t tx_slot);
+
 /*
  * Revert changes done by transaction:
  * - clears newly written objects,
@@ -170,6 +255,51 @@ uint8_t pmb_tx_abort(pmb_handle* handle, uint64_t tx_slot);
  */
 uint8_t pmb_get(pmb_handle* handle, uint64_t blk_id, pmb_pair* pair);
 
+/*
+ * Finds object of data region by key in store created with key_index set,
+ * pair is filled the same way as by pmb_get. Index is updated when
+ * transaction is executed or replayed and by pmb_put_atomic, so objects
+ * written by not executed transactions aren't found yet. Keys are expected
+ * to be unique, when more objects have the same key any of them is returned.
+ * Index is persisted at close, after crash it's rebuilt by full recovery and
+ * with PMB_RECOVERY_LAZY the call waits until recovery finishes.
+ *
+ * Return:
+ * - PMB_OK on success
+ * - PMB_ENOENT if there's no object with the key
+ * - PMB_EARGS if arguments are invalid
+ * - PMB_ERR if store was created without key index
+ */
+uint8_t pmb_get_by_key(pmb_handle* handle, const void* key, uint32_t key_len,
+        pmb_pair* pair);
+
+/*
+ * Gets n objects at once, pairs[i] is filled the same way as by pmb_get for
+ * blk_ids[i] and its result is stored in status[i]. Headers of all objects
+ * are prefetched before the first one is read, so their loads overlap.
+ *
+ * Return:
+ * - PMB_OK if all objects were found
+ * - PMB_ENOENT if any object doesn't exist, status tells which
+ * - PMB_EARGS if arguments are invalid
+ */
+uint8_t pmb_get_batch(pmb_handle* handle, const uint64_t* blk_ids,
+        pmb_pair* pairs, uint8_t* status, size_t n);
+
+/*
+ * Verifies checksums of object. For stores created with chunk_csum only
+ * chunks overlapping <offset, offset + len) are checked along with the header,
+ * so readers could verify just the range they use. Other stores always check
+ * whole object.
+ *
+ * Returns:
+ * - PMB_OK if object is valid
+ * - PMB_ENOENT if there's no object with given id
+ * - PMB_ECSUM if checksum doesn't match
+ */
+uint8_t pmb_verify(pmb_handle* handle, uint64_t blk_id, uint32_t offset,
+        uint32_t len);
+
 /*
  * Functions writing data to the store:
  * - tput: transactional write to data region
@@ -183,6 +313,12 @@ uint8_t pmb_get(pmb_handle* handle, uint64_t blk_id, pmb_pair* pair);
  *
  * If blk_id is set to non-zero value in pmb_pair and pmb_tput* verion is used then write will
  * be performed transactionally.
+ * pmb_tput update shorter than inplace_max_len is logged in tx slot and
+ * written into the existing block at execute, so only modified range is
+ * written and object keeps its id. Longer updates, and updates whose payload
+ * doesn't fit into free tx slots, copy object to a new block.
+ * Consecutive in-place updates of the same object which overlap or touch
+ * each other are merged into single log entry.
  *
  * val_len is allowed to be 0 only when val is set to NULL
  *
@@ -191,11 +327,62 @@ uint8_t pmb_get(pmb_handle* handle, uint64_t blk_id, pmb_pair* pair);
  * - PMB_ERR if arguments are invalid
  * - PMB_ESIZE if write is
  * - PMB_ENOENT
+ * - PMB_ENOSPC if there's no free block or no tx slot left to chain the
+ *   operation to
+ * - PMB_ENOMEM if in-place update can't be tracked by the transaction
  */
 uint8_t pmb_tput(pmb_handle* handle, uint64_t tx_slot, pmb_pair* pair);
 
 uint8_t pmb_tput_meta(pmb_handle* handle, uint64_t tx_slot, pmb_pair* pair);
 
+/*
+ * Conditional pmb_tput, object given by blk_id in pmb_pair is updated only if
+ * its version is equal to version argument. Block stays claimed by the
+ * transaction until it's executed or aborted, so other conditional updates
+ * of the same version fail instead of creating second live copy of object.
+ * Transaction holding the claim can update the object again with the same
+ * version. Updates done with plain pmb_tput are not checked.
+ * New object is written when blk_id is 0 and version is 0.
+ *
+ * Returns error codes of pmb_tput and:
+ * - PMB_EVERSION if object has different version or it's claimed by other
+ *   transaction
+ * - PMB_ENOENT if object doesn't exist, also when it was copied to new block
+ *   by executed update
+ */
+uint8_t pmb_tput_cas(pmb_handle* handle, uint64_t tx_slot, pmb_pair* pair,
+        uint32_t version);
+
+/*
+ * Writes n objects to data region in transaction, fields of every pmb_pair
+ * are used the same way as by pmb_tput and blk_id of each is set to written
+ * object id. All objects are written to new blocks, which are taken from free
+ * list and registered in tx slot at once. Copies are made durable by commit of
+ * the transaction with single fence.
+ *
+ * Returns PMB_OK or error code of pmb_tput, nothing is written if arguments
+ * of any pair are invalid. After other errors transaction should be aborted.
+ */
+uint8_t pmb_tput_batch(pmb_handle* handle, uint64_t tx_slot, pmb_pair* pairs,
+        size_t n);
+
+/*
+ * Writes single new object to data region without transaction, it's
+ * equivalent of begin, tput, commit and execute with one object. Object is
+ * written to a free block and made visible by its allocation bit once it's
+ * durable, so no tx slot is used. After crash object is either complete or
+ * absent. Updates aren't supported, release of the old version would need to
+ * be logged, they have to be done in transaction.
+ *
+ * Fields of pmb_pair are used the same way as by pmb_tput, blk_id has to be 0,
+ * returns:
+ * - PMB_OK on success, blk_id in pmb_pair is set to id of the object
+ * - PMB_EARGS if arguments are invalid or blk_id is set
+ * - PMB_ESIZE if value doesn't fit into block
+ * - PMB_ENOSPC if there's no free block
+ */
+uint8_t pmb_put_atomic(pmb_handle* handle, pmb_pair* pair);
+
 /*
  * Removes object from pmb_handle, at success returns PMB_OK, otherwise error code.
  *
@@ -221,6 +408,26 @@ void pmb_inspect(pmb_handle* handle, uint64_t blk_id);
 
 uint64_t pmb_resolve_conflict(pmb_handle* handle, uint64_t blk_id1, uint64_t blk_id2);
 
+/*
+ * Reports progress of background recovery started by pmb_open with
+ * PMB_RECOVERY_LAZY: number of already validated blocks and number of all
+ * blocks to validate. Both are equal when there's no recovery running.
+ *
+ * While recovery is running:
+ * - allocations take only blocks already proven free and wait for the scan
+ *   when there's none,
+ * - pmb_get validates requested block if it wasn't validated yet,
+ * - pmb_iter_open waits for the scan to finish.
+ */
+uint8_t pmb_recovery_progress(pmb_handle* handle, uint64_t* validated,
+        uint64_t* total);
+
+/*
+ * Waits until background recovery finishes, returns immediately when there's
+ * none running.
+ */
+uint8_t pmb_recovery_wait(pmb_handle* handle);
+
 /*
  * Return error message associated with given error code.
  */
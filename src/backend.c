@@ -31,8 +31,10 @@
  */
 
 #include "backend.h"
+#include "checksum.h"
 #include "libpmem.h"
 #include "kv.h"
+#include "pmbackend.h"
 
 // NVML's internals
 #include "out.h"
@@ -58,10 +60,62 @@
 #define PMB_FORMAT_DATA_ALIGN 4096
 #define PMB_HDR_SIG           "PMBACKEN"
 #define PMB_FORMAT_MAJOR      0x0001
-#define PMB_FORMAT_INCOMPAT   0x0000
+#define PMB_FORMAT_INCOMPAT   PMB_INCOMPAT_FEATURES
 #define PMB_FORMAT_RO_COMPAT  0x0000
 #define PMB_FORMAT_COMPAT     0x0000
 
+/*
+ * Incompat flags of the pool header. Versions which don't know the features
+ * word would read the allocation bitmap, snapshot and key index as data blocks
+ * and verify CRC32C and chunk checksums as plain ones, so every pool created
+ * with the features word is marked and refused by them in util_pool_open.
+ */
+#define PMB_INCOMPAT_FEATURES 0x0001 /* layout described by PMB_FEAT_* flags */
+
+/*
+ * Pool feature flags, saved in the header at creation time. Pools created
+ * before a feature was introduced have the flag cleared.
+ */
+#define PMB_FEAT_ALLOC_MAP    0x0001 /* allocation bitmap after tx log */
+#define PMB_FEAT_FREE_SNAP    0x0002 /* free-list snapshot after bitmap */
+#define PMB_FEAT_CHUNK_CSUM   0x0004 /* data values checksummed in chunks */
+#define PMB_FEAT_WIDE_TX      0x0008 /* tx slots count in 32-bit field */
+#define PMB_FEAT_KEY_INDEX    0x0010 /* key hash index after snapshot */
+
+/*
+ * Allocation bitmap header, first page of the allocation bitmap region.
+ * It's kept outside of the pool header, because that one is read-only after
+ * the pool is mapped.
+ */
+struct alloc_map_hdr {
+    uint64_t flch64;  /* checksum of the bitmap, valid in CLEAN state */
+    uint32_t state;
+    uint32_t reserved;
+    uint64_t nbits;
+};
+
+/*
+ * Free-list snapshot header, first page of the snapshot region. Ranges of data
+ * free list followed by ranges of meta free list are stored as <begin, end>
+ * pairs on the following pages. Checksum covers header page and used ranges.
+ */
+struct free_snap_hdr {
+    uint64_t flch64;
+    uint32_t valid;   /* set at clean shutdown, cleared right after load */
+    uint32_t reserved;
+    uint64_t nranges[2];
+};
+
+/*
+ * Key index bucket. Empty bucket has both fields cleared, removed entry keeps
+ * the hash, so lookups continue over it. Block id is written last, so torn
+ * insert leaves either removed entry or entry verified against the block.
+ */
+struct key_index_entry {
+    uint64_t hash;
+    uint64_t blk_id;
+};
+
 typedef void (*persist_fn)(void *, size_t);
 typedef void (*flush_fn)(void *, size_t);
 typedef void (*drain_fn)(void);
@@ -96,6 +150,22 @@ struct _backend {
     void           *data;    // start of data area
     void           *meta;    // start of metadata area
     uint64_t        flch64;
+    uint32_t        features; // PMB_FEAT_* flags
+    uint32_t        csum_type; // PMB_CSUM_* algorithm of all checksums
+    uint32_t        tx_slots;  // tx slots count with PMB_FEAT_WIDE_TX
+    struct alloc_map_hdr *alloc_hdr; // allocation bitmap header or NULL
+    uint64_t       *alloc_map;       // allocation bitmap, bit per block
+    size_t          alloc_map_size;  // size of the bitmap in bytes
+    struct free_snap_hdr *snap_hdr;  // free-list snapshot header or NULL
+    uint64_t       *snap_ranges;     // free-list snapshot ranges
+    size_t          snap_max;        // number of ranges snapshot could keep
+    checksum_fn     checksum;        // implementation of csum_type
+    uint32_t        chunk_off;       // chunk checksum table offset in data
+                                     // block, 0 if values aren't chunked
+    uint32_t        tx_nslots;       // number of tx slots
+    copy_fn         memcpy_nodrain;  // copy without trailing fence on pmem
+    struct key_index_entry *key_index; // key index buckets or NULL
+    uint64_t        key_index_mask;  // number of buckets - 1
 };
 
 /*
@@ -149,10 +219,11 @@ empty_weak_persist(void *addr, size_t length)
 static struct _backend*
 _backend_map_common(struct pool_set* set, size_t poolsize, size_t meta_poolsize,
         size_t bsize, size_t meta_bsize, int rdonly, int initialize,
-        uint8_t tx_slots_count, size_t tx_slot_size,
+        uint32_t tx_slots_count, size_t tx_slot_size,
         uint32_t max_key_len, uint32_t max_val_len,
 		uint32_t meta_max_key_len, uint32_t meta_max_val_len,
-        uint8_t sync_type)
+        uint8_t sync_type, uint8_t csum_type, uint8_t chunk_csum,
+        uint8_t key_index)
 {
 	LOG(3, "poolsize %zu meta_poolsize %zu bsize %zu meta_bsize %zu rdonly %d initialize %d",
 			poolsize, meta_poolsize, bsize, meta_bsize, rdonly, initialize);
@@ -168,6 +239,24 @@ _backend_map_common(struct pool_set* set, size_t poolsize, size_t meta_poolsize,
 	/* opaque info lives at the beginning of mapped memory pool */
 	//struct _backend *pbp = addr;
 
+	/*
+	 * chunk checksum table follows value area of data block, lengths saved
+	 * in the header are used for existing pool
+	 */
+	uint32_t chunk_off = 0;
+	if (initialize ? chunk_csum :
+			(le32toh(backend->features) & PMB_FEAT_CHUNK_CSUM) != 0) {
+		if (!initialize) {
+			max_key_len = le32toh(backend->max_key_len);
+			max_val_len = le32toh(backend->max_val_len);
+		}
+		chunk_off = sizeof(pmb_data_hdr) + max_key_len +
+				roundup(max_val_len, sizeof(uint64_t));
+		if (bsize) {
+			bsize = chunk_off + BACKEND_NCHUNKS(max_val_len) * sizeof(uint64_t);
+		}
+	}
+
 	bsize = roundup(bsize, PMB_FORMAT_DATA_ALIGN);
 	meta_bsize = roundup(meta_bsize, PMB_FORMAT_DATA_ALIGN);
 	tx_slot_size = roundup(tx_slot_size, PMB_FORMAT_DATA_ALIGN);
@@ -192,6 +281,17 @@ _backend_map_common(struct pool_set* set, size_t poolsize, size_t meta_poolsize,
 		}
 		meta_bsize = meta_hdr_bsize;
 		LOG(3, "using meta block size from header: %zu", meta_bsize);
+
+		/* tx log layout is saved in the header, older pools keep slots
+		 * count in 8-bit field */
+		tx_slot_size = le32toh(backend->tx_slot_size);
+		if (le32toh(backend->features) & PMB_FEAT_WIDE_TX) {
+			tx_slots_count = le32toh(backend->tx_slots);
+		} else {
+			tx_slots_count = backend->tx_slots_count;
+		}
+		LOG(3, "using tx log from header: %u slots of %zu", tx_slots_count,
+				tx_slot_size);
 	} else {
 		LOG(3, "creating new memory pool");
 
@@ -233,9 +333,21 @@ _backend_map_common(struct pool_set* set, size_t poolsize, size_t meta_poolsize,
 		backend->tx_slot_size = htole32(tx_slot_size);
 		pmem_msync(&backend->tx_slot_size, sizeof(backend->tx_slot_size));
 
-		backend->tx_slots_count = tx_slots_count;
+		backend->tx_slots_count = tx_slots_count > UINT8_MAX ?
+				UINT8_MAX : tx_slots_count;
 		pmem_msync(&backend->tx_slots_count, sizeof(backend->tx_slots_count));
 
+		backend->tx_slots = htole32(tx_slots_count);
+		pmem_msync(&backend->tx_slots, sizeof(backend->tx_slots));
+
+		backend->features = htole32(PMB_FEAT_ALLOC_MAP | PMB_FEAT_FREE_SNAP |
+				PMB_FEAT_WIDE_TX | (chunk_csum ? PMB_FEAT_CHUNK_CSUM : 0) |
+				(key_index ? PMB_FEAT_KEY_INDEX : 0));
+		pmem_msync(&backend->features, sizeof(backend->features));
+
+		backend->csum_type = htole32(csum_type);
+		pmem_msync(&backend->csum_type, sizeof(backend->csum_type));
+
 		/* store pool's header */
 		pmem_msync(backend, sizeof (*backend));
 	}
@@ -249,12 +361,75 @@ _backend_map_common(struct pool_set* set, size_t poolsize, size_t meta_poolsize,
 	backend->is_pmem = is_pmem;
 	backend->tx_log = backend->addr + roundup(sizeof (*backend), PMB_FORMAT_DATA_ALIGN);
 	backend->data = backend->tx_log + tx_slots_count * tx_slot_size;
+	backend->tx_nslots = tx_slots_count;
+
+	backend->alloc_hdr = NULL;
+	backend->alloc_map = NULL;
+	backend->alloc_map_size = 0;
+	backend->snap_hdr = NULL;
+	backend->snap_ranges = NULL;
+	backend->snap_max = 0;
+	if (le32toh(backend->features) & PMB_FEAT_ALLOC_MAP) {
+		/* bit for every block which could fit into data and meta areas */
+		size_t min_bsize = bsize < meta_bsize ? bsize : meta_bsize;
+		size_t nbits = (poolsize + meta_poolsize) / min_bsize + 1;
+		backend->alloc_hdr = backend->data;
+		backend->alloc_map = backend->data + PMB_FORMAT_DATA_ALIGN;
+		backend->alloc_map_size = roundup(roundup(nbits, 64) / 8,
+				PMB_FORMAT_DATA_ALIGN);
+		backend->data += PMB_FORMAT_DATA_ALIGN + backend->alloc_map_size;
+		if (initialize) {
+			backend->alloc_hdr->nbits = htole64(nbits);
+			pmem_msync(backend->alloc_hdr, sizeof(*backend->alloc_hdr));
+		}
+	}
+	if ((le32toh(backend->features) & PMB_FEAT_FREE_SNAP) &&
+			backend->alloc_map != NULL) {
+		/*
+		 * snapshot is twice the size of the bitmap, heavily fragmented free
+		 * lists don't fit and are restored from the bitmap instead
+		 */
+		size_t snap_size = 2 * backend->alloc_map_size;
+		backend->snap_hdr = backend->data;
+		backend->snap_ranges = backend->data + PMB_FORMAT_DATA_ALIGN;
+		backend->snap_max = snap_size / (2 * sizeof(uint64_t));
+		backend->data += PMB_FORMAT_DATA_ALIGN + snap_size;
+	}
+	backend->key_index = NULL;
+	backend->key_index_mask = 0;
+	if (le32toh(backend->features) & PMB_FEAT_KEY_INDEX) {
+		/* at least two buckets for every block which could fit into data
+		 * area, so chains stay short */
+		uint64_t nbuckets = 1;
+		while (nbuckets < 2 * (poolsize / bsize + 1)) {
+			nbuckets <<= 1;
+		}
+		backend->key_index = backend->data;
+		backend->key_index_mask = nbuckets - 1;
+		backend->data += roundup(nbuckets * sizeof(struct key_index_entry),
+				PMB_FORMAT_DATA_ALIGN);
+	}
 	backend->datasize = (backend->addr + poolsize) - backend->data;
 	backend->data_nlba = backend->datasize / backend->bsize;
 	backend->meta = backend->data + backend->data_nlba * backend->bsize;
 	backend->metasize = (backend->addr + poolsize + meta_poolsize) - backend->meta;
 	backend->meta_nlba = backend->metasize / backend->meta_bsize;
 	backend->sync_type = sync_type;
+	backend->chunk_off = chunk_off;
+
+	/* pools created before csum_type was introduced have it cleared */
+	switch (le32toh(backend->csum_type)) {
+		case PMB_CSUM_FLETCHER64:
+			backend->checksum = util_checksum;
+			break;
+		case PMB_CSUM_CRC32C:
+			backend->checksum = checksum_crc32c;
+			break;
+		default:
+			LOG(1, "unknown checksum type %u", le32toh(backend->csum_type));
+			errno = EINVAL;
+			goto err;
+	}
 
 	if (backend->is_pmem) {
 		backend->persist = pmem_persist;
@@ -262,12 +437,14 @@ _backend_map_common(struct pool_set* set, size_t poolsize, size_t meta_poolsize,
 		backend->flush = pmem_flush;
 		backend->drain = pmem_drain;
 		backend->memcpy = pmem_memcpy_persist;
+		backend->memcpy_nodrain = pmem_memcpy_nodrain;
 	} else {
 		backend->persist = (persist_fn)pmem_msync;
 		backend->weak_persist = msync_weak;
 	    backend->flush = (flush_fn)pmem_msync;
 		backend->drain = drain_empty;
 		backend->memcpy = memcpy;
+		backend->memcpy_nodrain = memcpy;
 	}
 
 	LOG(4, "data area %p data size %zu bsize %zu",
@@ -304,7 +481,8 @@ backend_create(const char *path, size_t data_size, size_t meta_size,
         size_t tx_slots, size_t tx_slot_size,
         uint32_t max_key_len, uint32_t max_val_len,
 		uint32_t meta_max_key_len, uint32_t meta_max_val_len,
-        mode_t mode, uint8_t sync_type)
+        mode_t mode, uint8_t sync_type, uint8_t csum_type, uint8_t chunk_csum,
+        uint8_t key_index)
 {
     size_t bsize = sizeof(pmb_data_hdr) + max_key_len + max_val_len;
     size_t meta_bsize = sizeof(pmb_data_hdr) + meta_max_key_len + meta_max_val_len;
@@ -340,7 +518,7 @@ backend_create(const char *path, size_t data_size, size_t meta_size,
 	struct _backend* backend = _backend_map_common(set, data_size, meta_size,
             bsize, meta_bsize, 0, created, tx_slots, tx_slot_size,
             max_key_len, max_val_len, meta_max_key_len, meta_max_val_len,
-            sync_type);
+            sync_type, csum_type, chunk_csum, key_index);
 
     if (created) {
         util_poolset_chmod(set, mode);
@@ -378,7 +556,7 @@ backend_open(const char *path, size_t data_size, size_t meta_size,
 	struct _backend* backend = _backend_map_common(set, data_size, meta_size,
             bsize, meta_bsize, 0, 0, tx_slots, tx_slot_size,
             max_key_len, max_val_len, meta_max_key_len, meta_max_val_len,
-            sync_type);
+            sync_type, 0, 0, 0);
 
     util_poolset_fdclose(set);
     util_poolset_free(set);
@@ -514,7 +692,7 @@ backend_persist_weak(struct _backend* backend, void *obj_ptr, size_t size)
 }
 
 void*
-backend_tx_direct(struct _backend* backend, uint8_t tx_id)
+backend_tx_direct(struct _backend* backend, uint32_t tx_id)
 {
 	tracepoint(pmem_backend, backend_tx_direct_enter);
     if (backend == NULL) {
@@ -522,7 +700,7 @@ backend_tx_direct(struct _backend* backend, uint8_t tx_id)
         return NULL;
     }
 
-    if (tx_id < backend->tx_slots_count) {
+    if (tx_id < backend->tx_nslots) {
         tracepoint(pmem_backend, backend_tx_direct_exit);
         return backend->tx_log + tx_id * backend->tx_slot_size;
     }
@@ -532,7 +710,7 @@ backend_tx_direct(struct _backend* backend, uint8_t tx_id)
 }
 
 uint8_t
-backend_tx_persist(struct _backend* backend, uint8_t tx_id, size_t size)
+backend_tx_persist(struct _backend* backend, uint32_t tx_id, size_t size)
 {
 	tracepoint(pmem_backend, backend_tx_persist_enter, tx_id, size);
     if (backend == NULL) {
@@ -540,24 +718,60 @@ backend_tx_persist(struct _backend* backend, uint8_t tx_id, size_t size)
         return BACKEND_NO_BACKEND;
     }
 
-    if (backend->sync_type == 0) {
-        backend_persist_all(backend);
-        tracepoint(pmem_backend, backend_tx_persist_exit, tx_id, size);
-        return BACKEND_OK;
-    }
-
     void *obj = backend_tx_direct(backend, tx_id);
     if (obj == NULL) {
         tracepoint(pmem_backend, backend_tx_persist_exit, tx_id, size);
         return BACKEND_ENOENT;
     }
 
-    backend_persist(backend, obj, size);
+    if (backend->sync_type == 0) {
+        // SYNC, drains blocks flushed with backend_block_flush too
+        backend->persist(obj, size);
+    } else {
+        backend_persist(backend, obj, size);
+    }
 
     tracepoint(pmem_backend, backend_tx_persist_exit, tx_id, size);
     return BACKEND_OK;
 }
 
+void
+backend_tx_persist_batch(struct _backend *backend, const uint32_t *tx_ids,
+        const size_t *sizes, size_t count)
+{
+    if (backend->sync_type != 0 && backend->sync_type != 2) {
+        // ASYNC and others keep their semantics
+        for (size_t i = 0; i < count; i++) {
+            backend_persist(backend, backend_tx_direct(backend, tx_ids[i]),
+                    sizes[i]);
+        }
+        return;
+    }
+
+    if (backend->is_pmem) {
+        for (size_t i = 0; i < count; i++) {
+            backend->flush(backend_tx_direct(backend, tx_ids[i]), sizes[i]);
+        }
+        backend->drain();
+        return;
+    }
+
+    void *begin = NULL;
+    void *end = NULL;
+    for (size_t i = 0; i < count; i++) {
+        void *slot = backend_tx_direct(backend, tx_ids[i]);
+        if (begin == NULL || slot < begin) {
+            begin = slot;
+        }
+        if (end == NULL || slot + sizes[i] > end) {
+            end = slot + sizes[i];
+        }
+    }
+    if (begin != NULL) {
+        backend->persist(begin, end - begin);
+    }
+}
+
 uint8_t
 backend_set_zero(struct _backend* backend, void *obj_ptr)
 {
@@ -608,7 +822,7 @@ backend_tx_set_zero(struct _backend *backend, void *slot_ptr)
 
 	tracepoint(pmem_backend, persist_enter);
 	if (backend->sync_type == 0) {
-	    backend_persist_all(backend);
+	    backend->persist(slot_ptr, size);
 	} else {
 	    backend_persist(backend, slot_ptr, size);
 	}
@@ -618,6 +832,18 @@ backend_tx_set_zero(struct _backend *backend, void *slot_ptr)
     return 0;
 }
 
+uint32_t
+backend_tx_count(struct _backend *backend)
+{
+    return backend->tx_nslots;
+}
+
+size_t
+backend_tx_slot_size(struct _backend *backend)
+{
+    return backend->tx_slot_size;
+}
+
 size_t
 backend_nblock(struct _backend *backend, int meta_store)
 {
@@ -635,3 +861,550 @@ backend_memcpy(struct _backend *backend, void *dest, const void *src, size_t num
 {
 	return backend->memcpy(dest, src, num);
 }
+
+void *
+backend_memcpy_nodrain(struct _backend *backend, void *dest, const void *src,
+        size_t num)
+{
+    if (backend->sync_type != 0) {
+        return backend->memcpy(dest, src, num);
+    }
+    return backend->memcpy_nodrain(dest, src, num);
+}
+
+int
+backend_checksum(struct _backend *backend, void *addr, size_t len,
+        uint64_t *csump, int insert)
+{
+    return backend->checksum(addr, len, csump, insert);
+}
+
+/*
+ * Folds checksum of first n entries of chunk table to 32 bits kept in block
+ * header
+ */
+static uint32_t
+backend_chunk_fold(struct _backend *backend, uint64_t *table, size_t n)
+{
+    uint64_t csum;
+    backend->checksum(table, n * sizeof(uint64_t), &csum, 1);
+    return (uint32_t)(csum ^ (csum >> 32));
+}
+
+void
+backend_block_checksum(struct _backend *backend, uint64_t obj_id,
+        uint32_t offset, uint32_t len)
+{
+    pmb_data_hdr *hdr = backend_direct(backend, obj_id);
+    if (obj_id >= backend->data_nlba) {
+        backend->checksum(hdr, sizeof(pmb_data_hdr) + hdr->key_len +
+                hdr->val_len, &hdr->flch64, 1);
+        return;
+    }
+
+    size_t key_len = le32toh(backend->max_key_len);
+    if (!backend->chunk_off) {
+        backend->checksum(hdr, sizeof(pmb_data_hdr) + key_len + hdr->val_len,
+                &hdr->flch64, 1);
+        return;
+    }
+
+    // rehash only chunks touched by the update
+    void *value = (void *)hdr + sizeof(pmb_data_hdr) + key_len;
+    uint64_t *table = (void *)hdr + backend->chunk_off;
+    uint64_t end = (uint64_t)offset + len;
+    if (end > hdr->val_len) {
+        end = hdr->val_len;
+    }
+    size_t first = offset / BACKEND_CSUM_CHUNK;
+    size_t last = BACKEND_NCHUNKS(end);
+    for (size_t i = first; i < last; i++) {
+        size_t chunk_len = hdr->val_len - i * BACKEND_CSUM_CHUNK;
+        if (chunk_len > BACKEND_CSUM_CHUNK) {
+            chunk_len = BACKEND_CSUM_CHUNK;
+        }
+        backend->checksum(value + i * BACKEND_CSUM_CHUNK, chunk_len,
+                &table[i], 1);
+    }
+    if (last > first) {
+        backend_persist(backend, &table[first], (last - first) * sizeof(uint64_t));
+    }
+
+    hdr->chunk_csum = backend_chunk_fold(backend, table,
+            BACKEND_NCHUNKS(hdr->val_len));
+    backend->checksum(hdr, sizeof(pmb_data_hdr) + key_len, &hdr->flch64, 1);
+    backend_persist(backend, hdr, sizeof(pmb_data_hdr));
+}
+
+void
+backend_block_flush(struct _backend *backend, uint64_t obj_id,
+        uint32_t offset, uint32_t len)
+{
+    if (backend->sync_type != 0) {
+        return;
+    }
+
+    pmb_data_hdr *hdr = backend_direct(backend, obj_id);
+    if (hdr == NULL) {
+        return;
+    }
+
+    size_t key_len = obj_id < backend->data_nlba ?
+            le32toh(backend->max_key_len) : hdr->key_len;
+    void *value = (void *)hdr + sizeof(pmb_data_hdr) + key_len;
+    uint64_t end = (uint64_t)offset + len;
+    if (end > hdr->val_len) {
+        end = hdr->val_len;
+    }
+
+    if (len == 0 || (offset && offset >= end)) {
+        backend->flush(hdr, sizeof(pmb_data_hdr));
+        return;
+    }
+
+    if (offset == 0) {
+        backend->flush(hdr, value + end - (void *)hdr);
+    } else {
+        backend->flush(hdr, sizeof(pmb_data_hdr));
+        backend->flush(value + offset, end - offset);
+    }
+
+    size_t first = offset / BACKEND_CSUM_CHUNK;
+    if (backend->chunk_off && obj_id < backend->data_nlba &&
+            BACKEND_NCHUNKS(end) > first) {
+        uint64_t *table = (void *)hdr + backend->chunk_off;
+        backend->flush(&table[first],
+                (BACKEND_NCHUNKS(end) - first) * sizeof(uint64_t));
+    }
+}
+
+void
+backend_drain(struct _backend *backend)
+{
+    if (backend->sync_type == 0) {
+        backend->drain();
+    }
+}
+
+int
+backend_block_verify(struct _backend *backend, uint64_t obj_id,
+        uint32_t offset, uint32_t len)
+{
+    pmb_data_hdr *hdr = backend_direct(backend, obj_id);
+    if (obj_id >= backend->data_nlba) {
+        return backend->checksum(hdr, sizeof(pmb_data_hdr) + hdr->key_len +
+                hdr->val_len, &hdr->flch64, 0);
+    }
+
+    size_t key_len = le32toh(backend->max_key_len);
+    if (!backend->chunk_off) {
+        return backend->checksum(hdr, sizeof(pmb_data_hdr) + key_len +
+                hdr->val_len, &hdr->flch64, 0);
+    }
+
+    // header covers the table, table covers chunks of the value
+    if (!backend->checksum(hdr, sizeof(pmb_data_hdr) + key_len, &hdr->flch64, 0) ||
+            hdr->val_len > le32toh(backend->max_val_len)) {
+        return 0;
+    }
+
+    uint64_t *table = (void *)hdr + backend->chunk_off;
+    if (backend_chunk_fold(backend, table, BACKEND_NCHUNKS(hdr->val_len)) !=
+            hdr->chunk_csum) {
+        return 0;
+    }
+
+    void *value = (void *)hdr + sizeof(pmb_data_hdr) + key_len;
+    uint64_t end = (uint64_t)offset + len;
+    if (end > hdr->val_len) {
+        end = hdr->val_len;
+    }
+    for (size_t i = offset / BACKEND_CSUM_CHUNK; i < BACKEND_NCHUNKS(end); i++) {
+        size_t chunk_len = hdr->val_len - i * BACKEND_CSUM_CHUNK;
+        if (chunk_len > BACKEND_CSUM_CHUNK) {
+            chunk_len = BACKEND_CSUM_CHUNK;
+        }
+        if (!backend->checksum(value + i * BACKEND_CSUM_CHUNK, chunk_len,
+                    &table[i], 0)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+uint8_t
+backend_alloc_state(struct _backend *backend)
+{
+    if (backend == NULL || backend->alloc_hdr == NULL) {
+        return BACKEND_ALLOC_DIRTY;
+    }
+
+    uint32_t state = le32toh(backend->alloc_hdr->state);
+    if (state == BACKEND_ALLOC_CLEAN &&
+            !backend->checksum(backend->alloc_map, backend->alloc_map_size,
+                    &backend->alloc_hdr->flch64, 0)) {
+        LOG(1, "allocation bitmap corrupted");
+        return BACKEND_ALLOC_DIRTY;
+    }
+
+    return state;
+}
+
+void
+backend_alloc_set_state(struct _backend *backend, uint8_t state)
+{
+    if (backend == NULL || backend->alloc_hdr == NULL) {
+        return;
+    }
+
+    if (state == BACKEND_ALLOC_CLEAN) {
+        backend->persist(backend->alloc_map, backend->alloc_map_size);
+        backend->checksum(backend->alloc_map, backend->alloc_map_size,
+                &backend->alloc_hdr->flch64, 1);
+    }
+
+    backend->alloc_hdr->state = htole32(state);
+    backend->persist(backend->alloc_hdr, sizeof(*backend->alloc_hdr));
+}
+
+uint64_t *
+backend_alloc_map(struct _backend *backend, size_t *nwords)
+{
+    if (backend == NULL || backend->alloc_map == NULL) {
+        *nwords = 0;
+        return NULL;
+    }
+
+    *nwords = backend->alloc_map_size / sizeof(uint64_t);
+    return backend->alloc_map;
+}
+
+/*
+ * backend_alloc_mark_word -- (internal) sets or clears bits in single bitmap
+ * word, other bits of the word could be changed concurrently
+ */
+static void
+backend_alloc_mark_word(struct _backend *backend, uint64_t *word,
+        uint64_t mask, int allocated)
+{
+    if (allocated) {
+        __sync_fetch_and_or(word, mask);
+    } else {
+        __sync_fetch_and_and(word, ~mask);
+    }
+}
+
+void
+backend_alloc_mark(struct _backend *backend, uint64_t obj_id, int allocated)
+{
+    if (backend == NULL || backend->alloc_map == NULL ||
+            obj_id >= le64toh(backend->alloc_hdr->nbits)) {
+        return;
+    }
+
+    uint64_t *word = &backend->alloc_map[obj_id / 64];
+    backend_alloc_mark_word(backend, word, 1ULL << (obj_id % 64), allocated);
+
+    if (backend->sync_type == 0) {
+        backend->flush(word, sizeof(*word)); // SYNC, drained with tx slot
+    } else if (backend->sync_type == 2) {
+        backend->persist(word, sizeof(*word)); // SELSYNC
+    }
+}
+
+void
+backend_alloc_mark_range(struct _backend *backend, uint64_t begin, uint64_t end,
+        int allocated)
+{
+    if (backend == NULL || backend->alloc_map == NULL || begin > end ||
+            end >= le64toh(backend->alloc_hdr->nbits)) {
+        return;
+    }
+
+    uint64_t first = begin / 64;
+    uint64_t last = end / 64;
+    uint64_t head_mask = ~0ULL << (begin % 64);
+    uint64_t tail_mask = ~0ULL >> (63 - end % 64);
+
+    if (first == last) {
+        backend_alloc_mark_word(backend, &backend->alloc_map[first],
+                head_mask & tail_mask, allocated);
+        return;
+    }
+
+    /* words fully covered by the range don't share bits with anyone else */
+    backend_alloc_mark_word(backend, &backend->alloc_map[first], head_mask,
+            allocated);
+    for (uint64_t i = first + 1; i < last; i++) {
+        backend->alloc_map[i] = allocated ? ~0ULL : 0;
+    }
+    backend_alloc_mark_word(backend, &backend->alloc_map[last], tail_mask,
+            allocated);
+}
+
+void
+backend_alloc_persist(struct _backend *backend)
+{
+    if (backend == NULL || backend->alloc_map == NULL) {
+        return;
+    }
+
+    backend->persist(backend->alloc_map, backend->alloc_map_size);
+}
+
+int
+backend_alloc_test(struct _backend *backend, uint64_t obj_id)
+{
+    if (backend == NULL || backend->alloc_map == NULL) {
+        return 1;
+    }
+    if (obj_id >= le64toh(backend->alloc_hdr->nbits)) {
+        return 0;
+    }
+
+    return (backend->alloc_map[obj_id / 64] >> (obj_id % 64)) & 1;
+}
+
+uint64_t *
+backend_free_snap(struct _backend *backend, size_t *max_ranges)
+{
+    if (backend == NULL || backend->snap_hdr == NULL) {
+        *max_ranges = 0;
+        return NULL;
+    }
+
+    *max_ranges = backend->snap_max;
+    return backend->snap_ranges;
+}
+
+/*
+ * backend_free_snap_len -- (internal) returns length of the snapshot area
+ * covered by the checksum
+ */
+static size_t
+backend_free_snap_len(struct _backend *backend)
+{
+    uint64_t nranges = le64toh(backend->snap_hdr->nranges[0]) +
+            le64toh(backend->snap_hdr->nranges[1]);
+    return PMB_FORMAT_DATA_ALIGN + nranges * 2 * sizeof(uint64_t);
+}
+
+void
+backend_free_snap_save(struct _backend *backend, size_t ndata, size_t nmeta)
+{
+    if (backend == NULL || backend->snap_hdr == NULL ||
+            ndata + nmeta > backend->snap_max) {
+        return;
+    }
+
+    backend->persist(backend->snap_ranges,
+            (ndata + nmeta) * 2 * sizeof(uint64_t));
+
+    backend->snap_hdr->nranges[0] = htole64(ndata);
+    backend->snap_hdr->nranges[1] = htole64(nmeta);
+    backend->snap_hdr->valid = htole32(1);
+    backend->checksum(backend->snap_hdr, backend_free_snap_len(backend),
+            &backend->snap_hdr->flch64, 1);
+    backend->persist(backend->snap_hdr, sizeof(*backend->snap_hdr));
+}
+
+uint64_t *
+backend_free_snap_load(struct _backend *backend, size_t *ndata, size_t *nmeta)
+{
+    if (backend == NULL || backend->snap_hdr == NULL ||
+            le32toh(backend->snap_hdr->valid) != 1) {
+        return NULL;
+    }
+
+    *ndata = le64toh(backend->snap_hdr->nranges[0]);
+    *nmeta = le64toh(backend->snap_hdr->nranges[1]);
+    if (*ndata + *nmeta > backend->snap_max ||
+            !backend->checksum(backend->snap_hdr, backend_free_snap_len(backend),
+                    &backend->snap_hdr->flch64, 0)) {
+        LOG(1, "free-list snapshot corrupted");
+        return NULL;
+    }
+
+    return backend->snap_ranges;
+}
+
+void
+backend_free_snap_invalidate(struct _backend *backend)
+{
+    if (backend == NULL || backend->snap_hdr == NULL) {
+        return;
+    }
+
+    backend->snap_hdr->valid = 0;
+    backend->persist(&backend->snap_hdr->valid,
+            sizeof(backend->snap_hdr->valid));
+}
+
+/*
+ * backend_key_hash -- (internal) FNV-1a hash of the key, never 0
+ */
+static uint64_t
+backend_key_hash(const void *key, uint32_t key_len)
+{
+    const uint8_t *p = key;
+    uint64_t hash = 14695981039346656037ULL;
+    for (uint32_t i = 0; i < key_len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 32;
+
+    return hash ? hash : 1;
+}
+
+/*
+ * backend_key_index_block -- (internal) returns header of live data block
+ * and hash of its key, NULL if block is empty or outside data area
+ */
+static pmb_data_hdr *
+backend_key_index_block(struct _backend *backend, uint64_t obj_id,
+        uint64_t *hash)
+{
+    if (obj_id == 0 || obj_id >= backend->data_nlba) {
+        return NULL;
+    }
+
+    pmb_data_hdr *hdr = backend_direct(backend, obj_id);
+    if (hdr->flch64 == 0 || hdr->key_len == 0 ||
+            hdr->key_len > le32toh(backend->max_key_len)) {
+        return NULL;
+    }
+
+    *hash = backend_key_hash((void *)hdr + sizeof(pmb_data_hdr), hdr->key_len);
+    return hdr;
+}
+
+/*
+ * backend_key_index_flush -- (internal) same durability as allocation bitmap
+ */
+static void
+backend_key_index_flush(struct _backend *backend, struct key_index_entry *e)
+{
+    if (backend->sync_type == 0) {
+        backend->flush(e, sizeof(*e)); // SYNC, drained with tx slot
+    } else if (backend->sync_type == 2) {
+        backend->persist(e, sizeof(*e)); // SELSYNC
+    }
+}
+
+int
+backend_key_index_enabled(struct _backend *backend)
+{
+    return backend != NULL && backend->key_index != NULL;
+}
+
+void
+backend_key_index_insert(struct _backend *backend, uint64_t obj_id)
+{
+    uint64_t hash;
+    if (!backend_key_index_enabled(backend) ||
+            backend_key_index_block(backend, obj_id, &hash) == NULL) {
+        return;
+    }
+
+    uint64_t mask = backend->key_index_mask;
+    struct key_index_entry *free_entry = NULL;
+    for (uint64_t n = 0; n <= mask; n++) {
+        struct key_index_entry *e = &backend->key_index[(hash + n) & mask];
+        if (e->hash == 0 && e->blk_id == 0) {
+            if (free_entry == NULL) {
+                free_entry = e;
+            }
+            break;
+        }
+        if (e->blk_id == obj_id && e->hash == hash) {
+            return; // replayed insert
+        }
+
+        // removed entries and ones left after crash are reused
+        uint64_t blk_hash;
+        if (free_entry == NULL && (e->blk_id == 0 ||
+                backend_key_index_block(backend, e->blk_id, &blk_hash) == NULL ||
+                blk_hash != e->hash)) {
+            free_entry = e;
+        }
+    }
+
+    if (free_entry == NULL) {
+        LOG(1, "key index full, block %" PRIu64 " not indexed", obj_id);
+        return;
+    }
+
+    free_entry->hash = hash;
+    __sync_synchronize();
+    free_entry->blk_id = obj_id;
+    backend_key_index_flush(backend, free_entry);
+}
+
+void
+backend_key_index_remove(struct _backend *backend, uint64_t obj_id)
+{
+    uint64_t hash;
+    if (!backend_key_index_enabled(backend) ||
+            backend_key_index_block(backend, obj_id, &hash) == NULL) {
+        return;
+    }
+
+    uint64_t mask = backend->key_index_mask;
+    for (uint64_t n = 0; n <= mask; n++) {
+        struct key_index_entry *e = &backend->key_index[(hash + n) & mask];
+        if (e->hash == 0 && e->blk_id == 0) {
+            return;
+        }
+        if (e->blk_id == obj_id) {
+            e->blk_id = 0;
+            backend_key_index_flush(backend, e);
+            return;
+        }
+    }
+}
+
+void
+backend_key_index_persist(struct _backend *backend)
+{
+    if (!backend_key_index_enabled(backend)) {
+        return;
+    }
+
+    backend->persist(backend->key_index,
+            (backend->key_index_mask + 1) * sizeof(struct key_index_entry));
+}
+
+uint64_t
+backend_key_index_find(struct _backend *backend, const void *key,
+        uint32_t key_len, uint64_t *pos)
+{
+    if (!backend_key_index_enabled(backend)) {
+        return 0;
+    }
+
+    uint64_t hash = backend_key_hash(key, key_len);
+    uint64_t mask = backend->key_index_mask;
+    while (*pos <= mask) {
+        struct key_index_entry *e = &backend->key_index[(hash + *pos) & mask];
+        (*pos)++;
+        uint64_t blk_id = e->blk_id;
+        if (e->hash == 0 && blk_id == 0) {
+            break;
+        }
+        if (e->hash != hash || blk_id == 0) {
+            continue;
+        }
+
+        uint64_t blk_hash;
+        pmb_data_hdr *hdr = backend_key_index_block(backend, blk_id, &blk_hash);
+        if (hdr != NULL && hdr->key_len == key_len &&
+                memcmp((void *)hdr + sizeof(pmb_data_hdr), key, key_len) == 0) {
+            return blk_id;
+        }
+    }
+
+    *pos = mask + 1;
+    return 0;
+}
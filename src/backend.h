@@ -36,6 +36,10 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define BACKEND_OK         0
 #define BACKEND_NO_BACKEND 1
 #define BACKEND_ENOENT     2
@@ -43,6 +47,17 @@
 #define BACKEND_FULL       4
 #define BACKEND_INV_ID     5
 
+/*
+ * States of the allocation bitmap:
+ * - DIRTY:  bitmap could be stale, blocks have to be validated with full scan
+ * - CLEAN:  bitmap saved at close, covered by the checksum
+ * - SYNCED: bitmap persisted with every transaction execute (PMB_SYNC and
+ *           PMB_SELSYNC), exact after replaying transaction log
+ */
+#define BACKEND_ALLOC_DIRTY  0
+#define BACKEND_ALLOC_CLEAN  1
+#define BACKEND_ALLOC_SYNCED 2
+
 typedef struct _backend backend;
 
 backend* backend_open(const char* path, size_t data_size, size_t meta_size,
@@ -55,12 +70,57 @@ backend* backend_create(const char* path, size_t data_size, size_t meta_size,
          size_t tx_slots, size_t tx_slot_size,
          uint32_t max_key_len, uint32_t max_val_len,
 		 uint32_t meta_max_key_len, uint32_t meta_max_val_len,
-         mode_t mode, uint8_t sync_type);
+         mode_t mode, uint8_t sync_type, uint8_t csum_type, uint8_t chunk_csum,
+         uint8_t key_index);
 
 uint8_t backend_get_sync_type(struct _backend* backend);
 
 void* backend_memcpy(struct _backend* backend, void* dest, const void* src, size_t num);
 
+// with PMB_SYNC copy is durable after backend_drain, otherwise same as
+// backend_memcpy
+void* backend_memcpy_nodrain(struct _backend* backend, void* dest,
+        const void* src, size_t num);
+
+/*
+ * Computes or verifies checksum with algorithm selected at pool creation, same
+ * semantics as util_checksum
+ */
+int backend_checksum(struct _backend* backend, void* addr, size_t len,
+        uint64_t* csump, int insert);
+
+/*
+ * Block checksums. Values in data blocks of pools created with chunk checksums
+ * have checksum of every BACKEND_CSUM_CHUNK bytes kept in a table at the block
+ * tail, header checksum covers header, key and folded checksum of the table.
+ * Otherwise whole block is covered by the header checksum and range is
+ * ignored.
+ *
+ * backend_block_checksum rehashes chunks overlapping <offset, offset + len)
+ * and the header. backend_block_verify checks the header and chunks
+ * overlapping the range, returns 1 if they're valid.
+ */
+#define BACKEND_CSUM_CHUNK 4096
+#define BACKEND_NCHUNKS(len) (((len) + BACKEND_CSUM_CHUNK - 1) / BACKEND_CSUM_CHUNK)
+
+void backend_block_checksum(struct _backend* backend, uint64_t obj_id,
+        uint32_t offset, uint32_t len);
+
+int backend_block_verify(struct _backend* backend, uint64_t obj_id,
+        uint32_t offset, uint32_t len);
+
+/*
+ * Flushing of ranges modified by transaction with PMB_SYNC, no-op for other
+ * sync types. backend_block_flush flushes the block header and
+ * <offset, offset + len) range of value with its chunk checksums, range
+ * starting at 0 is flushed along with the key, empty range flushes only the
+ * header. Nothing is durable until backend_drain or persist of tx slot.
+ */
+void backend_block_flush(struct _backend* backend, uint64_t obj_id,
+        uint32_t offset, uint32_t len);
+
+void backend_drain(struct _backend* backend);
+
 void  backend_close(struct _backend* backend);
 
 void* backend_direct(struct _backend* backend, uint64_t obj_id);
@@ -77,10 +137,82 @@ uint8_t backend_set_zero(struct _backend* backend, void* obj_ptr);
 
 uint8_t backend_tx_set_zero(struct _backend* backend, void* slot_ptr);
 
-void* backend_tx_direct(struct _backend* backen, uint8_t tx_id);
+void* backend_tx_direct(struct _backend* backen, uint32_t tx_id);
 
-uint8_t backend_tx_persist(struct _backend* backend, uint8_t tx_id, size_t size);
+// number of tx slots, saved in pool header
+uint32_t backend_tx_count(struct _backend* backend);
+
+// size of single tx slot in bytes
+size_t backend_tx_slot_size(struct _backend* backend);
+
+uint8_t backend_tx_persist(struct _backend* backend, uint32_t tx_id, size_t size);
+
+/*
+ * Persists several tx slots with single drain, or single msync of the range
+ * spanning them when pool isn't on PMEM
+ */
+void backend_tx_persist_batch(struct _backend* backend, const uint32_t* tx_ids,
+        const size_t* sizes, size_t count);
 
 size_t backend_nblock(struct _backend* backend, int meta);
 
+/*
+ * Allocation bitmap, bit per block id, set for blocks holding objects. Pools
+ * created without the bitmap report DIRTY state and ignore updates.
+ */
+uint8_t backend_alloc_state(struct _backend* backend);
+
+void backend_alloc_set_state(struct _backend* backend, uint8_t state);
+
+uint64_t* backend_alloc_map(struct _backend* backend, size_t* nwords);
+
+void backend_alloc_mark(struct _backend* backend, uint64_t obj_id, int allocated);
+
+void backend_alloc_mark_range(struct _backend* backend, uint64_t begin, uint64_t end,
+        int allocated);
+
+void backend_alloc_persist(struct _backend* backend);
+
+// returns 1 if block is marked as allocated or pool has no bitmap
+int backend_alloc_test(struct _backend* backend, uint64_t obj_id);
+
+/*
+ * Free-list snapshot, ranges of data and meta free lists saved at clean
+ * shutdown. backend_free_snap returns buffer for up to max_ranges <begin, end>
+ * pairs to be filled before backend_free_snap_save. backend_free_snap_load
+ * returns NULL unless there's valid snapshot.
+ */
+uint64_t* backend_free_snap(struct _backend* backend, size_t* max_ranges);
+
+void backend_free_snap_save(struct _backend* backend, size_t ndata, size_t nmeta);
+
+uint64_t* backend_free_snap_load(struct _backend* backend, size_t* ndata, size_t* nmeta);
+
+void backend_free_snap_invalidate(struct _backend* backend);
+
+/*
+ * Key index, hash table of data block ids by key hash kept after the snapshot
+ * in pools created with it. Key is read from the block, so block has to be
+ * written before insert and removed before it's cleared. Entries left after
+ * crash are reused by inserts, backend_key_index_find returns only blocks
+ * holding the key, starting from probe *pos, which is 0 for the first call,
+ * 0 is returned when there are no more. Updates have to be serialized by the
+ * caller, finds could run concurrently with them. Entries are durable like
+ * allocation bitmap, backend_key_index_persist persists whole index and is
+ * called together with backend_alloc_persist.
+ */
+int backend_key_index_enabled(struct _backend* backend);
+
+void backend_key_index_insert(struct _backend* backend, uint64_t obj_id);
+
+void backend_key_index_remove(struct _backend* backend, uint64_t obj_id);
+
+void backend_key_index_persist(struct _backend* backend);
+
+uint64_t backend_key_index_find(struct _backend* backend, const void* key,
+        uint32_t key_len, uint64_t* pos);
+
+#ifdef __cplusplus
+}
+#endif
 #endif//_BACKEND_H
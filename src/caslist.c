@@ -30,8 +30,12 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
 #include "caslist.h"
 
 // caslist constructor
@@ -50,29 +54,212 @@ caslist* caslist_new (uint64_t begin, uint64_t end)
     else
         list->size = end - begin + 1;
     list->next = NULL;
+    list->root = NULL;
+    list->shards = NULL;
+    list->nshards = 0;
+    list->members = NULL;
+    list->first = 0;
+    list->last = 0;
     pthread_mutex_init (&list->mutex, NULL);
     return list;
 }
 
-// returns one element from ranges or 0 if there's none available
-uint8_t caslist_pop (caslist* list, uint64_t* val)
+// sharded caslist constructor, one magazine per configured CPU
+caslist* caslist_new_sharded (uint64_t begin, uint64_t end, uint64_t first,
+        uint64_t last)
 {
-    if (!list || !val)
-        return 1;
+    if (first > last)
+        return NULL;
 
-    pthread_mutex_lock (&list->mutex);
+    caslist* list = caslist_new (begin, end);
+    if (!list)
+        return list;
 
-    if (list->begin == 0 && list->end == 0) {
-        *val = 0;
-        pthread_mutex_unlock(&list->mutex);
+    list->members = calloc ((last - first) / 64 + 1, sizeof (uint64_t));
+    if (!list->members) {
+        caslist_free (list);
+        return NULL;
+    }
+    list->first = first;
+    list->last = last;
+    uint64_t lo = begin > first ? begin : first;
+    uint64_t hi = end < last ? end : last;
+    for (uint64_t val = lo; begin != 0 && val <= hi; val++)
+        list->members[(val - first) / 64] |= 1ULL << ((val - first) % 64);
+
+    long ncpu = sysconf (_SC_NPROCESSORS_CONF);
+    uint32_t nshards = ncpu > 0 ? ncpu : 1;
+    void* shards;
+    if (posix_memalign (&shards, __alignof__ (caslist_shard),
+                nshards * sizeof (caslist_shard))) {
+        caslist_free (list);
+        return NULL;
+    }
+
+    list->shards = shards;
+    list->nshards = nshards;
+    for (uint32_t i = 0; i < list->nshards; i++) {
+        pthread_mutex_init (&list->shards[i].mutex, NULL);
+        list->shards[i].count = 0;
+    }
+    return list;
+}
+
+static caslist_link* _caslist_link_new (uint64_t begin, uint64_t end,
+        caslist_link* next)
+{
+    caslist_link* link = (caslist_link*) malloc (sizeof (caslist_link));
+    link->begin = begin;
+    link->end = end;
+    link->next = next;
+    link->left = NULL;
+    link->right = NULL;
+    link->height = 1;
+    return link;
+}
+
+/*
+ * AVL tree of links keyed by range begin. Ranges never overlap, so begin keys
+ * are unique and extending a range towards its neighbours doesn't change
+ * order of keys in the tree.
+ */
+static int32_t _caslist_tree_height (caslist_link* link)
+{
+    return link ? link->height : 0;
+}
+
+static void _caslist_tree_update (caslist_link* link)
+{
+    int32_t left = _caslist_tree_height (link->left);
+    int32_t right = _caslist_tree_height (link->right);
+    link->height = (left > right ? left : right) + 1;
+}
+
+static caslist_link* _caslist_tree_rotate_right (caslist_link* link)
+{
+    caslist_link* left = link->left;
+    link->left = left->right;
+    left->right = link;
+    _caslist_tree_update (link);
+    _caslist_tree_update (left);
+    return left;
+}
+
+static caslist_link* _caslist_tree_rotate_left (caslist_link* link)
+{
+    caslist_link* right = link->right;
+    link->right = right->left;
+    right->left = link;
+    _caslist_tree_update (link);
+    _caslist_tree_update (right);
+    return right;
+}
+
+static caslist_link* _caslist_tree_balance (caslist_link* link)
+{
+    _caslist_tree_update (link);
+    int32_t factor = _caslist_tree_height (link->left) - _caslist_tree_height (link->right);
+
+    if (factor > 1) {
+        if (_caslist_tree_height (link->left->left) < _caslist_tree_height (link->left->right))
+            link->left = _caslist_tree_rotate_left (link->left);
+        return _caslist_tree_rotate_right (link);
+    }
+
+    if (factor < -1) {
+        if (_caslist_tree_height (link->right->right) < _caslist_tree_height (link->right->left))
+            link->right = _caslist_tree_rotate_right (link->right);
+        return _caslist_tree_rotate_left (link);
+    }
+
+    return link;
+}
+
+static caslist_link* _caslist_tree_insert (caslist_link* root, caslist_link* link)
+{
+    if (!root)
+        return link;
+
+    if (link->begin < root->begin)
+        root->left = _caslist_tree_insert (root->left, link);
+    else
+        root->right = _caslist_tree_insert (root->right, link);
+
+    return _caslist_tree_balance (root);
+}
+
+// unlinks the lowest link from the tree, *min is set to it
+static caslist_link* _caslist_tree_remove_min (caslist_link* root, caslist_link** min)
+{
+    if (!root->left) {
+        *min = root;
+        return root->right;
+    }
+
+    root->left = _caslist_tree_remove_min (root->left, min);
+    return _caslist_tree_balance (root);
+}
+
+// unlinks link with given begin from the tree, link itself is not freed
+static caslist_link* _caslist_tree_remove (caslist_link* root, uint64_t begin)
+{
+    if (!root)
+        return NULL;
+
+    if (begin < root->begin) {
+        root->left = _caslist_tree_remove (root->left, begin);
+    } else if (begin > root->begin) {
+        root->right = _caslist_tree_remove (root->right, begin);
+    } else {
+        caslist_link* min;
+        if (!root->right)
+            return root->left;
+
+        caslist_link* right = _caslist_tree_remove_min (root->right, &min);
+        min->left = root->left;
+        min->right = right;
+        root = min;
+    }
+
+    return _caslist_tree_balance (root);
+}
+
+// returns link with the greatest begin not greater than val or NULL
+static caslist_link* _caslist_tree_floor (caslist_link* root, uint64_t val)
+{
+    caslist_link* floor = NULL;
+    while (root) {
+        if (root->begin <= val) {
+            floor = root;
+            root = root->right;
+        } else {
+            root = root->left;
+        }
+    }
+    return floor;
+}
+
+// takes up to max consecutive elements from the head range, list mutex has to
+// be held by caller
+static uint8_t _caslist_pop_range_locked (caslist* list, uint64_t max,
+        uint64_t* begin, uint64_t* end)
+{
+    if ((list->begin == 0 && list->end == 0) || max == 0) {
+        *begin = 0;
+        *end = 0;
         return 1;
     }
 
-    *val = list->begin;
-    list->begin++;
+    uint64_t count = list->end - list->begin + 1;
+    if (count > max)
+        count = max;
+
+    *begin = list->begin;
+    *end = list->begin + count - 1;
+    list->size -= count;
 
     // check if we depleted current range
-    if (list->begin > list->end) {
+    if (*end == list->end) {
         // we depleted current range
         if (list->next) {
             // next range is available, get copy boundaries and next range form
@@ -81,70 +268,368 @@ uint8_t caslist_pop (caslist* list, uint64_t* val)
             list->begin = next->begin;
             list->end = next->end;
             list->next = next->next;
+            list->root = _caslist_tree_remove (list->root, next->begin);
             free(next);
         } else {
             // next range is not available
             list->begin = 0;
             list->end = 0;
         }
+    } else {
+        list->begin += count;
     }
 
-    list->size--;
-    pthread_mutex_unlock(&list->mutex);
     return 0;
 }
 
-static bool _caslist_put (caslist_link* link, uint64_t val)
+// takes one element from ranges, list mutex has to be held by caller
+static uint8_t _caslist_pop_locked (caslist* list, uint64_t* val)
 {
-    if (val >= link->begin && val <= link->end)
-        return false;
+    uint64_t end;
+    return _caslist_pop_range_locked (list, 1, val, &end);
+}
+
+// takes up to n elements from ranges, list mutex has to be held by caller
+static size_t _caslist_pop_n_locked (caslist* list, uint64_t* vals, size_t n)
+{
+    size_t popped = 0;
+    uint64_t begin, end;
+    while (popped < n &&
+            _caslist_pop_range_locked (list, n - popped, &begin, &end) == 0) {
+        for (uint64_t val = begin; val <= end; val++)
+            vals[popped++] = val;
+    }
+    return popped;
+}
 
-    if (val == link->begin - 1) {
+// expands ranges with val, list mutex has to be held by caller
+//
+// head range lives in the list itself, all following ranges are kept both on
+// the sorted 'next' chain and in the AVL tree, so range which could absorb
+// val is found in O(log n) instead of walking the chain
+static void _caslist_push_locked (caslist* list, uint64_t val)
+{
+    if(list->begin <= val && list->end >= val)
+        return;
+
+    // check if main range is empty
+    if (list->begin == 0 && list->end == 0) {
+        list->begin = val;
+        list->end = val;
+        list->size++;
+        return;
+    }
+
+    if (val == list->begin - 1) {
         // it's just before current range, so just decrease it
-        link->begin--;
-        return true;
+        list->begin--;
+        list->size++;
+        return;
     }
 
-    if (val == link->end + 1) {
-        // it's just after current range, so expand it and check if merge with
-        // another range is possible
-        link->end++;
-        if (link->next) {
-            // try to merge current current range with next
-            if (link->end + 1 == link->next->begin) {
-                caslist_link* rm_link = link->next;
-                link->end = rm_link->end;
-                link->next = rm_link->next;
-                free (rm_link);
-            }
+    if (val < list->begin - 1) {
+        // prepend new range with value, current head range becomes the
+        // lowest link
+        caslist_link* new_link = _caslist_link_new (list->begin, list->end, list->next);
+        list->root = _caslist_tree_insert (list->root, new_link);
+        list->next = new_link;
+        list->begin = val;
+        list->end = val;
+        list->size++;
+        return;
+    }
+
+    // val is after head range, prev is range starting at or before val (head
+    // range when there's no such link), next is the range following it
+    caslist_link* prev = _caslist_tree_floor (list->root, val);
+    caslist_link* next = prev ? prev->next : list->next;
+    uint64_t* prev_end = prev ? &prev->end : &list->end;
+    caslist_link** prev_next = prev ? &prev->next : &list->next;
+
+    if (val <= *prev_end)
+        return;
+
+    if (val == *prev_end + 1) {
+        // it's just after previous range, so expand it and check if merge with
+        // next range is possible
+        (*prev_end)++;
+        if (next && *prev_end + 1 == next->begin) {
+            *prev_end = next->end;
+            *prev_next = next->next;
+            list->root = _caslist_tree_remove (list->root, next->begin);
+            free (next);
         }
+    } else if (next && val == next->begin - 1) {
+        // it's just before next range, order of ranges doesn't change
+        next->begin--;
+    } else {
+        // link new range between previous and next
+        caslist_link* new_link = _caslist_link_new (val, val, next);
+        list->root = _caslist_tree_insert (list->root, new_link);
+        *prev_next = new_link;
+    }
 
-        return true;
+    list->size++;
+}
+
+// merges links following the range ending at *end as long as they overlap or
+// touch it, returns number of ids which were already in merged links
+static uint64_t _caslist_absorb_locked (caslist* list, uint64_t* end,
+        caslist_link** next)
+{
+    uint64_t absorbed = 0;
+    while (*next && (*next)->begin <= *end + 1) {
+        caslist_link* link = *next;
+        absorbed += link->end - link->begin + 1;
+        if (link->end > *end)
+            *end = link->end;
+        *next = link->next;
+        list->root = _caslist_tree_remove (list->root, link->begin);
+        free (link);
     }
+    return absorbed;
+}
 
-    if (!link->next) {
-        // add new range after current
-        caslist_link* new_link = (caslist_link*) malloc (sizeof (caslist_link));
-        new_link->begin = val;
-        new_link->end = val;
-        new_link->next = NULL;
-        link->next = new_link;
-        return true;
+// expands ranges with <begin, end>, list mutex has to be held by caller
+static void _caslist_push_range_locked (caslist* list, uint64_t begin, uint64_t end)
+{
+    uint64_t old_len, absorbed;
+
+    // check if main range is empty
+    if (list->begin == 0 && list->end == 0) {
+        list->begin = begin;
+        list->end = end;
+        list->size += end - begin + 1;
+        return;
+    }
+
+    if (end + 1 < list->begin) {
+        // prepend new range, current head range becomes the lowest link
+        caslist_link* new_link = _caslist_link_new (list->begin, list->end, list->next);
+        list->root = _caslist_tree_insert (list->root, new_link);
+        list->next = new_link;
+        list->begin = begin;
+        list->end = end;
+        list->size += end - begin + 1;
+        return;
+    }
+
+    if (begin <= list->end + 1) {
+        // overlaps or touches head range
+        old_len = list->end - list->begin + 1;
+        if (begin < list->begin)
+            list->begin = begin;
+        if (end > list->end)
+            list->end = end;
+        absorbed = _caslist_absorb_locked (list, &list->end, &list->next);
+        list->size += list->end - list->begin + 1 - old_len - absorbed;
+        return;
     }
 
-    // check next range
-    if (val < link->next->begin - 1) {
-        // link with existing ranges
-        caslist_link* new_link = (caslist_link*) malloc (sizeof (caslist_link));
-        new_link->begin = val;
-        new_link->end = val;
-        new_link->next = link->next;
-        link->next = new_link;
+    caslist_link* prev = _caslist_tree_floor (list->root, begin);
+    caslist_link* next = prev ? prev->next : list->next;
+    uint64_t* prev_end = prev ? &prev->end : &list->end;
+    caslist_link** prev_next = prev ? &prev->next : &list->next;
+
+    if (prev && begin <= *prev_end + 1) {
+        // overlaps or touches previous range
+        old_len = prev->end - prev->begin + 1;
+        if (end > prev->end)
+            prev->end = end;
+        absorbed = _caslist_absorb_locked (list, &prev->end, &prev->next);
+        list->size += prev->end - prev->begin + 1 - old_len - absorbed;
+    } else if (next && next->begin <= end + 1) {
+        // overlaps or touches next range, order of ranges doesn't change
+        old_len = next->end - next->begin + 1;
+        next->begin = begin;
+        if (end > next->end)
+            next->end = end;
+        absorbed = _caslist_absorb_locked (list, &next->end, &next->next);
+        list->size += next->end - next->begin + 1 - old_len - absorbed;
+    } else {
+        // link new range between previous and next
+        caslist_link* new_link = _caslist_link_new (begin, end, next);
+        list->root = _caslist_tree_insert (list->root, new_link);
+        *prev_next = new_link;
+        list->size += end - begin + 1;
+    }
+}
+
+// returns magazine of the CPU current thread is running on
+static caslist_shard* _caslist_shard (caslist* list)
+{
+    int cpu = sched_getcpu ();
+    if (cpu < 0)
+        cpu = 0;
+    return &list->shards[cpu % list->nshards];
+}
+
+// marks val as held by the list, returns false if it's already there
+static bool _caslist_member_add (caslist* list, uint64_t val)
+{
+    if (!list->members || val < list->first || val > list->last)
         return true;
+
+    uint64_t bit = 1ULL << ((val - list->first) % 64);
+    uint64_t* word = &list->members[(val - list->first) / 64];
+    return !(__sync_fetch_and_or (word, bit) & bit);
+}
+
+// marks val as taken from the list, done before val is returned to the caller
+// so following push of the same id is never ignored
+static void _caslist_member_del (caslist* list, uint64_t val)
+{
+    if (!list->members || val < list->first || val > list->last)
+        return;
+
+    uint64_t bit = 1ULL << ((val - list->first) % 64);
+    __sync_fetch_and_and (&list->members[(val - list->first) / 64], ~bit);
+}
+
+// pushes ids of <begin, end> which are not held by the list yet, runs of new
+// ids are found a bitmap word at a time, list mutex has to be held
+static void _caslist_push_range_new_locked (caslist* list, uint64_t begin,
+        uint64_t end)
+{
+    if (!list->members || begin > list->last || end < list->first) {
+        _caslist_push_range_locked (list, begin, end);
+        return;
+    }
+
+    if (begin < list->first)
+        _caslist_push_range_locked (list, begin, list->first - 1);
+
+    uint64_t last = end < list->last ? end : list->last;
+    uint64_t val = begin > list->first ? begin : list->first;
+    uint64_t run = 0; // first id of pending run of new ids, 0 if there's none
+    while (val <= last) {
+        uint64_t shift = (val - list->first) % 64;
+        uint64_t n = 64 - shift;
+        if (n > last - val + 1)
+            n = last - val + 1;
+        uint64_t mask = (n == 64 ? ~0ULL : (1ULL << n) - 1) << shift;
+        uint64_t* word = &list->members[(val - list->first) / 64];
+        uint64_t added = mask & ~__sync_fetch_and_or (word, mask);
+
+        if (added == mask) {
+            if (!run)
+                run = val;
+            val += n;
+            continue;
+        }
+        for (uint64_t i = 0; i < n; i++, val++) {
+            if (added & (1ULL << (shift + i))) {
+                if (!run)
+                    run = val;
+            } else if (run) {
+                _caslist_push_range_locked (list, run, val - 1);
+                run = 0;
+            }
+        }
+    }
+    if (run)
+        _caslist_push_range_locked (list, run, last);
+
+    if (end > last)
+        _caslist_push_range_locked (list, last + 1, end);
+}
+
+// moves up to CASLIST_MAG_BATCH ids from ranges to the magazine, the lowest id
+// lands on top of the magazine so it's popped first
+static void _caslist_shard_refill (caslist* list, caslist_shard* shard)
+{
+    uint64_t ids[CASLIST_MAG_BATCH];
+    size_t n;
+
+    pthread_mutex_lock (&list->mutex);
+    n = _caslist_pop_n_locked (list, ids, CASLIST_MAG_BATCH);
+    pthread_mutex_unlock (&list->mutex);
+
+    while (n > 0)
+        shard->ids[shard->count++] = ids[--n];
+}
+
+// moves CASLIST_MAG_BATCH ids from the bottom of the magazine back to ranges
+static void _caslist_shard_flush (caslist* list, caslist_shard* shard)
+{
+    pthread_mutex_lock (&list->mutex);
+    for (size_t i = 0; i < CASLIST_MAG_BATCH; i++)
+        _caslist_push_locked (list, shard->ids[i]);
+    pthread_mutex_unlock (&list->mutex);
+
+    shard->count -= CASLIST_MAG_BATCH;
+    for (size_t i = 0; i < shard->count; i++)
+        shard->ids[i] = shard->ids[i + CASLIST_MAG_BATCH];
+}
+
+// takes an id cached by other CPU, used only when ranges are depleted
+static uint8_t _caslist_shard_steal (caslist* list, caslist_shard* own, uint64_t* val)
+{
+    for (uint32_t i = 0; i < list->nshards; i++) {
+        caslist_shard* shard = &list->shards[i];
+        if (shard == own)
+            continue;
+
+        pthread_mutex_lock (&shard->mutex);
+        if (shard->count) {
+            *val = shard->ids[--shard->count];
+            _caslist_member_del (list, *val);
+            pthread_mutex_unlock (&shard->mutex);
+            return 0;
+        }
+        pthread_mutex_unlock (&shard->mutex);
     }
 
-    // val is in the next range
-    return _caslist_put(link->next, val);
+    *val = 0;
+    return 1;
+}
+
+static uint8_t _caslist_shard_pop (caslist* list, uint64_t* val)
+{
+    caslist_shard* shard = _caslist_shard (list);
+
+    pthread_mutex_lock (&shard->mutex);
+    if (!shard->count)
+        _caslist_shard_refill (list, shard);
+
+    if (shard->count) {
+        *val = shard->ids[--shard->count];
+        _caslist_member_del (list, *val);
+        pthread_mutex_unlock (&shard->mutex);
+        return 0;
+    }
+    pthread_mutex_unlock (&shard->mutex);
+
+    return _caslist_shard_steal (list, shard, val);
+}
+
+static void _caslist_shard_push (caslist* list, uint64_t val)
+{
+    if (!_caslist_member_add (list, val))
+        return;
+
+    caslist_shard* shard = _caslist_shard (list);
+
+    pthread_mutex_lock (&shard->mutex);
+    if (shard->count == CASLIST_MAG_SIZE)
+        _caslist_shard_flush (list, shard);
+    shard->ids[shard->count++] = val;
+    pthread_mutex_unlock (&shard->mutex);
+}
+
+// returns one element from ranges or 0 if there's none available
+uint8_t caslist_pop (caslist* list, uint64_t* val)
+{
+    if (!list || !val)
+        return 1;
+
+    if (list->shards)
+        return _caslist_shard_pop (list, val);
+
+    pthread_mutex_lock (&list->mutex);
+    uint8_t ret = _caslist_pop_locked (list, val);
+    pthread_mutex_unlock (&list->mutex);
+    return ret;
 }
 
 // expands ranges with val
@@ -153,90 +638,178 @@ void caslist_push (caslist* list, uint64_t val)
     if (!list || val == 0)
         return;
 
+    if (list->shards) {
+        _caslist_shard_push (list, val);
+        return;
+    }
+
     pthread_mutex_lock (&list->mutex);
+    _caslist_push_locked (list, val);
+    pthread_mutex_unlock (&list->mutex);
+}
 
-    if(list->begin <= val && list->end >= val)
-        goto end;
+// takes up to n values in single critical section, returns number of values
+// stored in vals
+size_t caslist_pop_n (caslist* list, uint64_t* vals, size_t n)
+{
+    if (!list || !vals)
+        return 0;
 
-    // check if main range is empty
-    if (list->begin == 0 && list->end == 0) {
-        list->begin = val;
-        list->end = val;
-        list->size++;
-        goto end;
+    size_t popped = 0;
+    if (list->shards) {
+        // drain own magazine first, it's not shared with anyone in most cases
+        caslist_shard* shard = _caslist_shard (list);
+        pthread_mutex_lock (&shard->mutex);
+        while (popped < n && shard->count) {
+            vals[popped] = shard->ids[--shard->count];
+            _caslist_member_del (list, vals[popped++]);
+        }
+        pthread_mutex_unlock (&shard->mutex);
     }
 
-    if (val == list->begin - 1) {
-        // it's just before current range, so just decrease it
-        list->begin--;
-        list->size++;
-        goto end;
+    pthread_mutex_lock (&list->mutex);
+    size_t from = popped;
+    popped += _caslist_pop_n_locked (list, vals + popped, n - popped);
+    pthread_mutex_unlock (&list->mutex);
+    for (size_t i = from; i < popped; i++)
+        _caslist_member_del (list, vals[i]);
+
+    while (list->shards && popped < n &&
+            _caslist_shard_steal (list, NULL, &vals[popped]) == 0)
+        popped++;
+
+    return popped;
+}
+
+// takes up to max consecutive values, returns 0 on success, 1 on failure
+uint8_t caslist_pop_range (caslist* list, uint64_t max, uint64_t* begin, uint64_t* end)
+{
+    if (!list || !begin || !end)
+        return 1;
+
+    pthread_mutex_lock (&list->mutex);
+    uint8_t ret = _caslist_pop_range_locked (list, max, begin, end);
+    pthread_mutex_unlock (&list->mutex);
+
+    for (uint64_t val = *begin; ret == 0 && list->members && val <= *end; val++)
+        _caslist_member_del (list, val);
+    return ret;
+}
+
+// expands ranges with all values from <begin, end> in single critical section
+void caslist_push_range (caslist* list, uint64_t begin, uint64_t end)
+{
+    if (!list || begin == 0 || begin > end)
+        return;
+
+    pthread_mutex_lock (&list->mutex);
+    _caslist_push_range_new_locked (list, begin, end);
+    pthread_mutex_unlock (&list->mutex);
+}
+
+// expands ranges with n values in single critical section
+void caslist_push_n (caslist* list, const uint64_t* vals, size_t n)
+{
+    if (!list || !vals || n == 0)
+        return;
+
+    pthread_mutex_lock (&list->mutex);
+    for (size_t i = 0; i < n; i++) {
+        if (vals[i] && _caslist_member_add (list, vals[i]))
+            _caslist_push_locked (list, vals[i]);
     }
+    pthread_mutex_unlock (&list->mutex);
+}
 
-    if (val == list->end + 1) {
-        // it's just after current range, so expand it and check if merge with
-        // another range is possible
-        list->end++;
-        if (list->next) {
-            // try to merge current current range with next
-            if (list->end + 1 == list->next->begin) {
-                caslist_link* rm_link = list->next;
-                list->end = rm_link->end;
-                list->next = rm_link->next;
-                free(rm_link);
-            }
+// moves ranges and cached ids of src to the list
+void caslist_merge (caslist* list, caslist* src)
+{
+    if (!list || !src || list == src)
+        return;
+
+    for (uint32_t i = 0; i < src->nshards; i++) {
+        caslist_shard* shard = &src->shards[i];
+        pthread_mutex_lock (&shard->mutex);
+        pthread_mutex_lock (&list->mutex);
+        for (size_t j = 0; j < shard->count; j++) {
+            _caslist_member_del (src, shard->ids[j]);
+            if (_caslist_member_add (list, shard->ids[j]))
+                _caslist_push_locked (list, shard->ids[j]);
         }
+        shard->count = 0;
+        pthread_mutex_unlock (&list->mutex);
+        pthread_mutex_unlock (&shard->mutex);
+    }
 
-        list->size++;
-        goto end;
+    pthread_mutex_lock (&src->mutex);
+    pthread_mutex_lock (&list->mutex);
+    if (src->begin != 0 || src->end != 0)
+        _caslist_push_range_new_locked (list, src->begin, src->end);
+
+    caslist_link* link = src->next;
+    caslist_link* next;
+    while (link) {
+        _caslist_push_range_new_locked (list, link->begin, link->end);
+        next = link->next;
+        free (link);
+        link = next;
     }
+    pthread_mutex_unlock (&list->mutex);
 
-    // val could be:
-    // - before current range but not mergable
-    // - after current range and there's no range after it
-    // - between current range an the next range
-    // - in the next range
-    if (val < list->begin - 1) {
-        // prepend new range with value
-        caslist_link* new_link = (caslist_link*) malloc (sizeof (caslist_link));
-        new_link->begin = list->begin;
-        new_link->end = list->end;
-        new_link->next = list->next;
-        list->next = new_link;
-        list->begin = val;
-        list->end = val;
-        list->size++;
-        goto end;
+    src->begin = 0;
+    src->end = 0;
+    src->size = 0;
+    src->next = NULL;
+    src->root = NULL;
+    if (src->members)
+        memset (src->members, 0,
+                ((src->last - src->first) / 64 + 1) * sizeof (uint64_t));
+    pthread_mutex_unlock (&src->mutex);
+}
+
+// exports ranges as <begin, end> pairs, returns number of ranges or
+// (size_t)-1 if they don't fit into max pairs
+size_t caslist_ranges (caslist* list, uint64_t* ranges, size_t max)
+{
+    if (!list || !ranges)
+        return (size_t)-1;
+
+    // shard mutex is always taken before the list one
+    for (uint32_t i = 0; i < list->nshards; i++) {
+        caslist_shard* shard = &list->shards[i];
+        pthread_mutex_lock (&shard->mutex);
+        pthread_mutex_lock (&list->mutex);
+        for (size_t j = 0; j < shard->count; j++)
+            _caslist_push_locked (list, shard->ids[j]);
+        shard->count = 0;
+        pthread_mutex_unlock (&list->mutex);
+        pthread_mutex_unlock (&shard->mutex);
     }
 
-    if (!list->next) {
-        // add new range after current
-        caslist_link *new_link = (caslist_link *) malloc(sizeof(caslist_link));
-        new_link->begin = val;
-        new_link->end = val;
-        new_link->next = NULL;
-        list->next = new_link;
-        list->size++;
-    } else {
-        // check next range
-        if (val < list->next->begin - 1) {
-            // link with existing ranges
-            caslist_link *new_link = (caslist_link *) malloc(sizeof(caslist_link));
-            new_link->begin = val;
-            new_link->end = val;
-            new_link->next = list->next;
-            list->next = new_link;
-            list->size++;
-        } else {
-            // val is in the next range
-            if (_caslist_put(list->next, val))
-                list->size++;
+    size_t n = 0;
+    pthread_mutex_lock (&list->mutex);
+    if (list->begin != 0 || list->end != 0) {
+        if (n == max) {
+            pthread_mutex_unlock (&list->mutex);
+            return (size_t)-1;
         }
+        ranges[2 * n] = list->begin;
+        ranges[2 * n + 1] = list->end;
+        n++;
     }
 
-end:
+    for (caslist_link* link = list->next; link; link = link->next) {
+        if (n == max) {
+            pthread_mutex_unlock (&list->mutex);
+            return (size_t)-1;
+        }
+        ranges[2 * n] = link->begin;
+        ranges[2 * n + 1] = link->end;
+        n++;
+    }
     pthread_mutex_unlock (&list->mutex);
-    return;
+
+    return n;
 }
 
 // caslist destructor
@@ -258,6 +831,13 @@ void caslist_free (caslist* list)
 
     pthread_mutex_unlock (&list->mutex);
     pthread_mutex_destroy (&list->mutex);
+
+    if (list->shards) {
+        for (uint32_t i = 0; i < list->nshards; i++)
+            pthread_mutex_destroy (&list->shards[i].mutex);
+        free (list->shards);
+    }
+    free (list->members);
     free (list);
 }
 
@@ -272,5 +852,11 @@ ssize_t caslist_size (caslist* list)
     size = list->size;
     pthread_mutex_unlock (&list->mutex);
 
+    for (uint32_t i = 0; i < list->nshards; i++) {
+        pthread_mutex_lock (&list->shards[i].mutex);
+        size += list->shards[i].count;
+        pthread_mutex_unlock (&list->shards[i].mutex);
+    }
+
     return size;
 }
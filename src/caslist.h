@@ -43,15 +43,35 @@ extern "C" {
 typedef struct _caslist_link {
     uint64_t begin;
     uint64_t end;
-    struct _caslist_link* next;
+    struct _caslist_link* next;  // following range, links are sorted by begin
+    struct _caslist_link* left;  // AVL tree of links, used to find range for
+    struct _caslist_link* right; // pushed value without walking the chain
+    int32_t height;
 } caslist_link;
 
+// number of ids cached by a single per-CPU magazine
+#define CASLIST_MAG_SIZE  64
+// number of ids moved between a magazine and the shared ranges at once
+#define CASLIST_MAG_BATCH 32
+
+typedef struct _caslist_shard {
+    pthread_mutex_t mutex;
+    size_t count;
+    uint64_t ids[CASLIST_MAG_SIZE];
+} __attribute__((aligned(64))) caslist_shard;
+
 typedef struct _caslist {
     ssize_t size;
     uint64_t begin;
     uint64_t end;
     pthread_mutex_t mutex;
     caslist_link* next;
+    caslist_link* root;    // root of AVL tree with all links
+    caslist_shard* shards; // per-CPU magazines, NULL for plain list
+    uint32_t nshards;
+    uint64_t* members;     // bit per id of <first, last> held by sharded list
+    uint64_t first;
+    uint64_t last;
 } caslist;
 
 // returns pointer to the new caslist with begin and end defined or NULL
@@ -60,6 +80,15 @@ typedef struct _caslist {
 // it's not allowed to create list with range: begin = 0, end > 0
 caslist* caslist_new (uint64_t begin, uint64_t end);
 
+// same as caslist_new, but pop and push are served from per-CPU magazines of
+// ids which are refilled from and flushed to the shared ranges in batches,
+// so the list mutex is taken once per CASLIST_MAG_BATCH operations;
+// magazines can't be searched, so ids of <first, last> held by the list are
+// tracked in a bitmap and pushing an id which is already there is ignored like
+// in plain list, ids outside of <first, last> are not checked
+caslist* caslist_new_sharded (uint64_t begin, uint64_t end, uint64_t first,
+        uint64_t last);
+
 // gets next value from caslist defined ranges, returns 0 on success, 1 on failure
 // val - out value
 uint8_t caslist_pop (caslist* list, uint64_t* val);
@@ -68,10 +97,36 @@ uint8_t caslist_pop (caslist* list, uint64_t* val);
 // val - in value
 void caslist_push (caslist* list, uint64_t val);
 
+// gets up to n values in single critical section, returns number of values
+// stored in vals
+size_t caslist_pop_n (caslist* list, uint64_t* vals, size_t n);
+
+// gets up to max consecutive values <begin, end> in single critical section,
+// returns 0 on success, 1 on failure, per-CPU magazines are not used
+uint8_t caslist_pop_range (caslist* list, uint64_t max, uint64_t* begin, uint64_t* end);
+
+// adds all values from <begin, end> to the caslist ranges in single critical
+// section, per-CPU magazines are bypassed
+void caslist_push_range (caslist* list, uint64_t begin, uint64_t end);
+
+// adds n values to the caslist ranges in single critical section, per-CPU
+// magazines are bypassed
+void caslist_push_n (caslist* list, const uint64_t* vals, size_t n);
+
+// moves all values from src to the list in single critical section, src is
+// left empty, used to merge lists built locally by separate threads
+void caslist_merge (caslist* list, caslist* src);
+
+// stores ranges of the list as <begin, end> pairs in ranges, ids cached in
+// per-CPU magazines are returned to the ranges first; returns number of ranges
+// or (size_t)-1 if there's more than max of them
+size_t caslist_ranges (caslist* list, uint64_t* ranges, size_t max);
+
 // deallocates the list and associated structures
 void caslist_free (caslist* list);
 
-// return combined length of all ranges in the list
+// return combined length of all ranges in the list, including ids cached in
+// per-CPU magazines
 ssize_t caslist_size (caslist* list);
 
 #ifdef __cplusplus
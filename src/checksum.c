@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY LOG OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <endian.h>
+
+#include "checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_HW 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78 // reflected Castagnoli polynomial
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t* buf, size_t len);
+
+static uint32_t crc32c_table[8][256];
+static crc32c_fn crc32c_update;
+
+/*
+ * crc32c_sw -- (internal) slicing-by-8, eight bytes consumed per step with
+ * independent table lookups
+ */
+static uint32_t
+crc32c_sw(uint32_t crc, const uint8_t* buf, size_t len)
+{
+    while (len && ((uintptr_t)buf & 7)) {
+        crc = crc32c_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, buf, sizeof(word));
+        word = le64toh(word) ^ crc;
+        crc = crc32c_table[7][word & 0xff] ^
+              crc32c_table[6][(word >> 8) & 0xff] ^
+              crc32c_table[5][(word >> 16) & 0xff] ^
+              crc32c_table[4][(word >> 24) & 0xff] ^
+              crc32c_table[3][(word >> 32) & 0xff] ^
+              crc32c_table[2][(word >> 40) & 0xff] ^
+              crc32c_table[1][(word >> 48) & 0xff] ^
+              crc32c_table[0][word >> 56];
+        buf += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = crc32c_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#ifdef CRC32C_HW
+/*
+ * crc32c_hw -- (internal) SSE4.2 crc32 instruction, compiled for SSE4.2 only
+ * in this function, it's selected at runtime when CPU supports it
+ */
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_hw(uint32_t crc, const uint8_t* buf, size_t len)
+{
+    while (len && ((uintptr_t)buf & 7)) {
+        crc = _mm_crc32_u8(crc, *buf++);
+        len--;
+    }
+
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        crc64 = _mm_crc32_u64(crc64, *(const uint64_t *)buf);
+        buf += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+
+    while (len >= 4) {
+        crc = _mm_crc32_u32(crc, *(const uint32_t *)buf);
+        buf += 4;
+        len -= 4;
+    }
+
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *buf++);
+    }
+
+    return crc;
+}
+#endif
+
+/*
+ * crc32c_init -- (internal) builds lookup tables and selects implementation
+ */
+__attribute__((constructor))
+static void
+crc32c_init(void)
+{
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][n] = crc;
+    }
+
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = crc32c_table[0][n];
+        for (int k = 1; k < 8; k++) {
+            crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+            crc32c_table[k][n] = crc;
+        }
+    }
+
+    crc32c_update = crc32c_sw;
+#ifdef CRC32C_HW
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_update = crc32c_hw;
+    }
+#endif
+}
+
+uint32_t
+crc32c(uint32_t crc, const void* buf, size_t len)
+{
+    return ~crc32c_update(~crc, buf, len);
+}
+
+int
+checksum_crc32c(void* addr, size_t len, uint64_t* csump, int insert)
+{
+    static const uint8_t zero[sizeof(uint64_t)];
+    const uint8_t* begin = addr;
+    const uint8_t* end = begin + len;
+    const uint8_t* csum_ptr = (const uint8_t *)csump;
+    uint32_t crc = ~0U;
+
+    if (csum_ptr >= begin && csum_ptr + sizeof(uint64_t) <= end) {
+        crc = crc32c_update(crc, begin, csum_ptr - begin);
+        crc = crc32c_update(crc, zero, sizeof(zero));
+        csum_ptr += sizeof(uint64_t);
+        crc = crc32c_update(crc, csum_ptr, end - csum_ptr);
+    } else {
+        crc = crc32c_update(crc, begin, len);
+    }
+
+    uint64_t csum = htole64(CHECKSUM_CRC32C_TAG | (uint32_t)~crc);
+    if (insert) {
+        *csump = csum;
+        return 1;
+    }
+
+    return *csump == csum;
+}
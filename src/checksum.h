@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY LOG OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Checksum function with util_checksum semantics: checksum of <addr, addr + len)
+ * is computed with 8 bytes at csump treated as zero, then stored at csump when
+ * insert is set, otherwise compared with value at csump. Returns 1 when stored
+ * value matches.
+ */
+typedef int (*checksum_fn)(void* addr, size_t len, uint64_t* csump, int insert);
+
+// CRC32C kept in lower half of stored value, upper half holds tag, so valid
+// checksum is never 0, which marks empty block
+#define CHECKSUM_CRC32C_TAG (0x43524343ULL << 32)
+
+// CRC32C (Castagnoli) checksum, uses SSE4.2 crc32 instruction when CPU
+// supports it and slicing-by-8 tables otherwise
+int checksum_crc32c(void* addr, size_t len, uint64_t* csump, int insert);
+
+// continues CRC32C of previous buffers, crc of empty buffer is 0
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //CHECKSUM_H
@@ -50,6 +50,7 @@ typedef struct {
     uint32_t version;
     uint32_t key_len;
     uint32_t val_len;
+    uint32_t chunk_csum; // folded checksum of chunk checksum table
 } pmb_data_hdr;
 
 typedef struct {
@@ -64,15 +65,81 @@ typedef struct _tx_meta {
 	struct _tx_meta* next;
 	uint64_t id;
 	uint32_t version;
+	uint32_t base;   // version of block when first updated by transaction
 	uint32_t val_len;
-	uint32_t offset;
+	uint32_t offset; // value range modified by transaction, rehashed
+	uint32_t end;    // at execute
 } tx_meta;
 
+// initial number of blocks tracked per slot, list grows when needed
+#define TX_METALIST_INIT 16
+
+/*
+ * Entry of open addressing index over tx_metalist, it's valid only when gen
+ * matches generation of the list, so list is reset without clearing index
+ */
+typedef struct {
+	uint32_t gen;
+	uint32_t pos; // position in list
+} tx_meta_idx;
+
 typedef struct {
 	size_t count;
+	size_t reserved; // blocks of logged updates not added yet
+	size_t capacity;
 	tx_meta *list;
+	tx_meta_idx *index; // 2 * capacity entries
+	uint32_t gen;
 } tx_metalist;
 
+/*
+ * Group commit state. Slots committed within window_us, but no more than
+ * max_batch of them, are persisted by committer thread at once with single
+ * drain. Committing threads wait until ticket they got is persisted.
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  pending_cond; // signalled when committer should wake up
+    pthread_cond_t  done_cond;    // broadcast after every persisted batch
+    uint32_t*       slots;        // ids of slots waiting for persist
+    size_t*         sizes;
+    size_t          count;
+    size_t          max_batch;
+    uint64_t        window_us;
+    uint64_t        queued;       // ticket of last queued slot
+    uint64_t        persisted;    // ticket of last persisted slot
+    uint8_t         stop;
+    pthread_t       thread;
+} tx_group;
+
+/*
+ * Background execute. Slots queued by pmb_tx_execute are executed and returned
+ * to the list of free slots by executor threads, pending flag of the slot is
+ * set until then. With batch above 1 single thread takes up to batch queued
+ * slots at once and applies their in-place updates ordered by block id.
+ * deferred counts blocks of queued slots per block id hash, so readers wait
+ * only for blocks with changes not yet applied. running counts blocks of slots
+ * taken by threads, slot touching any of them waits in the queue, so changes
+ * of the block are applied in commit order.
+ */
+#define TX_EXEC_FILTER 4096
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  queue_cond;   // signalled when slot is queued
+    pthread_cond_t  done_cond;    // broadcast after every executed slot
+    uint32_t*       queue;        // ring with ids of slots to execute
+    uint8_t*        pending;      // per slot, set while slot is queued
+    size_t          head;
+    size_t          count;
+    uint8_t         stop;
+    uint32_t        nthreads;
+    pthread_t*      threads;
+    uint32_t        batch;        // maximal number of slots executed together
+    uint32_t*       deferred;     // TX_EXEC_FILTER counters of queued blocks
+    uint32_t*       running;      // TX_EXEC_FILTER counters of executed blocks
+} tx_executor;
+
 /*
  * Structure defining transaction log. Before actual write first new data will be saved
  * to write log, and then persisted to actual block. Each block will be guarded
@@ -81,13 +148,40 @@ typedef struct {
  * number of write threads.
  */
 typedef struct {
-    uint8_t      tx_slots_count;   // number of available write log entries
-    uint32_t     tx_slot_capacity; // number of entries single transaction slot could keep
+    uint32_t     tx_slots_count;   // number of available write log entries
+    size_t       tx_slot_size;     // size of single transaction slot in bytes
     caslist*     tx_slots_list;    // list with available tx_slots
     tx_flush*    hard_flush_list;  // list with id's for hard flush
     tx_metalist* upd_id_list;      // list with blocks ids to metadata update
+    tx_group*    group;            // group commit or NULL if disabled
+    tx_executor* executor;         // background execute or NULL if disabled
+    void**       last_upd;         // in-place update entry at the end of each
+                                   // slot, NULL if other op follows it
 } tx_log;
 
+/*
+ * Full recovery validates blocks in chunks of RECOVERY_CHUNK ids. Chunk mutex
+ * is held while the chunk is scanned, chunk is never scanned twice. In lazy
+ * mode transactions modifying blocks from not yet scanned chunk scan it first,
+ * so background threads never see half-updated block.
+ */
+#define RECOVERY_CHUNK 4096
+
+typedef struct {
+    pthread_mutex_t  mutex;       // guards done, used with cond
+    pthread_cond_t   cond;        // broadcast after every scanned chunk
+    pthread_mutex_t* chunk_locks;
+    uint8_t*         scanned;     // set when chunk was validated
+    uint64_t         nchunks;
+    uint64_t         nblocks;     // ids below nblocks are validated
+    uint64_t         validated;   // number of validated blocks
+    uint64_t         next_chunk;  // next chunk to be taken by recovery thread
+    uint8_t          lazy;        // merge recovered blocks after every chunk
+    uint8_t          index;       // add valid data blocks to key index
+    uint8_t          done;
+    pthread_t        thread;      // background recovery in lazy mode
+} rc_state;
+
 /*
  * Main handle to object handle, used by all other functions to put/get/delete
  * objects from pool.
@@ -106,6 +200,13 @@ struct _pmb_handle {
     caslist*     meta_free_list;
     tx_log       op_log;           // for secure in-place data writes/updates
     pthread_t    sync_thread;      // thread for syncs
+    uint32_t     recovery_threads; // 0 - number of online CPUs
+    rc_state*    rc;               // running lazy recovery or NULL
+    uint32_t     inplace_max_len;  // updates shorter than it are done in place
+    uint32_t*    claims;           // per block id of tx slot holding it for
+                                   // conditional update, allocated by first
+                                   // pmb_tput_cas
+    pthread_mutex_t key_index_lock; // serializes updates of key index
 };
 
 struct pmb_iter {
@@ -119,6 +220,53 @@ struct pmb_iter {
  */
 uint8_t recovery(struct _pmb_handle* handle);
 
+/*
+ * Starts full recovery in background, pmb_open returns without waiting for it
+ */
+uint8_t recovery_start(struct _pmb_handle* handle);
+
+/*
+ * Validates chunk of blk_id if background recovery didn't reach it yet, has to
+ * be called before transaction modifies existing block
+ */
+void recovery_validate(struct _pmb_handle* handle, uint64_t blk_id);
+
+/*
+ * Indexes key of new_blk_id and removes old_blk_id from key index, 0 skips
+ * either. Has to be called when the transaction is executed, before old block
+ * is cleared.
+ */
+void key_index_update(struct _pmb_handle* handle, uint64_t new_blk_id,
+        uint64_t old_blk_id);
+
+/*
+ * Validates single block for pmb_get, returns PMB_ENOENT if block from not
+ * yet scanned chunk is corrupted
+ */
+uint8_t recovery_check(struct _pmb_handle* handle, uint64_t blk_id, void* obj);
+
+/*
+ * Takes block from free list, while background recovery is running waits for
+ * more free blocks to be found instead of failing
+ */
+uint8_t recovery_pop_free(struct _pmb_handle* handle, caslist* list, uint64_t* blk_id);
+
+/*
+ * Waits for background recovery and releases its state
+ */
+void recovery_stop(struct _pmb_handle* handle);
+
+/*
+ * Creates object list and free list from the allocation bitmap, used instead
+ * of recovery when bitmap is known to be exact
+ */
+uint8_t recovery_from_map(struct _pmb_handle* handle);
+
+/*
+ * Creates object list and free list from free-list snapshot saved by pmb_close
+ */
+uint8_t recovery_from_snapshot(struct _pmb_handle* handle);
+
 void populate_free_list(struct _pmb_handle* handle);
 
 /*
@@ -131,12 +279,15 @@ void populate_free_list(struct _pmb_handle* handle);
  * - PROCESSING: before commit
  * - COMMITED:   after commit, before execute
  * - ABORTED:    after triggering pmb_tx_abort, all ops will be reverted
+ * - CHAINED:    overflow slot of transaction which didn't fit into one slot,
+ *               state is kept by the head slot
  */
 typedef enum {
     EMPTY,
     PROCESSING,
     COMMITED,
-    ABORTED
+    ABORTED,
+    CHAINED
 } tx_status;
 
 /*
@@ -168,15 +319,42 @@ typedef struct {
 typedef struct {
     uint64_t  flch64;
     tx_status status;
+    uint32_t  next;   // 1-based id of chained overflow slot, 0 if none
     size_t    size;
 } tx_slot;
 
-void tx_log_init(struct _pmb_handle *handle, uint8_t tx_log_slots);
+// with slot_cache free slots are kept in per-CPU magazines of sharded caslist
+void tx_log_init(struct _pmb_handle *handle, uint32_t tx_log_slots,
+        uint8_t slot_cache);
 
 void tx_log_check(struct _pmb_handle *handle);
 
 void tx_log_free(struct _pmb_handle *handle);
 
+// starts group commit thread, max_batch 0 means all tx slots
+uint8_t tx_log_group_start(struct _pmb_handle *handle, uint64_t window_us,
+        size_t max_batch);
+
+/*
+ * Background execute: tx_log_exec_queue returns right after committed slot is
+ * queued, tx_log_exec_wait waits until it's executed and tx_log_exec_stop
+ * executes all queued slots before threads exit. tx_log_exec_wait_blk waits
+ * until queued changes of the block are applied.
+ */
+uint8_t tx_log_exec_start(struct _pmb_handle *handle, uint32_t nthreads,
+        uint32_t batch);
+
+uint8_t tx_log_exec_queue(struct _pmb_handle *handle, uint64_t tx_slot);
+
+void tx_log_exec_wait(struct _pmb_handle *handle, uint64_t tx_slot);
+
+void tx_log_exec_wait_blk(struct _pmb_handle *handle, uint64_t blk_id);
+
+void tx_log_exec_stop(struct _pmb_handle *handle);
+
+// returns 1 when no transaction slot holds pending operations
+uint8_t tx_log_empty(struct _pmb_handle *handle);
+
 uint64_t tx_log_get_slot(struct _pmb_handle *handle, uint64_t *tx_slot_pt);
 
 void tx_log_free_slot(struct _pmb_handle *handle, uint64_t tx_slot);
@@ -193,6 +371,18 @@ uint8_t tx_slot_op_write(struct _pmb_handle *handle, uint64_t tx_slot, uint64_t
 
 uint8_t tx_slot_op_update(struct _pmb_handle *handle, uint64_t tx_slot, uint64_t old_blk_id, uint64_t new_blk_id, uint32_t size);
 
+/*
+ * Registers n writes at once, UPDATE if old_blk_ids[i] is set, WRITE otherwise.
+ * Number of registered entries is stored in *done also on error.
+ */
+uint8_t tx_slot_op_write_n(struct _pmb_handle *handle, uint64_t tx_slot,
+        const uint64_t *old_blk_ids, const uint64_t *new_blk_ids, size_t n,
+        size_t *done);
+
+// smallest part of in-place update payload placed at the end of a slot before
+// the rest continues in the next one
+#define TX_UPDATE_MIN_PIECE 64
+
 uint8_t tx_slot_op_small_update(struct _pmb_handle *handle, uint64_t tx_slot, uint64_t blk_id, void *data, uint32_t offset, uint32_t size);
 
 uint8_t tx_slot_op_remove(struct _pmb_handle *handle, uint64_t tx_slot, uint64_t blk_id);
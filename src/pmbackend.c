@@ -30,6 +30,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
@@ -88,7 +89,22 @@ _sync_thread(void *args)
     return NULL;
 }
 
-#define TX_LOG_SIZE 128UL * 1024 * 1024
+#define TX_LOG_SIZE 128UL * 1024 * 1024 // default size of transaction log
+
+/*
+ * Sets state of allocation bitmap for open handle, with PMB_SYNC and
+ * PMB_SELSYNC every change to the bitmap is persisted immediately
+ */
+static void
+alloc_state_open(pmb_handle* handle)
+{
+    uint8_t sync_type = backend_get_sync_type(handle->backend);
+    if (sync_type == PMB_SYNC || sync_type == PMB_SELSYNC) {
+        backend_alloc_set_state(handle->backend, BACKEND_ALLOC_SYNCED);
+    } else {
+        backend_alloc_set_state(handle->backend, BACKEND_ALLOC_DIRTY);
+    }
+}
 
 pmb_handle*
 pmb_open(pmb_opts* opts, uint8_t* error)
@@ -99,17 +115,36 @@ pmb_open(pmb_opts* opts, uint8_t* error)
     // initialize and process write log
     // populate free list and validate saved data
     uint8_t empty;
+    uint8_t full_recovery = 0;
     pmb_handle* handle = NULL;
 
     tracepoint(pmbackend, pmb_open_enter, opts);
+    // fields added after the caller was built are left 0
+    pmb_opts known = PMB_OPTS_INIT;
+    if (opts->size < offsetof(pmb_opts, recovery_mode)) {
+        *error = PMB_EARGS;
+        return NULL;
+    }
+    memcpy(&known, opts, opts->size < sizeof(known) ? opts->size : sizeof(known));
+    opts = &known;
+
+    uint32_t tx_slots = opts->tx_slots ? opts->tx_slots : opts->write_log_entries;
+    if (tx_slots == 0) {
+        *error = PMB_EARGS;
+        return NULL;
+    }
+    uint64_t tx_log_size = opts->tx_log_size ? opts->tx_log_size : TX_LOG_SIZE;
+
     handle = malloc(sizeof(pmb_handle));
     if (handle == NULL) {
         *error = PMB_ERR;
         return NULL;
     }
+    handle->claims = NULL;
+    pthread_mutex_init(&handle->key_index_lock, NULL);
     // Fails when trying open existing store with changed params
     handle->backend = backend_open(opts->path, opts->data_size, opts->meta_size,
-                                   opts->write_log_entries, TX_LOG_SIZE / opts->write_log_entries,
+                                   tx_slots, tx_log_size / tx_slots,
                                    opts->max_key_len, opts->max_val_len,
                                    opts->meta_max_key_len, opts->meta_max_val_len,
                                    opts->sync_type);
@@ -117,10 +152,11 @@ pmb_open(pmb_opts* opts, uint8_t* error)
     if (handle->backend == NULL) {
         // try create if cannot open
         handle->backend = backend_create(opts->path, opts->data_size, opts->meta_size,
-                                         opts->write_log_entries, TX_LOG_SIZE / opts->write_log_entries,
+                                         tx_slots, tx_log_size / tx_slots,
                                          opts->max_key_len, opts->max_val_len,
                                          opts->meta_max_key_len, opts->meta_max_val_len,
-                                         S_IRWXU, opts->sync_type);
+                                         S_IRWXU, opts->sync_type, opts->checksum,
+                                         opts->chunk_csum, opts->key_index);
         if (handle->backend == NULL) {
             *error = PMB_ECREAT;
             logprintf("pmb_open: cannot create store: %s\n", strerror(errno));
@@ -141,9 +177,26 @@ pmb_open(pmb_opts* opts, uint8_t* error)
     handle->max_val_len = opts->max_val_len;
     handle->meta_max_key_len = opts->meta_max_key_len;
     handle->meta_max_val_len = opts->meta_max_val_len;
+    handle->recovery_threads = opts->recovery_threads;
+    handle->rc = NULL;
+    handle->inplace_max_len = opts->inplace_max_len ? opts->inplace_max_len :
+            handle->max_val_len / 2;
 
     // initialize and process write log
-    tx_log_init(handle, opts->write_log_entries);
+    // existing store keeps number of slots it was created with
+    tx_log_init(handle, backend_tx_count(handle->backend), opts->tx_slot_cache);
+    if (opts->execute_threads &&
+            tx_log_exec_start(handle, opts->execute_threads,
+                opts->execute_batch) != PMB_OK) {
+        logprintf("pmb_open: cannot start executor threads, transactions "
+                "executed by caller\n");
+    }
+    if (opts->group_commit_us &&
+            tx_log_group_start(handle, opts->group_commit_us,
+                opts->group_commit_max) != PMB_OK) {
+        logprintf("pmb_open: cannot start group commit, commits persisted "
+                "separately\n");
+    }
 
     handle->total_objs_count = backend_nblock(handle->backend, PMB_DATA);
     handle->meta_objs_count = backend_nblock(handle->backend, PMB_META);
@@ -152,19 +205,42 @@ pmb_open(pmb_opts* opts, uint8_t* error)
         // empty store, skip recovery
         // initialize freelist, free list will be populated, when data will be checked
         // with iterator
-        handle->free_list = caslist_new(1, handle->total_objs_count);
-        handle->meta_free_list = caslist_new(1, handle->meta_objs_count);
+        handle->free_list = caslist_new_sharded(0, 0, 1,
+                handle->total_objs_count);
+        handle->meta_free_list = caslist_new_sharded(0, 0,
+                handle->total_objs_count,
+                handle->total_objs_count + handle->meta_objs_count);
         handle->objs_list = NULL;
         handle->meta_objs_list = NULL;
         populate_free_list(handle);
     } else {
         // there was write to store, perform full recovery
         tx_log_check(handle);  // recover transactions
-        handle->free_list = caslist_new(0, 0);
-        handle->meta_free_list = caslist_new(0, 0);
+        handle->free_list = caslist_new_sharded(0, 0, 1,
+                handle->total_objs_count);
+        handle->meta_free_list = caslist_new_sharded(0, 0,
+                handle->total_objs_count,
+                handle->total_objs_count + handle->meta_objs_count);
         handle->objs_list = caslist_new(0, 0);
         handle->meta_objs_list = caslist_new(0, 0);
-        recovery(handle);
+        // allocation bitmap can't be trusted without the snapshot, validate
+        // every block and rebuild the bitmap
+        full_recovery = recovery_from_snapshot(handle) != PMB_OK &&
+                (backend_alloc_state(handle->backend) == BACKEND_ALLOC_DIRTY ||
+                 recovery_from_map(handle) != PMB_OK);
+    }
+
+    // snapshot describes the store only until it's modified
+    backend_free_snap_invalidate(handle->backend);
+
+    if (full_recovery && opts->recovery_mode == PMB_RECOVERY_LAZY &&
+            recovery_start(handle) == PMB_OK) {
+        logprintf("pmb_open: recovery started in background\n");
+    } else {
+        if (full_recovery) {
+            recovery(handle);
+        }
+        alloc_state_open(handle);
     }
 
     if (opts->sync_type == PMB_THSYNC) {
@@ -176,6 +252,34 @@ pmb_open(pmb_opts* opts, uint8_t* error)
 }
 
 
+/*
+ * Saves ranges of both free lists, so the next open doesn't have to scan the
+ * store. Nothing is saved when there are pending transactions or the ranges
+ * don't fit into the snapshot area.
+ */
+static void
+free_snap_save(pmb_handle* handle)
+{
+    size_t max, ndata, nmeta;
+    uint64_t* ranges = backend_free_snap(handle->backend, &max);
+    if (ranges == NULL || !tx_log_empty(handle)) {
+        return;
+    }
+
+    ndata = caslist_ranges(handle->free_list, ranges, max);
+    if (ndata == (size_t)-1) {
+        return;
+    }
+
+    nmeta = caslist_ranges(handle->meta_free_list, ranges + 2 * ndata,
+            max - ndata);
+    if (nmeta == (size_t)-1) {
+        return;
+    }
+
+    backend_free_snap_save(handle->backend, ndata, nmeta);
+}
+
 uint8_t
 pmb_close(pmb_handle* handle)
 {
@@ -194,15 +298,25 @@ pmb_close(pmb_handle* handle)
         caslist_free(handle->meta_objs_list);
     }
 
+    // queued executes could still wait for recovery
+    tx_log_exec_stop(handle);
+    recovery_stop(handle);
+    free_snap_save(handle);
+
     caslist_free(handle->free_list);
     caslist_free(handle->meta_free_list);
     tx_log_free(handle);
+    free(handle->claims);
+    pthread_mutex_destroy(&handle->key_index_lock);
 
     if (backend_get_sync_type(handle->backend) == PMB_THSYNC) {
         pthread_cancel(handle->sync_thread);
         pthread_join(handle->sync_thread, NULL);
     }
 
+    backend_key_index_persist(handle->backend);
+    backend_alloc_set_state(handle->backend, BACKEND_ALLOC_CLEAN);
+
     backend_close(handle->backend);
 
     free(handle);
@@ -255,12 +369,31 @@ pmb_tx_execute(pmb_handle* handle, uint64_t tx_slot)
         tracepoint(pmbackend, pmb_tx_execute_exit, handle, tx_slot, PMB_ERR);
         return PMB_EARGS;
     }
+    if (handle->op_log.executor != NULL) {
+        // cleanup is done by executor thread, which also frees the slot
+        uint8_t ret = tx_log_exec_queue(handle, tx_slot);
+        tracepoint(pmbackend, pmb_tx_execute_exit, handle, tx_slot, ret);
+        return ret;
+    }
     uint8_t ret = tx_slot_execute(handle, tx_slot);
-    tx_log_free_slot(handle, tx_slot);
+    // slot which wasn't executed may be still used by its owner
+    if (ret == PMB_OK) {
+        tx_log_free_slot(handle, tx_slot);
+    }
     tracepoint(pmbackend, pmb_tx_execute_exit, handle, tx_slot, ret);
     return ret;
 }
 
+uint8_t
+pmb_tx_wait(pmb_handle* handle, uint64_t tx_slot)
+{
+    if (handle == NULL || tx_slot == 0 || tx_slot > handle->op_log.tx_slots_count) {
+        return PMB_EARGS;
+    }
+    tx_log_exec_wait(handle, tx_slot);
+    return PMB_OK;
+}
+
 uint8_t
 pmb_tx_abort(pmb_handle* handle, uint64_t tx_slot)
 {
@@ -271,26 +404,24 @@ pmb_tx_abort(pmb_handle* handle, uint64_t tx_slot)
         return PMB_EARGS;
     }
     uint8_t ret = tx_slot_abort(handle, tx_slot);
-    tx_log_free_slot(handle, tx_slot);
+    if (ret == PMB_OK) {
+        tx_log_free_slot(handle, tx_slot);
+    }
     tracepoint(pmbackend, pmb_tx_abort_exit, handle, tx_slot, ret);
     return ret;
 }
 
-uint8_t
-pmb_get(pmb_handle* handle, uint64_t blk_id, pmb_pair* kv)
+/*
+ * Fills key-value pair with object stored in blk_id
+ */
+static uint8_t
+get_pair(pmb_handle* handle, uint64_t blk_id, pmb_pair* kv)
 {
-    tracepoint(pmbackend, pmb_get_enter, handle, blk_id);
-    if (handle == NULL || kv == NULL) {
-        logprintf(INVALID_INPUT, "pmb_get");
-        tracepoint(pmbackend, pmb_get_exit, handle, blk_id, PMB_ERR);
-        return PMB_EARGS;
-    }
-
     uint8_t error;
+    tx_log_exec_wait_blk(handle, blk_id);
     void* obj = backend_get(handle->backend, blk_id, &error);
     pmb_data_hdr* hdr = (pmb_data_hdr *) obj;
-    if (obj == NULL) {
-        tracepoint(pmbackend, pmb_get_exit, handle, blk_id, PMEMKV_ENOENT);
+    if (obj == NULL || recovery_check(handle, blk_id, obj) != PMB_OK) {
         return PMB_ENOENT;
     }
 
@@ -316,10 +447,157 @@ pmb_get(pmb_handle* handle, uint64_t blk_id, pmb_pair* kv)
     kv->offset = 0;
     kv->id = hdr->id;
 
-    tracepoint(pmbackend, pmb_get_exit, handle, blk_id, PMB_OK);
     return PMB_OK;
 }
 
+uint8_t
+pmb_get(pmb_handle* handle, uint64_t blk_id, pmb_pair* kv)
+{
+    tracepoint(pmbackend, pmb_get_enter, handle, blk_id);
+    if (handle == NULL || kv == NULL) {
+        logprintf(INVALID_INPUT, "pmb_get");
+        tracepoint(pmbackend, pmb_get_exit, handle, blk_id, PMB_ERR);
+        return PMB_EARGS;
+    }
+
+    uint8_t ret = get_pair(handle, blk_id, kv);
+    tracepoint(pmbackend, pmb_get_exit, handle, blk_id, ret);
+    return ret;
+}
+
+uint8_t
+pmb_get_by_key(pmb_handle* handle, const void* key, uint32_t key_len,
+        pmb_pair* kv)
+{
+    if (handle == NULL || key == NULL || key_len == 0 ||
+            key_len > handle->max_key_len || kv == NULL) {
+        logprintf(INVALID_INPUT, "pmb_get_by_key");
+        return PMB_EARGS;
+    }
+    if (!backend_key_index_enabled(handle->backend)) {
+        return PMB_ERR;
+    }
+    // blocks not scanned yet are missing in rebuilt index
+    if (handle->rc != NULL && handle->rc->index) {
+        pmb_recovery_wait(handle);
+    }
+
+    // index could point to blocks of not executed or removed objects
+    uint64_t pos = 0;
+    uint64_t blk_id;
+    while ((blk_id = backend_key_index_find(handle->backend, key, key_len,
+                    &pos)) != 0) {
+        recovery_validate(handle, blk_id);
+        if (backend_alloc_test(handle->backend, blk_id) &&
+                get_pair(handle, blk_id, kv) == PMB_OK) {
+            return PMB_OK;
+        }
+    }
+
+    return PMB_ENOENT;
+}
+
+uint8_t
+pmb_get_batch(pmb_handle* handle, const uint64_t* blk_ids, pmb_pair* kvs,
+        uint8_t* status, size_t n)
+{
+    if (handle == NULL || blk_ids == NULL || kvs == NULL || status == NULL) {
+        logprintf(INVALID_INPUT, "pmb_get_batch");
+        return PMB_EARGS;
+    }
+
+    // issue loads of all headers first, so they are served in parallel
+    for (size_t i = 0; i < n; i++) {
+        void* obj = backend_direct(handle->backend, blk_ids[i]);
+        if (obj != NULL) {
+            __builtin_prefetch(obj, 0, 3);
+        }
+    }
+
+    uint8_t ret = PMB_OK;
+    for (size_t i = 0; i < n; i++) {
+        status[i] = get_pair(handle, blk_ids[i], &kvs[i]);
+        if (status[i] != PMB_OK) {
+            ret = status[i];
+        }
+    }
+
+    return ret;
+}
+
+uint8_t
+pmb_verify(pmb_handle* handle, uint64_t blk_id, uint32_t offset, uint32_t len)
+{
+    if (handle == NULL) {
+        return PMB_EARGS;
+    }
+
+    uint8_t error;
+    void* obj = backend_get(handle->backend, blk_id, &error);
+    if (obj == NULL || recovery_check(handle, blk_id, obj) != PMB_OK) {
+        return PMB_ENOENT;
+    }
+
+    if (!backend_block_verify(handle->backend, blk_id, offset, len)) {
+        return PMB_ECSUM;
+    }
+
+    return PMB_OK;
+}
+
+/*
+ * Fills new data block with key and value, on update data outside of written
+ * range is copied from the old block. Checksum is computed last. With nodrain
+ * copies aren't fenced, caller drains once for many blocks.
+ */
+static void
+put_data_block(pmb_handle* handle, pmb_pair* kv, uint64_t blk_id, void* obj,
+        void* old_obj, int nodrain)
+{
+    void* (*copy)(struct _backend*, void*, const void*, size_t) =
+            nodrain ? backend_memcpy_nodrain : backend_memcpy;
+    size_t data_len = kv->val_len + kv->offset;
+    pmb_data_hdr *meta = obj;
+    pmb_data_hdr *old_meta = NULL;
+    meta->key_len = kv->key_len;
+
+    // increment version number if needed
+    if (kv->blk_id) {
+        // update, increment version number
+        old_meta = (pmb_data_hdr *)old_obj;
+        meta->version = old_meta->version + 1;
+    } else {
+        // new write, set version number to "1"
+        meta->version = 1;
+    }
+
+    void *key = obj + sizeof(pmb_data_hdr);
+    void *value = key + handle->max_key_len;
+
+    copy(handle->backend, key, kv->key, kv->key_len);
+    meta->id = kv->id;
+    meta->val_len = data_len;
+
+    if (kv->val_len) {
+        if (kv->blk_id && old_meta->val_len > 0) {
+            // update to existing block, need to copy old data
+            // clean write without offset
+            old_obj = old_obj + sizeof(pmb_data_hdr) + handle->max_key_len;
+            size_t beginning = kv->offset > old_meta->val_len ? old_meta->val_len : kv->offset;
+            copy(handle->backend, value, old_obj, beginning);
+
+            if (old_meta->val_len > data_len) {
+                uint64_t size_diff = old_meta->val_len - data_len;
+                copy(handle->backend, value + data_len, old_obj + data_len, size_diff);
+                meta->val_len = old_meta->val_len;
+            }
+        }
+        copy(handle->backend, value + kv->offset, kv->val, kv->val_len);
+    }
+
+    backend_block_checksum(handle->backend, blk_id, 0, meta->val_len);
+}
+
 uint8_t
 pmb_tput(pmb_handle* handle, uint64_t tx_slot, pmb_pair* kv)
 {
@@ -344,21 +622,28 @@ pmb_tput(pmb_handle* handle, uint64_t tx_slot, pmb_pair* kv)
     uint8_t error;
     void *old_obj = NULL;
 
-    if (kv->blk_id && (kv->val_len < (handle->max_val_len / 2))) {
+    if (kv->blk_id && kv->val_len < handle->inplace_max_len) {
         //  we're performing "small" update
-        return tx_slot_op_small_update(handle, tx_slot, kv->blk_id, kv->val,
-                                       kv->offset, kv->val_len);
-    } else {
-        if (kv->blk_id) {
-            old_obj = backend_get(handle->backend, kv->blk_id, &error);
-            if (old_obj == NULL) {
-                tracepoint(pmbackend, pmb_tput_exit, handle, kv, tx_slot, __LINE__);
-                return PMB_ENOENT;
-            }
+        status = tx_slot_op_small_update(handle, tx_slot, kv->blk_id, kv->val,
+                                         kv->offset, kv->val_len);
+        // object is copied to a new block when there are no tx slots left
+        // for the whole payload
+        if (status != PMB_ENOSPC) {
+            return status;
+        }
+    }
+
+    if (kv->blk_id) {
+        // new version is copied from the old one, which has to be current
+        tx_log_exec_wait_blk(handle, kv->blk_id);
+        old_obj = backend_get(handle->backend, kv->blk_id, &error);
+        if (old_obj == NULL) {
+            tracepoint(pmbackend, pmb_tput_exit, handle, kv, tx_slot, __LINE__);
+            return PMB_ENOENT;
         }
-        // get new empty block
-        status = caslist_pop(handle->free_list, &blk_id);
     }
+    // get new empty block
+    status = recovery_pop_free(handle, handle->free_list, &blk_id);
 
     if (status != 0) {
         logprintf("pmb_tput: free objects %zu\n", handle->free_list->counter);
@@ -388,55 +673,243 @@ pmb_tput(pmb_handle* handle, uint64_t tx_slot, pmb_pair* kv)
     }
 
     if (status != PMB_OK) {
+        caslist_push(handle->free_list, blk_id);
         tracepoint(pmbackend, pmb_tput_exit, handle, kv, tx_slot, __LINE__);
         return status;
     }
 
-    pmb_data_hdr *meta = obj;
-    pmb_data_hdr *old_meta = NULL;
-    meta->key_len = kv->key_len;
+    put_data_block(handle, kv, blk_id, obj, old_obj, 0);
 
-    // increment version number if needed
-    if (kv->blk_id) {
-        // update, increment version number
-        old_meta = (pmb_data_hdr *)old_obj;
-        meta->version = old_meta->version + 1;
+    logprintf("pmb_put before write blk_id: %zu\n", blk_id);
+
+    kv->blk_id = blk_id;
+    tracepoint(pmbackend, pmb_tput_exit, handle, kv, tx_slot, __LINE__);
+    return PMB_OK;
+}
+
+void
+key_index_update(pmb_handle* handle, uint64_t new_blk_id, uint64_t old_blk_id)
+{
+    if (!backend_key_index_enabled(handle->backend) ||
+            (new_blk_id >= handle->total_objs_count &&
+             old_blk_id >= handle->total_objs_count)) {
+        return;
+    }
+
+    pthread_mutex_lock(&handle->key_index_lock);
+    if (new_blk_id) {
+        backend_key_index_insert(handle->backend, new_blk_id);
+    }
+    if (old_blk_id) {
+        backend_key_index_remove(handle->backend, old_blk_id);
+    }
+    pthread_mutex_unlock(&handle->key_index_lock);
+}
+
+/*
+ * Claims block for conditional update by transaction. Returns 1 when claim is
+ * taken now, 0 when transaction already holds it, -1 when other transaction
+ * holds it and -2 when claims can't be allocated.
+ */
+static int
+claim_block(pmb_handle* handle, uint64_t tx_slot, uint64_t blk_id)
+{
+    uint32_t* claims = handle->claims;
+    if (claims == NULL) {
+        claims = calloc(handle->total_objs_count + handle->meta_objs_count,
+                sizeof(uint32_t));
+        if (claims == NULL) {
+            return -2;
+        }
+        if (!__sync_bool_compare_and_swap(&handle->claims, NULL, claims)) {
+            free(claims);
+            claims = handle->claims;
+        }
+    }
+
+    uint32_t owner = __sync_val_compare_and_swap(&claims[blk_id], 0, tx_slot);
+    if (owner == 0) {
+        return 1;
+    }
+    return owner == tx_slot ? 0 : -1;
+}
+
+uint8_t
+pmb_tput_cas(pmb_handle* handle, uint64_t tx_slot, pmb_pair* kv,
+        uint32_t version)
+{
+    if (handle == NULL || kv == NULL || tx_slot == 0 ||
+            tx_slot > handle->op_log.tx_slots_count) {
+        logprintf(INVALID_INPUT, "pmb_tput_cas");
+        return PMB_EARGS;
+    }
+
+    // new object has no version yet
+    if (kv->blk_id == 0) {
+        return version == 0 ? pmb_tput(handle, tx_slot, kv) : PMB_EVERSION;
+    }
+
+    uint64_t blk_id = kv->blk_id;
+    if (blk_id >= handle->total_objs_count) {
+        return PMB_EWRGID;
+    }
+
+    int claimed = claim_block(handle, tx_slot, blk_id);
+    if (claimed == -2) {
+        return PMB_ERR;
+    } else if (claimed < 0) {
+        return PMB_EVERSION;
+    }
+
+    uint8_t error;
+    uint8_t ret;
+    tx_log_exec_wait_blk(handle, blk_id);
+    pmb_data_hdr* hdr = backend_get(handle->backend, blk_id, &error);
+    if (hdr == NULL) {
+        ret = PMB_ENOENT;
+    } else if (hdr->version != version) {
+        ret = PMB_EVERSION;
     } else {
-        // new write, set version number to "1"
-        meta->version = 1;
+        ret = pmb_tput(handle, tx_slot, kv);
     }
 
-    void *key = obj + sizeof(pmb_data_hdr);
-    void *value = key + handle->max_key_len;
+    if (ret != PMB_OK && claimed) {
+        __sync_bool_compare_and_swap(&handle->claims[blk_id], tx_slot, 0);
+    }
+    return ret;
+}
 
-    backend_memcpy(handle->backend, key, kv->key, kv->key_len);
-    meta->id = kv->id;
-    meta->val_len = data_len;
+/*
+ * Writes n objects in transaction. Blocks are taken from free list at once and
+ * all of them are registered in tx slot before any is written. Copies aren't
+ * fenced, commit of the transaction drains them together with the slot.
+ */
+uint8_t
+pmb_tput_batch(pmb_handle* handle, uint64_t tx_slot, pmb_pair* kvs, size_t n)
+{
+    if (handle == NULL || kvs == NULL || n == 0 || tx_slot == 0 ||
+            tx_slot > handle->op_log.tx_slots_count) {
+        logprintf(INVALID_INPUT, "pmb_tput_batch");
+        return PMB_EARGS;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        pmb_pair* kv = &kvs[i];
+        if (kv->key_len > handle->max_key_len || kv->key_len == 0 ||
+                kv->key == NULL || (kv->val == NULL && kv->val_len != 0) ||
+                (kv->val_len == 0 && kv->offset != 0)) {
+            logprintf(INVALID_INPUT, "pmb_tput_batch");
+            return PMB_EARGS;
+        }
+        if (kv->offset + kv->val_len > handle->max_val_len) {
+            return PMB_ESIZE;
+        }
+    }
+
+    uint64_t* ids = malloc(2 * n * sizeof(uint64_t));
+    void** old_objs = malloc(n * sizeof(void*));
+    if (ids == NULL || old_objs == NULL) {
+        free(ids);
+        free(old_objs);
+        return PMB_ERR;
+    }
+    uint64_t* old_ids = ids + n;
+
+    uint8_t ret = PMB_OK;
+    uint8_t error;
+    for (size_t i = 0; i < n && ret == PMB_OK; i++) {
+        old_ids[i] = kvs[i].blk_id;
+        old_objs[i] = NULL;
+        if (old_ids[i]) {
+            tx_log_exec_wait_blk(handle, old_ids[i]);
+            old_objs[i] = backend_get(handle->backend, old_ids[i], &error);
+            if (old_objs[i] == NULL) {
+                ret = PMB_ENOENT;
+            }
+        }
+    }
+
+    size_t popped = 0;
+    if (ret == PMB_OK) {
+        popped = caslist_pop_n(handle->free_list, ids, n);
+        // lazy recovery could still add free blocks
+        while (popped < n &&
+                recovery_pop_free(handle, handle->free_list, &ids[popped]) == 0) {
+            popped++;
+        }
+        if (popped < n) {
+            ret = PMB_ENOSPC;
+        }
+    }
+
+    size_t logged = 0;
+    if (ret == PMB_OK) {
+        ret = tx_slot_op_write_n(handle, tx_slot, old_ids, ids, n, &logged);
+    }
+
+    if (ret != PMB_OK) {
+        // blocks already in tx slot are released by abort
+        if (popped > logged) {
+            caslist_push_n(handle->free_list, ids + logged, popped - logged);
+        }
+        free(ids);
+        free(old_objs);
+        return ret;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        void* obj = backend_direct(handle->backend, ids[i]);
+        put_data_block(handle, &kvs[i], ids[i], obj, old_objs[i], 1);
+        kvs[i].blk_id = ids[i];
+    }
+
+    free(ids);
+    free(old_objs);
+    return PMB_OK;
+}
+
+/*
+ * Single object write without tx slot. New block is written aside and its
+ * checksum is the commit record: torn block fails verification and recovery
+ * returns it to the free list. Old version is released only after the new one
+ * is durable.
+ */
+uint8_t
+pmb_put_atomic(pmb_handle* handle, pmb_pair* kv)
+{
+    // replaced version isn't logged anywhere, after crash before it's released
+    // both versions would stay allocated, so only new objects are written
+    if (handle == NULL || kv == NULL || kv->blk_id != 0 ||
+            kv->key_len > handle->max_key_len || kv->key_len == 0 || kv->key == NULL ||
+            (kv->val == NULL && kv->val_len != 0 ) || (kv->val_len == 0 && kv->offset != 0)) {
+        logprintf(INVALID_INPUT, "pmb_put_atomic");
+        return PMB_EARGS;
+    }
 
-    if (kv->val_len) {
-        if (kv->blk_id && old_meta->val_len > 0) {
-            // update to existing block, need to copy old data
-            // clean write without offset
-            old_obj = old_obj + sizeof(pmb_data_hdr) + handle->max_key_len;
-            size_t beginning = kv->offset > old_meta->val_len ? old_meta->val_len : kv->offset;
-            backend_memcpy(handle->backend, value, old_obj, beginning);
+    if (kv->offset + kv->val_len > handle->max_val_len) {
+        return PMB_ESIZE;
+    }
 
-            if (old_meta->val_len > data_len) {
-                uint64_t size_diff = old_meta->val_len - data_len;
-                backend_memcpy(handle->backend, value + data_len, old_obj + data_len, size_diff);
-                obj_size = obj_size + size_diff;
-                meta->val_len = old_meta->val_len;
-            }
-        }
-        backend_memcpy(handle->backend, value + kv->offset, kv->val, kv->val_len);
+    uint64_t blk_id;
+    if (recovery_pop_free(handle, handle->free_list, &blk_id) != 0) {
+        return PMB_ENOSPC;
     }
 
-    util_checksum(obj, obj_size, &meta->flch64, 1);
+    void *obj = backend_direct(handle->backend, blk_id);
+    if (obj == NULL) {
+        caslist_push(handle->free_list, blk_id);
+        return PMB_ERR;
+    }
 
-    logprintf("pmb_put before write blk_id: %zu\n", blk_id);
+    put_data_block(handle, kv, blk_id, obj, NULL, 1);
+    backend_block_flush(handle->backend, blk_id, 0, UINT32_MAX);
+    // block has to be durable before allocation bit makes it visible
+    backend_drain(handle->backend);
+    key_index_update(handle, blk_id, 0);
+    backend_alloc_mark(handle->backend, blk_id, 1);
+    backend_drain(handle->backend);
 
     kv->blk_id = blk_id;
-    tracepoint(pmbackend, pmb_tput_exit, handle, kv, tx_slot, __LINE__);
     return PMB_OK;
 }
 
@@ -482,7 +955,7 @@ pmb_tput_meta(pmb_handle* handle, uint64_t tx_slot, pmb_pair* kv)
 
     // get new empty block
     uint64_t blk_id;
-    status = caslist_pop(handle->meta_free_list, &blk_id);
+    status = recovery_pop_free(handle, handle->meta_free_list, &blk_id);
 
     if (status != 0) {
         logprintf("pmb_tput: free objects %zu\n", handle->free_list->counter);
@@ -534,7 +1007,7 @@ pmb_tput_meta(pmb_handle* handle, uint64_t tx_slot, pmb_pair* kv)
     backend_memcpy(handle->backend, key,   kv->key, kv->key_len);
     backend_memcpy(handle->backend, value, kv->val, kv->val_len);
 
-    util_checksum(obj, obj_size, &meta->flch64, 1);
+    backend_block_checksum(handle->backend, blk_id, 0, meta->val_len);
 
     kv->blk_id = blk_id;
 
@@ -555,6 +1028,8 @@ pmb_tdel(pmb_handle* handle, uint64_t tx_slot, uint64_t blk_id)
     }
 
     logprintf("tx del blk_id: %zu\n", blk_id);
+    // queued in-place updates can't be applied after the block is released
+    tx_log_exec_wait_blk(handle, blk_id);
     ret = tx_slot_op_remove(handle, tx_slot, blk_id);
     tracepoint(pmbackend, pmb_tdel_exit, handle, blk_id, tx_slot, ret);
     return ret;
@@ -605,6 +1080,9 @@ pmb_iter_open(pmb_handle* handle, uint8_t region)
         return NULL;
     }
 
+    // object lists are complete only after recovery
+    pmb_recovery_wait(handle);
+
     if (region) {
         if (handle->meta_objs_list == NULL) {
             tracepoint(pmbackend, pmb_iter_exit, handle, __LINE__);
@@ -722,92 +1200,570 @@ pmb_iter_valid(pmb_iter* iter)
     }
 }
 
+/*
+ * Lists recovered blocks are pushed to, each recovery thread builds its own
+ * and merges them to the handle ones
+ */
 typedef struct {
-    pmb_handle* handle;
-    uint64_t recovery_start;
-    uint64_t recovery_stop;
-} rc_args;
+    caslist* free_list;
+    caslist* objs_list;
+    caslist* meta_free_list;
+    caslist* meta_objs_list;
+} rc_lists;
 
-void*
-recovery_thread(void* args)
+/*
+ * Consecutive blocks with the same state are collected into a run and pushed
+ * to the target list with single caslist_push_range call. When backend is set,
+ * allocation bitmap is rebuilt from the runs as well.
+ */
+typedef struct {
+    struct _backend* backend;
+    caslist* list;
+    int      allocated;
+    uint64_t begin;
+    uint64_t end;
+} rc_run;
+
+static void
+recovery_run_flush(rc_run* run)
+{
+    if (run->list == NULL) {
+        return;
+    }
+
+    caslist_push_range(run->list, run->begin, run->end);
+    if (run->backend != NULL) {
+        backend_alloc_mark_range(run->backend, run->begin, run->end, run->allocated);
+    }
+    run->list = NULL;
+}
+
+static void
+recovery_run_add(rc_run* run, caslist* list, int allocated, uint64_t begin,
+        uint64_t end)
+{
+    if (run->list == list && run->end + 1 == begin) {
+        run->end = end;
+        return;
+    }
+
+    recovery_run_flush(run);
+    run->list = list;
+    run->allocated = allocated;
+    run->begin = begin;
+    run->end = end;
+}
+
+/*
+ * Checks if block holds valid object, block is expected to be non-empty
+ */
+static int
+recovery_block_valid(pmb_handle* handle, uint64_t pos, void* obj)
+{
+    return backend_block_verify(handle->backend, pos, 0, UINT32_MAX);
+}
+
+/*
+ * Validates all blocks of the chunk unless it was already done, pushes them to
+ * object and free lists and rebuilds allocation bitmap for them. Returns 1 if
+ * chunk was validated by this call.
+ */
+static int
+recovery_chunk(pmb_handle* handle, uint64_t chunk, rc_lists* lists)
 {
-    rc_args* rcargs = (rc_args *)args;
-    uint64_t border = pmb_ntotal(rcargs->handle, 0);
+    rc_state* rc = handle->rc;
+    uint64_t start = chunk * RECOVERY_CHUNK;
+    uint64_t stop = start + RECOVERY_CHUNK;
     uint8_t error;
     caslist* free_list = NULL;
     caslist* obj_list = NULL;
-    size_t object_size;
-    for (uint64_t pos = rcargs->recovery_start; pos < rcargs->recovery_stop; pos++) {
-        if (pos > border) {
-            free_list = rcargs->handle->meta_free_list;
-            obj_list = rcargs->handle->meta_objs_list;
-        } else {
-            free_list = rcargs->handle->free_list;
-            obj_list = rcargs->handle->objs_list;
-        }
+    rc_run run = {handle->backend, NULL, 0, 0, 0};
 
-        void* obj = backend_get(rcargs->handle->backend, pos, &error);
-        if (obj == NULL) {
-            caslist_push(free_list, pos);
-            continue;
-        }
+    if (start == 0) {
+        start++; // skip '0' block
+    }
+    if (stop > rc->nblocks) {
+        stop = rc->nblocks;
+    }
+
+    pthread_mutex_lock(&rc->chunk_locks[chunk]);
+    if (rc->scanned[chunk]) {
+        pthread_mutex_unlock(&rc->chunk_locks[chunk]);
+        return 0;
+    }
 
-        if (pos > border){
-            object_size = sizeof(pmb_data_hdr) + ((pmb_data_hdr *) obj)->key_len + ((pmb_data_hdr *) obj)->val_len;
+    for (uint64_t pos = start; pos < stop; pos++) {
+        if (pos >= handle->total_objs_count) {
+            free_list = lists->meta_free_list;
+            obj_list = lists->meta_objs_list;
         } else {
-            object_size = sizeof(pmb_data_hdr) + rcargs->handle->max_key_len + ((pmb_data_hdr *) obj)->val_len;
+            free_list = lists->free_list;
+            obj_list = lists->objs_list;
         }
 
-        if (util_checksum(obj, object_size, &((pmb_data_hdr *) obj)->flch64, 0)) {
+        void* obj = backend_get(handle->backend, pos, &error);
+        if (obj != NULL && recovery_block_valid(handle, pos, obj)) {
             // if checksum is correct it belongs to obj_list
-            caslist_push(obj_list, pos);
+            recovery_run_add(&run, obj_list, 1, pos, pos);
+            if (rc->index) {
+                key_index_update(handle, pos, 0);
+            }
         } else {
-            // if checksum is corrupted add it to free list
-            caslist_push(free_list, pos);
+            // empty block or corrupted checksum, add it to free list
+            recovery_run_add(&run, free_list, 0, pos, pos);
+        }
+    }
+
+    recovery_run_flush(&run);
+    rc->scanned[chunk] = 1;
+    pthread_mutex_unlock(&rc->chunk_locks[chunk]);
+
+    __sync_fetch_and_add(&rc->validated, stop - start);
+    return 1;
+}
+
+/*
+ * Wakes up allocations waiting for free blocks
+ */
+static void
+recovery_notify(rc_state* rc)
+{
+    pthread_mutex_lock(&rc->mutex);
+    pthread_cond_broadcast(&rc->cond);
+    pthread_mutex_unlock(&rc->mutex);
+}
+
+static void
+recovery_lists_merge(pmb_handle* handle, rc_lists* lists)
+{
+    caslist_merge(handle->free_list, lists->free_list);
+    caslist_merge(handle->objs_list, lists->objs_list);
+    caslist_merge(handle->meta_free_list, lists->meta_free_list);
+    caslist_merge(handle->meta_objs_list, lists->meta_objs_list);
+}
+
+/*
+ * Takes chunks from the shared cursor until all are taken, so threads which
+ * got chunks with small meta blocks or empty data blocks simply take more of
+ * them. Blocks are collected in thread local lists, in lazy mode they're merged
+ * after every chunk to make free blocks available as soon as possible.
+ */
+void*
+recovery_thread(void* args)
+{
+    pmb_handle* handle = (pmb_handle *) args;
+    rc_state* rc = handle->rc;
+    rc_lists local = {caslist_new(0, 0), caslist_new(0, 0),
+            caslist_new(0, 0), caslist_new(0, 0)};
+    rc_lists global = {handle->free_list, handle->objs_list,
+            handle->meta_free_list, handle->meta_objs_list};
+    rc_lists* lists = &local;
+    uint64_t chunk;
+
+    if (local.free_list == NULL || local.objs_list == NULL ||
+            local.meta_free_list == NULL || local.meta_objs_list == NULL) {
+        lists = &global;
+    }
+
+    while ((chunk = __sync_fetch_and_add(&rc->next_chunk, 1)) < rc->nchunks) {
+        if (recovery_chunk(handle, chunk, lists) && rc->lazy) {
+            if (lists == &local) {
+                recovery_lists_merge(handle, &local);
+            }
+            recovery_notify(rc);
         }
     }
 
+    if (lists == &local) {
+        recovery_lists_merge(handle, &local);
+    }
+    caslist_free(local.free_list);
+    caslist_free(local.objs_list);
+    caslist_free(local.meta_free_list);
+    caslist_free(local.meta_objs_list);
+
     return NULL;
 }
 
-uint8_t
-recovery(pmb_handle* handle)
+static rc_state*
+recovery_state_new(pmb_handle* handle)
 {
-    const uint8_t threads_num = 8; // TODO: option? or cpu_num?
-    pthread_t recovery_threads[threads_num];
-    rc_args rcargs[threads_num];
-    uint64_t part = (pmb_ntotal(handle, 0) + pmb_ntotal(handle, 1)) / threads_num;
-    for(int i = 0; i < threads_num; i++) {
-        rcargs[i].handle = handle;
-        rcargs[i].recovery_start = part * i;
-        if (i == 0)
-            rcargs[i].recovery_start++; // skip '0' block
-        if (i < threads_num - 1) {
-            rcargs[i].recovery_stop = part * (i + 1);
-        } else {
-            rcargs[i].recovery_stop = handle->total_objs_count + handle->meta_objs_count;
+    rc_state* rc = malloc(sizeof(rc_state));
+    if (rc == NULL) {
+        return NULL;
+    }
+
+    rc->nblocks = handle->total_objs_count + handle->meta_objs_count;
+    rc->nchunks = (rc->nblocks + RECOVERY_CHUNK - 1) / RECOVERY_CHUNK;
+    rc->validated = 0;
+    rc->next_chunk = 0;
+    rc->lazy = 0;
+    rc->done = 0;
+    // index entries could be lost together with bitmap updates
+    rc->index = backend_key_index_enabled(handle->backend) &&
+            backend_alloc_state(handle->backend) == BACKEND_ALLOC_DIRTY;
+    rc->scanned = calloc(rc->nchunks, sizeof(uint8_t));
+    rc->chunk_locks = malloc(rc->nchunks * sizeof(pthread_mutex_t));
+    if (rc->scanned == NULL || rc->chunk_locks == NULL) {
+        free(rc->scanned);
+        free(rc->chunk_locks);
+        free(rc);
+        return NULL;
+    }
+
+    for (uint64_t i = 0; i < rc->nchunks; i++) {
+        pthread_mutex_init(&rc->chunk_locks[i], NULL);
+    }
+    pthread_mutex_init(&rc->mutex, NULL);
+    pthread_cond_init(&rc->cond, NULL);
+
+    return rc;
+}
+
+static void
+recovery_state_free(rc_state* rc)
+{
+    for (uint64_t i = 0; i < rc->nchunks; i++) {
+        pthread_mutex_destroy(&rc->chunk_locks[i]);
+    }
+    pthread_mutex_destroy(&rc->mutex);
+    pthread_cond_destroy(&rc->cond);
+    free(rc->chunk_locks);
+    free(rc->scanned);
+    free(rc);
+}
+
+/*
+ * Validates all chunks with recovery threads, handle->rc has to be set
+ */
+static void
+recovery_scan(pmb_handle* handle)
+{
+    uint64_t threads_num = handle->recovery_threads;
+    if (threads_num == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_num = ncpu > 0 ? ncpu : 1;
+    }
+    if (threads_num > handle->rc->nchunks) {
+        threads_num = handle->rc->nchunks;
+    }
+
+    pthread_t* recovery_threads = malloc(threads_num * sizeof(pthread_t));
+    uint64_t started = 0;
+    if (recovery_threads != NULL) {
+        while (started < threads_num && pthread_create(
+                &recovery_threads[started], NULL, recovery_thread, handle) == 0) {
+            started++;
         }
+    }
 
-        pthread_create(&recovery_threads[i], NULL, recovery_thread, &rcargs[i]);
+    if (started == 0) {
+        // no threads available, validate everything in the caller
+        recovery_thread(handle);
     }
 
-    for(int i = 0; i < threads_num; i++) {
+    for(uint64_t i = 0; i < started; i++) {
         pthread_join(recovery_threads[i], NULL);
     }
+    free(recovery_threads);
+
+    backend_alloc_persist(handle->backend);
+    if (handle->rc->index) {
+        backend_key_index_persist(handle->backend);
+    }
+}
+
+uint8_t
+recovery(pmb_handle* handle)
+{
+    handle->rc = recovery_state_new(handle);
+    if (handle->rc == NULL) {
+        return PMB_ERR;
+    }
+
+    recovery_scan(handle);
+
+    recovery_state_free(handle->rc);
+    handle->rc = NULL;
+    return PMB_OK;
+}
+
+static void*
+recovery_main(void* args)
+{
+    pmb_handle* handle = (pmb_handle *) args;
+
+    recovery_scan(handle);
+    alloc_state_open(handle);
+
+    pthread_mutex_lock(&handle->rc->mutex);
+    handle->rc->done = 1;
+    pthread_cond_broadcast(&handle->rc->cond);
+    pthread_mutex_unlock(&handle->rc->mutex);
+
+    return NULL;
+}
+
+uint8_t
+recovery_start(pmb_handle* handle)
+{
+    handle->rc = recovery_state_new(handle);
+    if (handle->rc == NULL) {
+        return PMB_ERR;
+    }
+
+    // bitmap is exact only after the scan
+    handle->rc->lazy = 1;
+    backend_alloc_set_state(handle->backend, BACKEND_ALLOC_DIRTY);
+    if (pthread_create(&handle->rc->thread, NULL, recovery_main, handle) != 0) {
+        recovery_state_free(handle->rc);
+        handle->rc = NULL;
+        return PMB_ERR;
+    }
 
     return PMB_OK;
 }
 
 void
-populate_free_list(pmb_handle* handle)
+recovery_stop(pmb_handle* handle)
+{
+    if (handle->rc == NULL) {
+        return;
+    }
+
+    pmb_recovery_wait(handle);
+    pthread_join(handle->rc->thread, NULL);
+    recovery_state_free(handle->rc);
+    handle->rc = NULL;
+}
+
+/*
+ * Returns 1 when background recovery is running
+ */
+static int
+recovery_running(pmb_handle* handle)
+{
+    return handle->rc != NULL && !__atomic_load_n(&handle->rc->done, __ATOMIC_ACQUIRE);
+}
+
+void
+recovery_validate(pmb_handle* handle, uint64_t blk_id)
+{
+    if (!recovery_running(handle) || blk_id >= handle->rc->nblocks) {
+        return;
+    }
+
+    rc_lists global = {handle->free_list, handle->objs_list,
+            handle->meta_free_list, handle->meta_objs_list};
+    if (recovery_chunk(handle, blk_id / RECOVERY_CHUNK, &global)) {
+        recovery_notify(handle->rc);
+    }
+}
+
+uint8_t
+recovery_check(pmb_handle* handle, uint64_t blk_id, void* obj)
+{
+    if (!recovery_running(handle) || blk_id >= handle->rc->nblocks) {
+        return PMB_OK;
+    }
+
+    rc_state* rc = handle->rc;
+    uint64_t chunk = blk_id / RECOVERY_CHUNK;
+    uint8_t ret = PMB_OK;
+    pthread_mutex_lock(&rc->chunk_locks[chunk]);
+    if (!rc->scanned[chunk] && !recovery_block_valid(handle, blk_id, obj)) {
+        ret = PMB_ENOENT;
+    }
+    pthread_mutex_unlock(&rc->chunk_locks[chunk]);
+
+    return ret;
+}
+
+uint8_t
+recovery_pop_free(pmb_handle* handle, caslist* list, uint64_t* blk_id)
+{
+    uint8_t status = caslist_pop(list, blk_id);
+    if (status == 0 || handle->rc == NULL) {
+        return status;
+    }
+
+    pthread_mutex_lock(&handle->rc->mutex);
+    while ((status = caslist_pop(list, blk_id)) != 0 && !handle->rc->done) {
+        pthread_cond_wait(&handle->rc->cond, &handle->rc->mutex);
+    }
+    pthread_mutex_unlock(&handle->rc->mutex);
+
+    return status;
+}
+
+uint8_t
+pmb_recovery_progress(pmb_handle* handle, uint64_t* validated, uint64_t* total)
+{
+    if (handle == NULL || validated == NULL || total == NULL) {
+        logprintf(INVALID_INPUT, "pmb_recovery_progress");
+        return PMB_EARGS;
+    }
+
+    if (handle->rc == NULL) {
+        *total = handle->total_objs_count + handle->meta_objs_count - 1;
+        *validated = *total;
+        return PMB_OK;
+    }
+
+    *total = handle->rc->nblocks - 1; // '0' block is never validated
+    *validated = __atomic_load_n(&handle->rc->validated, __ATOMIC_ACQUIRE);
+    return PMB_OK;
+}
+
+uint8_t
+pmb_recovery_wait(pmb_handle* handle)
+{
+    if (handle == NULL) {
+        logprintf(INVALID_INPUT, "pmb_recovery_wait");
+        return PMB_EARGS;
+    }
+
+    if (handle->rc == NULL) {
+        return PMB_OK;
+    }
+
+    pthread_mutex_lock(&handle->rc->mutex);
+    while (!handle->rc->done) {
+        pthread_cond_wait(&handle->rc->cond, &handle->rc->mutex);
+    }
+    pthread_mutex_unlock(&handle->rc->mutex);
+
+    return PMB_OK;
+}
+
+/*
+ * Splits region <first, last> of the allocation bitmap into runs of allocated
+ * and free blocks. Bitmap is consumed word at a time, a word with uniform bits
+ * is a single step regardless of the number of blocks it covers.
+ */
+static void
+recovery_map_region(const uint64_t* map, uint64_t first, uint64_t last,
+        caslist* free_list, caslist* obj_list)
 {
-    for(uint64_t pos = handle->total_objs_count + handle->meta_objs_count - 1; pos > 0; pos--) {
-        if (pos <= handle->total_objs_count - 1) {
-            caslist_push(handle->free_list, pos);
+    rc_run run = {NULL, NULL, 0, 0, 0};
+    uint64_t pos = first;
+    while (pos <= last) {
+        uint64_t word = map[pos / 64] >> (pos % 64);
+        uint64_t left = 64 - pos % 64;
+        uint64_t len;
+
+        if (left > last - pos + 1) {
+            left = last - pos + 1;
+        }
+
+        if (word & 1) {
+            len = ~word ? __builtin_ctzll(~word) : 64;
         } else {
-            caslist_push(handle->meta_free_list, pos);
+            len = word ? __builtin_ctzll(word) : 64;
+        }
+        if (len > left) {
+            len = left;
+        }
+
+        recovery_run_add(&run, (word & 1) ? obj_list : free_list, word & 1,
+                pos, pos + len - 1);
+        pos += len;
+    }
+    recovery_run_flush(&run);
+}
+
+uint8_t
+recovery_from_map(pmb_handle* handle)
+{
+    size_t nwords;
+    const uint64_t* map = backend_alloc_map(handle->backend, &nwords);
+    uint64_t last = handle->total_objs_count + handle->meta_objs_count - 1;
+    if (map == NULL || last >= nwords * 64) {
+        return PMB_ERR;
+    }
+
+    recovery_map_region(map, 1, handle->total_objs_count - 1,
+            handle->free_list, handle->objs_list);
+    recovery_map_region(map, handle->total_objs_count, last,
+            handle->meta_free_list, handle->meta_objs_list);
+
+    return PMB_OK;
+}
+
+/*
+ * Checks that snapshot ranges of single region are sorted, disjoint and fit
+ * into <first, last>
+ */
+static uint8_t
+recovery_snapshot_check(const uint64_t* ranges, size_t n, uint64_t first,
+        uint64_t last)
+{
+    uint64_t next = first;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t begin = ranges[2 * i];
+        uint64_t end = ranges[2 * i + 1];
+        if (begin < next || begin > end || end > last) {
+            return PMB_ERR;
+        }
+        next = end + 1;
+    }
+
+    return PMB_OK;
+}
+
+/*
+ * Pushes snapshot ranges of single region to the free list, gaps between them
+ * hold objects
+ */
+static void
+recovery_snapshot_region(const uint64_t* ranges, size_t n, uint64_t first,
+        uint64_t last, caslist* free_list, caslist* obj_list)
+{
+    uint64_t next = first;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t begin = ranges[2 * i];
+        uint64_t end = ranges[2 * i + 1];
+        if (begin > next) {
+            caslist_push_range(obj_list, next, begin - 1);
         }
+        caslist_push_range(free_list, begin, end);
+        next = end + 1;
+    }
+
+    if (next <= last) {
+        caslist_push_range(obj_list, next, last);
+    }
+}
+
+uint8_t
+recovery_from_snapshot(pmb_handle* handle)
+{
+    size_t ndata, nmeta;
+    const uint64_t* ranges = backend_free_snap_load(handle->backend, &ndata,
+            &nmeta);
+    uint64_t first_meta = handle->total_objs_count;
+    uint64_t last = handle->total_objs_count + handle->meta_objs_count - 1;
+    if (ranges == NULL ||
+            recovery_snapshot_check(ranges, ndata, 1, first_meta - 1) != PMB_OK ||
+            recovery_snapshot_check(ranges + 2 * ndata, nmeta, first_meta,
+                    last) != PMB_OK) {
+        return PMB_ERR;
     }
+
+    recovery_snapshot_region(ranges, ndata, 1, first_meta - 1,
+            handle->free_list, handle->objs_list);
+    recovery_snapshot_region(ranges + 2 * ndata, nmeta, first_meta, last,
+            handle->meta_free_list, handle->meta_objs_list);
+
+    return PMB_OK;
+}
+
+void
+populate_free_list(pmb_handle* handle)
+{
+    caslist_push_range(handle->free_list, 1, handle->total_objs_count - 1);
+    caslist_push_range(handle->meta_free_list, handle->total_objs_count,
+            handle->total_objs_count + handle->meta_objs_count - 1);
 }
 
 void
@@ -854,6 +1810,9 @@ pmb_resolve_conflict(pmb_handle* handle, uint64_t blk_id1, uint64_t blk_id2)
     uint8_t error;
     uint64_t return_id, delete_id;
 
+    recovery_validate(handle, blk_id1);
+    recovery_validate(handle, blk_id2);
+
     obj1 = backend_get(handle->backend, blk_id1, &error);
     if (obj1 == NULL) {
         printf("Backend error: %d for blk_id1\n", error);
@@ -877,6 +1836,9 @@ pmb_resolve_conflict(pmb_handle* handle, uint64_t blk_id1, uint64_t blk_id2)
     }
 
     backend_set_zero(handle->backend, delete_ptr);
+    backend_block_flush(handle->backend, delete_id, 0, 0);
+    backend_alloc_mark(handle->backend, delete_id, 0);
+    backend_drain(handle->backend);
     caslist_push(handle->free_list, delete_id);
 
     return return_id;
@@ -896,6 +1858,9 @@ pmb_strerror(int error)
         case PMB_ESIZE: return "key or value length invalid\0";
         case PMB_EWRGID: return "update object with obeject from different region\0";
         case PMB_EARGS: return "invalid arguement\0";
+        case PMB_ECSUM: return "checksum mismatch\0";
+        case PMB_EVERSION: return "object version mismatch\0";
+        case PMB_ENOMEM: return "cannot allocate memory\0";
         default: return "Invalid error code!\0";
     }
 }
@@ -33,6 +33,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "pmbackend.h"
 #include "kv.h"
@@ -46,49 +49,477 @@
 #define tracepoint(...)
 #endif
 
-static void tx_update_block(struct _pmb_handle *store, uint8_t tx_id,
+static void tx_update_block(struct _pmb_handle *store, uint32_t tx_id,
         uint64_t blk_id, const void *payload, size_t offset, size_t len);
 
-static void tx_slot_meta_upd_add(struct _pmb_handle *store, uint8_t tx_id,
-        uint64_t blk_id, uint32_t size);
+static uint8_t tx_slot_meta_upd_add(struct _pmb_handle *store, uint32_t tx_id,
+        uint64_t blk_id, uint32_t offset, uint32_t size);
 
-static void tx_slot_meta_upd_process(struct _pmb_handle *store, uint8_t tx_id);
+static void tx_slot_meta_upd_process(struct _pmb_handle *store, uint32_t tx_id);
+
+static void tx_meta_apply(struct _pmb_handle *store, tx_meta *meta);
+
+static int tx_metalist_init(tx_metalist *metalist);
+
+static int tx_exec_filter(struct _pmb_handle *store, tx_slot *slot,
+        uint32_t *filter, int count);
+
+static void tx_slot_release_claims(struct _pmb_handle *store, tx_slot *slot,
+        uint32_t tx_slot_id);
+
+static void tx_exec_batch(struct _pmb_handle *store, uint32_t *ids, size_t n);
+
+/*
+ * Blocks released by transaction are collected per region and returned to
+ * the free lists with single caslist_push_n call per TX_FREE_BATCH blocks.
+ */
+#define TX_FREE_BATCH 64
+
+typedef struct {
+    size_t   count[2];
+    uint64_t blk_ids[2][TX_FREE_BATCH];
+} tx_free_batch;
+
+static void
+tx_free_batch_flush(struct _pmb_handle *store, tx_free_batch *batch,
+        uint8_t region)
+{
+    caslist *list = region == PMB_META ? store->meta_free_list : store->free_list;
+    caslist_push_n(list, batch->blk_ids[region], batch->count[region]);
+    batch->count[region] = 0;
+}
+
+static void
+tx_free_batch_add(struct _pmb_handle *store, tx_free_batch *batch,
+        uint64_t blk_id)
+{
+    uint8_t region = blk_id < store->total_objs_count ? PMB_DATA : PMB_META;
+    if (batch->count[region] == TX_FREE_BATCH) {
+        tx_free_batch_flush(store, batch, region);
+    }
+    batch->blk_ids[region][batch->count[region]++] = blk_id;
+}
 
 void
-tx_log_init(struct _pmb_handle *store, uint8_t tx_slots_count)
+tx_log_init(struct _pmb_handle *store, uint32_t tx_slots_count,
+        uint8_t slot_cache)
 {
     store->op_log.tx_slots_count = tx_slots_count;
-    store->op_log.tx_slots_list = caslist_new(1, tx_slots_count);
-    store->op_log.tx_slot_capacity =
-            (get_block_size(store->max_key_len, store->max_val_len) - sizeof(tx_slot))
-            / sizeof(tx_entry);
+    store->op_log.group = NULL;
+    store->op_log.executor = NULL;
+    // slot released by execute lands in magazine of CPU which used it, so
+    // steady state begin and execute don't touch shared ranges
+    store->op_log.tx_slots_list = slot_cache ?
+            caslist_new_sharded(1, tx_slots_count, 1, tx_slots_count) :
+            caslist_new(1, tx_slots_count);
+    store->op_log.tx_slot_size = backend_tx_slot_size(store->backend);
+
+    store->op_log.upd_id_list = (tx_metalist *) calloc(tx_slots_count, sizeof(tx_metalist));
+    store->op_log.last_upd = calloc(tx_slots_count, sizeof(void *));
+
+    for (uint32_t i = 0; i < tx_slots_count; i++) {
+        tx_metalist_init(&store->op_log.upd_id_list[i]);
+    }
+}
+
+static void *
+tx_group_main(void *arg)
+{
+    struct _pmb_handle *store = arg;
+    tx_group *group = store->op_log.group;
+    size_t nslots = store->op_log.tx_slots_count;
+    uint32_t *slots = malloc(nslots * sizeof(uint32_t));
+    size_t *sizes = malloc(nslots * sizeof(size_t));
+    struct timespec deadline;
+
+    pthread_mutex_lock(&group->mutex);
+    while (group->count || !group->stop) {
+        if (!group->count) {
+            pthread_cond_wait(&group->pending_cond, &group->mutex);
+            continue;
+        }
+
+        // give other threads a chance to join the batch
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += group->window_us / 1000000;
+        deadline.tv_nsec += (group->window_us % 1000000) * 1000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (group->count < group->max_batch && !group->stop) {
+            if (pthread_cond_timedwait(&group->pending_cond, &group->mutex,
+                        &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+
+        size_t count = group->count;
+        uint64_t ticket = group->queued;
+        memcpy(slots, group->slots, count * sizeof(uint32_t));
+        memcpy(sizes, group->sizes, count * sizeof(size_t));
+        group->count = 0;
+        pthread_mutex_unlock(&group->mutex);
+
+        backend_tx_persist_batch(store->backend, slots, sizes, count);
+
+        pthread_mutex_lock(&group->mutex);
+        group->persisted = ticket;
+        pthread_cond_broadcast(&group->done_cond);
+    }
+    pthread_mutex_unlock(&group->mutex);
+
+    free(slots);
+    free(sizes);
+    return NULL;
+}
+
+/*
+ * Queues checksummed slot for the committer thread and waits until it's
+ * persisted
+ */
+static void
+tx_group_commit(struct _pmb_handle *store, uint32_t tx_slot_id, size_t size)
+{
+    tx_group *group = store->op_log.group;
+
+    pthread_mutex_lock(&group->mutex);
+    group->slots[group->count] = tx_slot_id;
+    group->sizes[group->count] = size;
+    group->count++;
+    uint64_t ticket = ++group->queued;
+    if (group->count == 1 || group->count >= group->max_batch) {
+        pthread_cond_signal(&group->pending_cond);
+    }
+    while (group->persisted < ticket) {
+        pthread_cond_wait(&group->done_cond, &group->mutex);
+    }
+    pthread_mutex_unlock(&group->mutex);
+}
+
+uint8_t
+tx_log_group_start(struct _pmb_handle *store, uint64_t window_us,
+        size_t max_batch)
+{
+    size_t nslots = store->op_log.tx_slots_count;
+    tx_group *group = calloc(1, sizeof(tx_group));
+    if (group == NULL) {
+        return PMB_ERR;
+    }
+
+    group->slots = malloc(nslots * sizeof(uint32_t));
+    group->sizes = malloc(nslots * sizeof(size_t));
+    group->window_us = window_us;
+    group->max_batch = max_batch == 0 || max_batch > nslots ? nslots : max_batch;
+    pthread_mutex_init(&group->mutex, NULL);
+    pthread_cond_init(&group->pending_cond, NULL);
+    pthread_cond_init(&group->done_cond, NULL);
+    store->op_log.group = group;
+
+    if (group->slots == NULL || group->sizes == NULL ||
+            pthread_create(&group->thread, NULL, tx_group_main, store) != 0) {
+        store->op_log.group = NULL;
+        pthread_cond_destroy(&group->done_cond);
+        pthread_cond_destroy(&group->pending_cond);
+        pthread_mutex_destroy(&group->mutex);
+        free(group->sizes);
+        free(group->slots);
+        free(group);
+        return PMB_ERR;
+    }
+
+    return PMB_OK;
+}
+
+static void
+tx_log_group_stop(struct _pmb_handle *store)
+{
+    tx_group *group = store->op_log.group;
+    if (group == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&group->mutex);
+    group->stop = 1;
+    pthread_cond_signal(&group->pending_cond);
+    pthread_mutex_unlock(&group->mutex);
+    pthread_join(group->thread, NULL);
+
+    store->op_log.group = NULL;
+    pthread_cond_destroy(&group->done_cond);
+    pthread_cond_destroy(&group->pending_cond);
+    pthread_mutex_destroy(&group->mutex);
+    free(group->sizes);
+    free(group->slots);
+    free(group);
+}
+
+static void *
+tx_exec_main(void *arg)
+{
+    struct _pmb_handle *store = arg;
+    tx_executor *exec = store->op_log.executor;
+    size_t nslots = store->op_log.tx_slots_count;
+    uint32_t single;
+    uint32_t *ids = &single;
+    size_t batch = 1;
+    if (exec->batch > 1 &&
+            (ids = malloc(exec->batch * sizeof(uint32_t))) != NULL) {
+        batch = exec->batch;
+    } else {
+        ids = &single;
+    }
+
+    pthread_mutex_lock(&exec->mutex);
+    while (exec->count || !exec->stop) {
+        if (!exec->count) {
+            pthread_cond_wait(&exec->queue_cond, &exec->mutex);
+            continue;
+        }
+
+        size_t n = 0;
+        while (exec->count && n < batch) {
+            uint32_t id = exec->queue[exec->head];
+            tx_slot *slot = backend_tx_direct(store->backend, id - 1);
+            // block changed by slot executed by other thread, wait for it
+            if (tx_exec_filter(store, slot, exec->running, 0)) {
+                break;
+            }
+            ids[n++] = id;
+            exec->head = (exec->head + 1) % nslots;
+            exec->count--;
+        }
+        if (n == 0) {
+            pthread_cond_wait(&exec->done_cond, &exec->mutex);
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            tx_exec_filter(store, backend_tx_direct(store->backend, ids[i] - 1),
+                    exec->running, 1);
+        }
+        pthread_mutex_unlock(&exec->mutex);
+
+        tx_exec_batch(store, ids, n);
+        for (size_t i = 0; i < n; i++) {
+            tx_log_free_slot(store, ids[i]);
+        }
+
+        pthread_mutex_lock(&exec->mutex);
+        for (size_t i = 0; i < n; i++) {
+            exec->pending[ids[i] - 1] = 0;
+        }
+        pthread_cond_broadcast(&exec->done_cond);
+    }
+    pthread_mutex_unlock(&exec->mutex);
+
+    if (ids != &single) {
+        free(ids);
+    }
+    return NULL;
+}
+
+static void
+tx_exec_free(tx_executor *exec)
+{
+    pthread_cond_destroy(&exec->done_cond);
+    pthread_cond_destroy(&exec->queue_cond);
+    pthread_mutex_destroy(&exec->mutex);
+    free(exec->threads);
+    free(exec->running);
+    free(exec->deferred);
+    free(exec->pending);
+    free(exec->queue);
+    free(exec);
+}
+
+uint8_t
+tx_log_exec_start(struct _pmb_handle *store, uint32_t nthreads,
+        uint32_t batch)
+{
+    size_t nslots = store->op_log.tx_slots_count;
+    tx_executor *exec = calloc(1, sizeof(tx_executor));
+    if (exec == NULL) {
+        return PMB_ERR;
+    }
+
+    exec->queue = malloc(nslots * sizeof(uint32_t));
+    exec->pending = calloc(nslots, sizeof(uint8_t));
+    exec->threads = malloc(nthreads * sizeof(pthread_t));
+    exec->deferred = calloc(TX_EXEC_FILTER, sizeof(uint32_t));
+    exec->running = calloc(TX_EXEC_FILTER, sizeof(uint32_t));
+    exec->batch = batch > nslots ? nslots : batch;
+    if (exec->batch > 1) {
+        // batches of one thread keep order of in-place updates of the block
+        nthreads = 1;
+    }
+    pthread_mutex_init(&exec->mutex, NULL);
+    pthread_cond_init(&exec->queue_cond, NULL);
+    pthread_cond_init(&exec->done_cond, NULL);
+    if (exec->queue == NULL || exec->pending == NULL || exec->threads == NULL ||
+            exec->deferred == NULL || exec->running == NULL) {
+        tx_exec_free(exec);
+        return PMB_ERR;
+    }
+
+    store->op_log.executor = exec;
+    for (exec->nthreads = 0; exec->nthreads < nthreads; exec->nthreads++) {
+        if (pthread_create(&exec->threads[exec->nthreads], NULL, tx_exec_main,
+                    store) != 0) {
+            break;
+        }
+    }
 
-    store->op_log.upd_id_list = (tx_metalist *) malloc(tx_slots_count * sizeof(tx_metalist));
+    if (exec->nthreads == 0) {
+        store->op_log.executor = NULL;
+        tx_exec_free(exec);
+        return PMB_ERR;
+    }
 
-    for (uint8_t i = 1; i <= tx_slots_count; i++) {
-        caslist_push(store->op_log.tx_slots_list, i);
+    return PMB_OK;
+}
 
-        // very dummy way, check maximal number of ops per slot
-        store->op_log.upd_id_list[i - 1].list = (tx_meta *) malloc(128 * sizeof(tx_meta));
-        store->op_log.upd_id_list[i - 1].count = 0;
+uint8_t
+tx_log_exec_queue(struct _pmb_handle *store, uint64_t tx_slot_id)
+{
+    tx_executor *exec = store->op_log.executor;
+    tx_slot *slot = backend_tx_direct(store->backend, tx_slot_id - 1);
+    if (exec == NULL || slot == NULL || slot->status != COMMITED) {
+        return PMB_ERR;
+    }
+
+    pthread_mutex_lock(&exec->mutex);
+    if (exec->pending[tx_slot_id - 1]) {
+        pthread_mutex_unlock(&exec->mutex);
+        return PMB_ERR;
     }
+    // blocks have to be visible for readers before slot is queued
+    tx_exec_filter(store, slot, exec->deferred, 1);
+    size_t nslots = store->op_log.tx_slots_count;
+    exec->queue[(exec->head + exec->count) % nslots] = tx_slot_id;
+    exec->count++;
+    exec->pending[tx_slot_id - 1] = 1;
+    pthread_cond_signal(&exec->queue_cond);
+    pthread_mutex_unlock(&exec->mutex);
+
+    return PMB_OK;
+}
+
+void
+tx_log_exec_wait(struct _pmb_handle *store, uint64_t tx_slot_id)
+{
+    tx_executor *exec = store->op_log.executor;
+    if (exec == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&exec->mutex);
+    while (exec->pending[tx_slot_id - 1]) {
+        pthread_cond_wait(&exec->done_cond, &exec->mutex);
+    }
+    pthread_mutex_unlock(&exec->mutex);
+}
+
+void
+tx_log_exec_wait_blk(struct _pmb_handle *store, uint64_t blk_id)
+{
+    tx_executor *exec = store->op_log.executor;
+    if (exec == NULL) {
+        return;
+    }
+
+    uint32_t *deferred = &exec->deferred[blk_id % TX_EXEC_FILTER];
+    if (!__sync_fetch_and_add(deferred, 0)) {
+        return;
+    }
+
+    pthread_mutex_lock(&exec->mutex);
+    while (__sync_fetch_and_add(deferred, 0)) {
+        pthread_cond_wait(&exec->done_cond, &exec->mutex);
+    }
+    pthread_mutex_unlock(&exec->mutex);
+}
+
+void
+tx_log_exec_stop(struct _pmb_handle *store)
+{
+    tx_executor *exec = store->op_log.executor;
+    if (exec == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&exec->mutex);
+    exec->stop = 1;
+    pthread_cond_broadcast(&exec->queue_cond);
+    pthread_mutex_unlock(&exec->mutex);
+    for (uint32_t i = 0; i < exec->nthreads; i++) {
+        pthread_join(exec->threads[i], NULL);
+    }
+
+    store->op_log.executor = NULL;
+    tx_exec_free(exec);
 }
 
 void
 tx_log_free(struct _pmb_handle *store)
 {
-    for (uint8_t i = 0; i < store->op_log.tx_slots_count; i++) {
+    tx_log_exec_stop(store);
+    tx_log_group_stop(store);
+    for (uint32_t i = 0; i < store->op_log.tx_slots_count; i++) {
         free(store->op_log.upd_id_list[i].list);
+        free(store->op_log.upd_id_list[i].index);
     }
     free(store->op_log.upd_id_list);
+    free(store->op_log.last_upd);
     store->op_log.tx_slots_count = 0;
     caslist_free(store->op_log.tx_slots_list);
 }
 
+uint8_t
+tx_log_empty(struct _pmb_handle *store)
+{
+    for (uint32_t i = 0; i < store->op_log.tx_slots_count; i++) {
+        tx_slot *slot = backend_tx_direct(store->backend, i);
+        if (slot != NULL && slot->status != EMPTY) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Waits until any queued slot is executed, returns 0 if there was none
+ */
+static int
+tx_exec_wait_any(struct _pmb_handle *store)
+{
+    tx_executor *exec = store->op_log.executor;
+    if (exec == NULL) {
+        return 0;
+    }
+
+    int pending = 0;
+    pthread_mutex_lock(&exec->mutex);
+    for (size_t i = 0; i < store->op_log.tx_slots_count && !pending; i++) {
+        pending = exec->pending[i];
+    }
+    if (pending) {
+        pthread_cond_wait(&exec->done_cond, &exec->mutex);
+    }
+    pthread_mutex_unlock(&exec->mutex);
+
+    return pending;
+}
+
 uint64_t
 tx_log_get_slot(struct _pmb_handle *store, uint64_t *tx_slot_pt)
 {
-    return caslist_pop(store->op_log.tx_slots_list, tx_slot_pt);
+    // slots held by background execute are released soon
+    uint64_t ret;
+    while ((ret = caslist_pop(store->op_log.tx_slots_list, tx_slot_pt)) != 0 &&
+            tx_exec_wait_any(store)) {
+    }
+    return ret;
 }
 
 void
@@ -99,15 +530,176 @@ tx_log_free_slot(struct _pmb_handle *store, uint64_t tx_slot_id)
 
 static void
 tx_slot_checksum(struct _pmb_handle *store, tx_slot *slot,
-        uint8_t tx_slot_id)
+        uint32_t tx_slot_id)
 {
 	tracepoint(tx_log, tx_slot_checksum_enter);
     // compute slot checksum without space reserved for checksum
-    util_checksum(slot, slot->size, &(slot->flch64), 1);
+    backend_checksum(store->backend, slot, slot->size, &(slot->flch64), 1);
     backend_tx_persist(store->backend, tx_slot_id, slot->size);
     tracepoint(tx_log, tx_slot_checksum_exit);
 }
 
+/*
+ * Transactions which don't fit into single slot continue in overflow slots,
+ * each slot keeps 1-based id of the next one in the chain. Overflow slots are
+ * CHAINED, only the head slot carries state of the whole transaction.
+ */
+static tx_slot *
+tx_slot_next(struct _pmb_handle *store, tx_slot *slot, uint32_t *tx_id)
+{
+    if (slot->next == 0 || slot->next > store->op_log.tx_slots_count) {
+        return NULL;
+    }
+
+    if (tx_id != NULL) {
+        *tx_id = slot->next - 1;
+    }
+    return backend_tx_direct(store->backend, slot->next - 1);
+}
+
+static inline tx_entry *
+tx_slot_first(tx_slot *slot)
+{
+    return (void *)slot + sizeof(tx_slot);
+}
+
+// end of entries, size of slot not covered by checksum is trimmed
+static inline void *
+tx_slot_end(struct _pmb_handle *store, tx_slot *slot)
+{
+    size_t size = slot->size < store->op_log.tx_slot_size ?
+            slot->size : store->op_log.tx_slot_size;
+    return (void *)slot + size;
+}
+
+// next entry, UPDINPLACE is followed by its payload
+static inline tx_entry *
+tx_entry_next(tx_entry *txe)
+{
+    void *next = (void *)txe + sizeof(tx_entry);
+    if (txe->type == UPDINPLACE) {
+        next += txe->blk_id2 >> 32;
+    }
+    return next;
+}
+
+/*
+ * Returns slot with room for len bytes at the end of transaction, when the
+ * last slot is full new overflow slot is chained to it.
+ */
+static uint8_t
+tx_slot_reserve(struct _pmb_handle *store, uint64_t tx_slot_id, size_t len,
+        tx_slot **slotp)
+{
+    if (tx_slot_id == 0 || tx_slot_id > store->op_log.tx_slots_count) {
+        return PMB_ERR;
+    }
+
+    tx_slot *slot = backend_tx_direct(store->backend, tx_slot_id - 1);
+    if (slot == NULL || slot->status != PROCESSING) {
+        return PMB_ERR;
+    }
+
+    if (sizeof(tx_slot) + len > store->op_log.tx_slot_size) {
+        return PMB_ESIZE;
+    }
+
+    tx_slot *next;
+    while ((next = tx_slot_next(store, slot, NULL)) != NULL) {
+        slot = next;
+    }
+
+    if (slot->size + len > store->op_log.tx_slot_size) {
+        uint64_t overflow_id;
+        if (tx_log_get_slot(store, &overflow_id) != 0) {
+            return PMB_ENOSPC;
+        }
+        next = backend_tx_direct(store->backend, overflow_id - 1);
+        next->flch64 = 0;
+        next->status = CHAINED;
+        next->next = 0;
+        next->size = sizeof(tx_slot);
+        slot->next = overflow_id;
+        slot = next;
+    }
+
+    *slotp = slot;
+    return PMB_OK;
+}
+
+/*
+ * Returns 1 if every slot of the chain is intact, head slot is checked by the
+ * caller
+ */
+static int
+tx_chain_valid(struct _pmb_handle *store, tx_slot *slot)
+{
+    uint32_t count = 0;
+    while ((slot = tx_slot_next(store, slot, NULL)) != NULL) {
+        if (slot->status != CHAINED || slot->size > store->op_log.tx_slot_size ||
+                !backend_checksum(store->backend, slot, slot->size,
+                    &slot->flch64, 0) ||
+                ++count >= store->op_log.tx_slots_count) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Clears overflow slots of the transaction, head slot has to be cleared first,
+ * so the chain isn't replayed again. Slots are returned to the free list when
+ * release is set.
+ */
+static void
+tx_chain_clear(struct _pmb_handle *store, tx_slot *slot, int release)
+{
+    uint32_t tx_id;
+    tx_slot *next = tx_slot_next(store, slot, &tx_id);
+    slot->next = 0;
+    while ((slot = next) != NULL && slot->status == CHAINED) {
+        uint32_t next_id;
+        next = tx_slot_next(store, slot, &next_id);
+        slot->next = 0;
+        backend_tx_set_zero(store->backend, slot);
+        if (release) {
+            tx_log_free_slot(store, tx_id + 1);
+        }
+        tx_id = next_id;
+    }
+}
+
+/*
+ * With PMB_SYNC blocks written by transaction are flushed right before the
+ * commit record, single drain in tx_slot_checksum makes them durable together
+ * instead of persisting whole pool.
+ */
+static void
+tx_slot_flush_new(struct _pmb_handle *store, tx_slot *slot)
+{
+    if (backend_get_sync_type(store->backend) != PMB_SYNC) {
+        return;
+    }
+
+    for (; slot != NULL; slot = tx_slot_next(store, slot, NULL)) {
+        void *slot_end = tx_slot_end(store, slot);
+        for (tx_entry *txe = tx_slot_first(slot); (void *)txe < slot_end;
+                txe = tx_entry_next(txe)) {
+            switch (txe->type) {
+                case WRITE:
+                    backend_block_flush(store->backend, txe->blk_id1, 0, UINT32_MAX);
+                    break;
+                case UPDATE:
+                    backend_block_flush(store->backend, txe->blk_id2, 0, UINT32_MAX);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
 uint8_t
 tx_slot_init(struct _pmb_handle *store, uint64_t tx_slot_id)
 {
@@ -125,7 +717,9 @@ tx_slot_init(struct _pmb_handle *store, uint64_t tx_slot_id)
     tx_slot *slot = slot_ptr;
     slot->flch64 = 0;
     slot->status = PROCESSING;
+    slot->next = 0;
     slot->size = sizeof(tx_slot);
+    store->op_log.last_upd[tx_slot_id] = NULL;
 
     return PMB_OK;
 }
@@ -152,130 +746,521 @@ tx_slot_commit(struct _pmb_handle *store, uint64_t tx_slot_id)
         tracepoint(tx_log, tx_slot_commit_exit);
         return PMB_ERR;
     }
+
+    // overflow slots have to be durable before commit record of the head
+    uint32_t chained_id;
+    for (tx_slot *chained = tx_slot_next(store, slot, &chained_id);
+            chained != NULL; chained = tx_slot_next(store, chained, &chained_id)) {
+        tx_slot_checksum(store, chained, chained_id);
+    }
+
     slot->status = COMMITED;
 
-    tx_slot_checksum(store, slot, tx_slot_id);
+    tx_slot_flush_new(store, slot);
+    if (store->op_log.group != NULL) {
+        backend_checksum(store->backend, slot, slot->size, &(slot->flch64), 1);
+        tx_group_commit(store, tx_slot_id, slot->size);
+    } else {
+        tx_slot_checksum(store, slot, tx_slot_id);
+    }
 
     tracepoint(tx_log, tx_slot_commit_exit);
     return PMB_OK;
 }
+
+static inline size_t
+tx_meta_hash(uint64_t blk_id, size_t mask)
+{
+    return (blk_id * 0x9E3779B97F4A7C15ULL >> 32) & mask;
+}
+
+static int
+tx_metalist_init(tx_metalist *metalist)
+{
+    metalist->list = calloc(TX_METALIST_INIT, sizeof(tx_meta));
+    metalist->index = calloc(2 * TX_METALIST_INIT, sizeof(tx_meta_idx));
+    metalist->capacity = TX_METALIST_INIT;
+    metalist->count = 0;
+    metalist->reserved = 0;
+    metalist->gen = 1;
+
+    return metalist->list == NULL || metalist->index == NULL;
+}
+
+static int
+tx_metalist_grow(tx_metalist *metalist)
+{
+    size_t capacity = 2 * metalist->capacity;
+    tx_meta *list = realloc(metalist->list, capacity * sizeof(tx_meta));
+    if (list == NULL) {
+        return 1;
+    }
+    metalist->list = list;
+
+    tx_meta_idx *index = calloc(2 * capacity, sizeof(tx_meta_idx));
+    if (index == NULL) {
+        return 1;
+    }
+
+    size_t mask = 2 * capacity - 1;
+    for (size_t i = 0; i < metalist->count; i++) {
+        size_t h = tx_meta_hash(list[i].id, mask);
+        while (index[h].gen == metalist->gen) {
+            h = (h + 1) & mask;
+        }
+        index[h].gen = metalist->gen;
+        index[h].pos = i;
+    }
+
+    free(metalist->index);
+    metalist->index = index;
+    metalist->capacity = capacity;
+
+    return 0;
+}
+
+// drops all entries, index is cleared only when generation wraps
 static void
-tx_slot_meta_upd_add(struct _pmb_handle *store, uint8_t tx_id,
-        uint64_t blk_id, uint32_t size)
+tx_metalist_reset(tx_metalist *metalist)
 {
-	tracepoint(tx_log, tx_slot_meta_upd_add_enter);
-    size_t i = 0;
-    tx_metalist *metalist = &store->op_log.upd_id_list[tx_id];
-    tx_meta *meta;
-    while (i < metalist->count) {
-        if (metalist->list[i].id == blk_id || metalist->list[i].id == 0)
-            break;
-        i++;
+    metalist->count = 0;
+    metalist->reserved = 0;
+    if (++metalist->gen == 0) {
+        memset(metalist->index, 0,
+                2 * metalist->capacity * sizeof(tx_meta_idx));
+        metalist->gen = 1;
     }
+}
 
-    meta = &metalist->list[i];
-    if (meta->id == 0) {
+/*
+ * Makes room for one more block updated by logged transaction, so entries can
+ * be added at execute without growing the list
+ */
+static uint8_t
+tx_metalist_reserve(tx_metalist *metalist)
+{
+    while (metalist->count + metalist->reserved >= metalist->capacity) {
+        if (tx_metalist_grow(metalist) != 0) {
+            return PMB_ENOMEM;
+        }
+    }
+    metalist->reserved++;
+
+    return PMB_OK;
+}
+
+/*
+ * Returns entry for the block, new entry is added when block isn't tracked
+ * yet and *added is set
+ */
+static tx_meta *
+tx_metalist_get(tx_metalist *metalist, uint64_t blk_id, int *added)
+{
+    size_t mask = 2 * metalist->capacity - 1;
+    size_t h = tx_meta_hash(blk_id, mask);
+    while (metalist->index[h].gen == metalist->gen) {
+        tx_meta *meta = &metalist->list[metalist->index[h].pos];
+        if (meta->id == blk_id) {
+            *added = 0;
+            return meta;
+        }
+        h = (h + 1) & mask;
+    }
+
+    if (metalist->count == metalist->capacity) {
+        if (tx_metalist_grow(metalist) != 0) {
+            return NULL;
+        }
+        return tx_metalist_get(metalist, blk_id, added);
+    }
+
+    metalist->index[h].gen = metalist->gen;
+    metalist->index[h].pos = metalist->count;
+    *added = 1;
+    return &metalist->list[metalist->count++];
+}
+
+/*
+ * Extends metadata update of the block by written range, entry is initialized
+ * from block header when it's new
+ */
+static void
+tx_meta_track(struct _pmb_handle *store, tx_meta *meta, int added,
+        uint64_t blk_id, uint32_t offset, uint32_t size)
+{
+    if (added) {
         meta->id = blk_id;
         pmb_data_hdr *obj_meta = backend_direct(store->backend, blk_id);
         meta->version = obj_meta->version;
+        meta->base = obj_meta->version;
         meta->val_len = obj_meta->val_len;
-        metalist->count++;
+        meta->offset = offset;
+        meta->end = offset + size;
+    }
+
+    meta->version += 1;
+
+    // gap between old end of value and written range changes checksum too
+    if (offset > meta->val_len) {
+        offset = meta->val_len;
+    }
+    if (meta->offset > offset) {
+        meta->offset = offset;
+    }
+    if (meta->end < offset + size) {
+        meta->end = offset + size;
+    }
+
+    if (meta->val_len < offset + size) {
+        meta->val_len = offset + size;
+    }
+}
+
+/*
+ * Returns PMB_ENOMEM when list of blocks updated by the slot can't grow
+ */
+static uint8_t
+tx_slot_meta_upd_add(struct _pmb_handle *store, uint32_t tx_id,
+        uint64_t blk_id, uint32_t offset, uint32_t size)
+{
+	tracepoint(tx_log, tx_slot_meta_upd_add_enter);
+    int added;
+    tx_meta *meta = tx_metalist_get(&store->op_log.upd_id_list[tx_id], blk_id,
+            &added);
+    if (meta == NULL) {
+        tracepoint(tx_log, tx_slot_meta_upd_add_exit);
+        return PMB_ENOMEM;
+    }
+
+    tx_meta_track(store, meta, added, blk_id, offset, size);
+
+    tracepoint(tx_log, tx_slot_meta_upd_add_exit);
+    return PMB_OK;
+}
+
+static void
+tx_update_block(struct _pmb_handle *store, uint32_t tx_id, uint64_t blk_id,
+        const void *payload, size_t offset, size_t len)
+{
+	tracepoint(tx_log, tx_update_block_enter);
+
+    void *obj = backend_direct(store->backend, blk_id);
+    tracepoint(tx_log, backend_memcpy_enter);
+    backend_memcpy(store->backend,
+            obj + sizeof(pmb_data_hdr) + store->max_key_len + offset, payload,
+            len);
+	tracepoint(tx_log, backend_memcpy_exit);
+
+    // space is reserved when update is logged, but replay starts with empty
+    // lists, header of block which can't be tracked is updated right away
+    if (tx_slot_meta_upd_add(store, tx_id, blk_id, offset, len) != PMB_OK) {
+        tx_meta meta;
+        tx_meta_track(store, &meta, 1, blk_id, offset, len);
+        tx_meta_apply(store, &meta);
+    }
+
+    tracepoint(tx_log, tx_update_block_exit);
+}
+
+/*
+ * Executes single entry of committed transaction, blocks released by it are
+ * added to the batch
+ */
+static void
+tx_entry_execute(struct _pmb_handle *store, uint32_t tx_slot_id,
+        tx_entry *txe, tx_free_batch *batch)
+{
+    void *obj;
+    uint32_t offset;
+    uint32_t size;
+    uint8_t error = 0;
+
+    switch (txe->type) {
+        case WRITE:
+            key_index_update(store, txe->blk_id1, 0);
+            backend_alloc_mark(store->backend, txe->blk_id1, 1);
+            break;
+        case UPDATE:
+            key_index_update(store, txe->blk_id2, 0);
+            backend_alloc_mark(store->backend, txe->blk_id2, 1);
+            /* fall through */
+        case REMOVE:
+            recovery_validate(store, txe->blk_id1);
+            obj = backend_get(store->backend, txe->blk_id1, &error);
+            if (obj) {
+                key_index_update(store, 0, txe->blk_id1);
+                backend_set_zero(store->backend, obj);
+                backend_block_flush(store->backend, txe->blk_id1, 0, 0);
+                backend_alloc_mark(store->backend, txe->blk_id1, 0);
+                tx_free_batch_add(store, batch, txe->blk_id1);
+
+                logprintf("tx_log: releasing blk_id: %zu\n", txe->blk_id1);
+            }
+            break;
+        case UPDINPLACE:
+            // copy to the existing object and sync
+            size = txe->blk_id2 >> 32;
+            offset = txe->blk_id2 & 0xffffffff;
+            obj = (void *)txe + sizeof(tx_entry);
+            recovery_validate(store, txe->blk_id1);
+            tx_update_block(store, tx_slot_id, txe->blk_id1, obj, offset,
+                    size);
+            break;
+        default:
+            break;
+    }
+}
+
+uint8_t
+tx_slot_execute(struct _pmb_handle *store, uint64_t tx_slot_id)
+{
+	tracepoint(tx_log, tx_slot_execute_enter);
+
+    tx_slot_id--;
+    void *slot_ptr = backend_tx_direct(store->backend, tx_slot_id);
+
+    if (slot_ptr == NULL) {
+        printf("tx_execute: error lane\n");
+        tracepoint(tx_log, tx_slot_execute_exit);
+        return PMB_ERR;
+    }
+    tx_slot *slot = slot_ptr;
+
+    if (slot->status != COMMITED) {
+        tracepoint(tx_log, tx_slot_execute_exit);
+        return PMB_ERR;
+    }
+
+    tx_entry *txe;
+    tx_free_batch batch = { .count = { 0, 0 } };
+    for (tx_slot *cur = slot; cur != NULL; cur = tx_slot_next(store, cur, NULL)) {
+        void *slot_end = tx_slot_end(store, cur);
+        for (txe = tx_slot_first(cur); (void *)txe < slot_end;
+                txe = tx_entry_next(txe)) {
+            tx_entry_execute(store, tx_slot_id, txe, &batch);
+        }
+    }
+
+    tx_free_batch_flush(store, &batch, PMB_DATA);
+    tx_free_batch_flush(store, &batch, PMB_META);
+
+    tx_slot_meta_upd_process(store, tx_slot_id);
+    tx_slot_release_claims(store, slot, tx_slot_id);
+
+    backend_tx_set_zero(store->backend, slot_ptr);
+    tx_chain_clear(store, slot, 1);
+
+    tracepoint(tx_log, tx_slot_execute_exit);
+    return PMB_OK;
+}
+
+/*
+ * Adds count to counters of blocks changed by committed slot in the filter of
+ * block ids. With count 0 returns 1 if counter of any of them is set.
+ */
+static int
+tx_exec_filter(struct _pmb_handle *store, tx_slot *slot, uint32_t *filter,
+        int count)
+{
+    if (slot == NULL || slot->status != COMMITED) {
+        return 0;
+    }
+
+    for (tx_slot *cur = slot; cur != NULL; cur = tx_slot_next(store, cur, NULL)) {
+        void *slot_end = tx_slot_end(store, cur);
+        for (tx_entry *txe = tx_slot_first(cur); (void *)txe < slot_end;
+                txe = tx_entry_next(txe)) {
+            if (txe->type > REMOVE) {
+                continue;
+            }
+            // blk_id2 holds offset and size of in-place update
+            uint64_t blks[2] = { txe->blk_id1,
+                    txe->type == UPDATE ? txe->blk_id2 : 0 };
+            for (int i = 0; i < 2; i++) {
+                uint32_t *counter = &filter[blks[i] % TX_EXEC_FILTER];
+                if (blks[i] == 0) {
+                    continue;
+                } else if (count == 0) {
+                    if (__sync_fetch_and_add(counter, 0)) {
+                        return 1;
+                    }
+                } else {
+                    __sync_fetch_and_add(counter, count);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Releases blocks claimed by conditional updates of the transaction, after
+ * execute their version already moved
+ */
+static void
+tx_slot_release_claims(struct _pmb_handle *store, tx_slot *slot,
+        uint32_t tx_slot_id)
+{
+    uint32_t *claims = store->claims;
+    if (claims == NULL) {
+        return;
+    }
+
+    for (tx_slot *cur = slot; cur != NULL; cur = tx_slot_next(store, cur, NULL)) {
+        void *slot_end = tx_slot_end(store, cur);
+        for (tx_entry *txe = tx_slot_first(cur); (void *)txe < slot_end;
+                txe = tx_entry_next(txe)) {
+            if ((txe->type == UPDATE || txe->type == UPDINPLACE) &&
+                    txe->blk_id1 < store->total_objs_count) {
+                __sync_bool_compare_and_swap(&claims[txe->blk_id1],
+                        tx_slot_id + 1, 0);
+            }
+        }
     }
+}
 
-    meta->version += 1;
+typedef struct {
+    uint64_t  blk_id;
+    uint32_t  tx_slot_id;
+    uint32_t  seq;
+    tx_entry* entry;
+} tx_deferred_upd;
 
-    if (meta->val_len < size) {
-        meta->val_len = size;
+static int
+tx_deferred_upd_cmp(const void *a, const void *b)
+{
+    const tx_deferred_upd *upd1 = a;
+    const tx_deferred_upd *upd2 = b;
+    if (upd1->blk_id != upd2->blk_id) {
+        return upd1->blk_id < upd2->blk_id ? -1 : 1;
     }
+    return upd1->seq < upd2->seq ? -1 : upd1->seq > upd2->seq;
+}
 
-    tracepoint(tx_log, tx_slot_meta_upd_add_exit);
+/*
+ * Returns 1 if slot removes or replaces block with in-place update deferred
+ * from earlier slot of the batch
+ */
+static int
+tx_exec_conflict(struct _pmb_handle *store, tx_slot *slot,
+        const tx_deferred_upd *upds, size_t count)
+{
+    for (tx_slot *cur = slot; cur != NULL; cur = tx_slot_next(store, cur, NULL)) {
+        void *slot_end = tx_slot_end(store, cur);
+        for (tx_entry *txe = tx_slot_first(cur); (void *)txe < slot_end;
+                txe = tx_entry_next(txe)) {
+            if (txe->type != REMOVE && txe->type != UPDATE) {
+                continue;
+            }
+            for (size_t i = 0; i < count; i++) {
+                if (upds[i].blk_id == txe->blk_id1) {
+                    return 1;
+                }
+            }
+        }
+    }
+
+    return 0;
 }
 
+/*
+ * Applies deferred in-place updates ordered by block id and finishes slots
+ * whose other entries were already executed
+ */
 static void
-tx_update_block(struct _pmb_handle *store, uint8_t tx_id, uint64_t blk_id,
-        const void *payload, size_t offset, size_t len)
+tx_exec_apply(struct _pmb_handle *store, uint32_t *ids, size_t n,
+        tx_deferred_upd *upds, size_t count, tx_free_batch *batch)
 {
-	tracepoint(tx_log, tx_update_block_enter);
+    if (count > 0) {
+        qsort(upds, count, sizeof(tx_deferred_upd), tx_deferred_upd_cmp);
+    }
+    for (size_t i = 0; i < count; i++) {
+        tx_entry_execute(store, upds[i].tx_slot_id, upds[i].entry, batch);
+    }
 
-    void *obj = backend_direct(store->backend, blk_id);
-    tracepoint(tx_log, backend_memcpy_enter);
-    backend_memcpy(store->backend,
-            obj + sizeof(pmb_data_hdr) + store->max_key_len + offset, payload,
-            len);
-	tracepoint(tx_log, backend_memcpy_exit);
+    tx_free_batch_flush(store, batch, PMB_DATA);
+    tx_free_batch_flush(store, batch, PMB_META);
+
+    for (size_t i = 0; i < n; i++) {
+        tx_slot *slot = backend_tx_direct(store->backend, ids[i] - 1);
+        if (slot == NULL || slot->status != COMMITED) {
+            continue;
+        }
 
-    tx_slot_meta_upd_add(store, tx_id, blk_id, offset + len);
+        tx_slot_meta_upd_process(store, ids[i] - 1);
+        tx_slot_release_claims(store, slot, ids[i] - 1);
+        // blocks are up to date, readers and following slots don't have to
+        // wait for them
+        tx_exec_filter(store, slot, store->op_log.executor->deferred, -1);
+        tx_exec_filter(store, slot, store->op_log.executor->running, -1);
 
-    tracepoint(tx_log, tx_update_block_exit);
+        backend_tx_set_zero(store->backend, slot);
+        tx_chain_clear(store, slot, 1);
+    }
 }
 
-uint8_t
-tx_slot_execute(struct _pmb_handle *store, uint64_t tx_slot_id)
+/*
+ * Executes queued slots together. In-place updates of all of them are applied
+ * ordered by block id, updates of the same block keep their order, so home
+ * blocks are written sequentially and once per batch. Other entries are
+ * executed slot by slot. Slot removing or replacing block updated by earlier
+ * slot starts new batch, so the block isn't written after it's released.
+ */
+static void
+tx_exec_batch(struct _pmb_handle *store, uint32_t *ids, size_t n)
 {
-	tracepoint(tx_log, tx_slot_execute_enter);
-
-    tx_slot_id--;
-    void *slot_ptr = backend_tx_direct(store->backend, tx_slot_id);
+    tx_deferred_upd *upds = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    size_t first = 0;
+    tx_free_batch batch = { .count = { 0, 0 } };
+
+    for (size_t i = 0; i < n; i++) {
+        tx_slot *slot = backend_tx_direct(store->backend, ids[i] - 1);
+        if (slot == NULL || slot->status != COMMITED) {
+            continue;
+        }
 
-    if (slot_ptr == NULL) {
-        printf("tx_execute: error lane\n");
-        tracepoint(tx_log, tx_slot_execute_exit);
-        return PMB_ERR;
-    }
-    tx_slot *slot = slot_ptr;
+        if (count > 0 && tx_exec_conflict(store, slot, upds, count)) {
+            tx_exec_apply(store, ids + first, i - first, upds, count, &batch);
+            count = 0;
+            first = i;
+        }
 
-    if (slot->status != COMMITED) {
-        tracepoint(tx_log, tx_slot_execute_exit);
-        return PMB_ERR;
-    }
+        for (tx_slot *cur = slot; cur != NULL;
+                cur = tx_slot_next(store, cur, NULL)) {
+            void *slot_end = tx_slot_end(store, cur);
+            for (tx_entry *txe = tx_slot_first(cur); (void *)txe < slot_end;
+                    txe = tx_entry_next(txe)) {
+                if (txe->type != UPDINPLACE) {
+                    tx_entry_execute(store, ids[i] - 1, txe, &batch);
+                    continue;
+                }
 
-    void *entries = slot_ptr + sizeof(tx_slot);
-    void *slot_end = slot_ptr + slot->size;
-    void *obj;
-    tx_entry *txe;
-    uint32_t offset;
-    uint32_t size;
-    uint8_t error = 0;
-    while (entries < slot_end) {
-        txe = entries;
-        switch (txe->type) {
-            case UPDATE:
-            case REMOVE:
-                obj = backend_get(store->backend, txe->blk_id1, &error);
-                if (obj) {
-                    backend_set_zero(store->backend, obj);
-                    if (txe->blk_id1 < store->total_objs_count) {
-                        caslist_push(store->free_list, txe->blk_id1);
-                    } else {
-                        caslist_push(store->meta_free_list, txe->blk_id1);
+                if (count == capacity) {
+                    size_t new_capacity = capacity ? capacity * 2 : 64;
+                    tx_deferred_upd *tmp = realloc(upds,
+                            new_capacity * sizeof(tx_deferred_upd));
+                    if (tmp == NULL) {
+                        // no memory to sort, update the block right away
+                        tx_entry_execute(store, ids[i] - 1, txe, &batch);
+                        continue;
                     }
-
-                    logprintf("tx_log: releasing blk_id: %zu\n", txe->blk_id1);
+                    upds = tmp;
+                    capacity = new_capacity;
                 }
-                entries += sizeof(tx_entry);
-                break;
-            case UPDINPLACE:
-                // copy to the existing object and sync
-                size = txe->blk_id2 >> 32;
-                offset = txe->blk_id2 & 0xffffffff;
-                obj = entries + sizeof(tx_entry);
-                tx_update_block(store, tx_slot_id, txe->blk_id1, obj, offset,
-                        size);
-                entries = obj + size;
-                break;
-            default:
-                entries += sizeof(tx_entry);
+                upds[count].blk_id = txe->blk_id1;
+                upds[count].tx_slot_id = ids[i] - 1;
+                upds[count].seq = count;
+                upds[count].entry = txe;
+                count++;
+            }
         }
     }
 
-    // Chaining transaction slots not yet supported
-
-    tx_slot_meta_upd_process(store, tx_slot_id);
-
-    backend_tx_set_zero(store->backend, slot_ptr);
-
-    tracepoint(tx_log, tx_slot_execute_exit);
-    return PMB_OK;
+    tx_exec_apply(store, ids + first, n - first, upds, count, &batch);
+    free(upds);
 }
 
 uint8_t
@@ -289,7 +1274,6 @@ tx_slot_abort(struct _pmb_handle *store, uint64_t tx_slot_id)
 
      printf("tx_abort: %p\n", slot_ptr);
      tx_slot *slot = slot_ptr;
-     tx_entry *entries = slot_ptr + sizeof(tx_slot);
 
      if(slot->status != PROCESSING && slot->status != COMMITED) {
         return PMB_ERR;
@@ -299,44 +1283,46 @@ tx_slot_abort(struct _pmb_handle *store, uint64_t tx_slot_id)
 
      tx_slot_checksum(store, slot, tx_slot_id);
      void *update_clear_ptr, *write_clear_ptr;
-     void *slot_end = slot_ptr + slot->size;
      tx_entry *txe;
+     tx_free_batch batch = { .count = { 0, 0 } };
      // process entries, all new blocks (blk_id1 from WRITE and blk_id2 from UPDATE
      // should be zeroed and returned to the free list
 
-     for(void *position_ptr = entries; position_ptr < slot_end;
-             position_ptr += sizeof(tx_entry)) {
-         txe = (tx_entry *)position_ptr;
-         switch(txe->type) {
-             case UPDATE:
-                 update_clear_ptr = backend_direct(store->backend, txe->blk_id2);
-                 backend_set_zero(store->backend, update_clear_ptr);
-                 if (txe->blk_id2 < store->total_objs_count) {
-                    caslist_push(store->free_list, txe->blk_id2);
-                 } else {
-                    caslist_push(store->meta_free_list, txe->blk_id2);
-                 }
-                 break;
-             case WRITE:
-                 write_clear_ptr = backend_direct(store->backend, txe->blk_id1);
-                 backend_set_zero(store->backend, write_clear_ptr);
-                 if (txe->blk_id1 < store->total_objs_count) {
-                    caslist_push(store->free_list, txe->blk_id1);
-                 } else {
-                    caslist_push(store->meta_free_list, txe->blk_id1);
-                 }
-                 break;
-             default:
-                break;
+     for (tx_slot *cur = slot; cur != NULL; cur = tx_slot_next(store, cur, NULL)) {
+         void *slot_end = tx_slot_end(store, cur);
+         for (txe = tx_slot_first(cur); (void *)txe < slot_end;
+                 txe = tx_entry_next(txe)) {
+             switch(txe->type) {
+                 case UPDATE:
+                     update_clear_ptr = backend_direct(store->backend, txe->blk_id2);
+                     backend_set_zero(store->backend, update_clear_ptr);
+                     backend_block_flush(store->backend, txe->blk_id2, 0, 0);
+                     tx_free_batch_add(store, &batch, txe->blk_id2);
+                     break;
+                 case WRITE:
+                     write_clear_ptr = backend_direct(store->backend, txe->blk_id1);
+                     backend_set_zero(store->backend, write_clear_ptr);
+                     backend_block_flush(store->backend, txe->blk_id1, 0, 0);
+                     tx_free_batch_add(store, &batch, txe->blk_id1);
+                     break;
+                 default:
+                    break;
+             }
          }
      }
 
+     tx_free_batch_flush(store, &batch, PMB_DATA);
+     tx_free_batch_flush(store, &batch, PMB_META);
+     tx_slot_release_claims(store, slot, tx_slot_id);
+     tx_metalist_reset(&store->op_log.upd_id_list[tx_slot_id]);
+
      slot->status = EMPTY;
      slot->size = 0;
 
      tx_slot_checksum(store, slot, tx_slot_id);
 
      backend_tx_set_zero(store->backend, slot_ptr);
+     tx_chain_clear(store, slot, 1);
 
      return PMB_OK;
 }
@@ -345,49 +1331,127 @@ uint8_t
 tx_slot_op_write(struct _pmb_handle *store, uint64_t tx_slot_id,
         uint64_t blk_id, uint32_t size)
 {
-    tx_slot_id--;
-    void *slot_ptr = backend_tx_direct(store->backend, tx_slot_id);
+    tx_slot *slot;
+    uint8_t ret = tx_slot_reserve(store, tx_slot_id, sizeof(tx_entry), &slot);
+    if (ret != PMB_OK)
+        return ret;
 
-    if (slot_ptr == NULL)
-        return PMB_ERR;
-
-    tx_slot *slot = slot_ptr;
-    tx_entry *entry = slot_ptr + slot->size;
-
-    if (slot->status != PROCESSING) {
-        return PMB_ERR;
-    }
+    tx_entry *entry = (void *)slot + slot->size;
 
     entry->type = WRITE;
     entry->blk_id1 = blk_id;
     slot->size += sizeof(tx_entry);
+    store->op_log.last_upd[tx_slot_id - 1] = NULL;
 
     return PMB_OK;
 }
 
+/*
+ * Merges update with in-place update logged right before it when both are for
+ * the same block and their ranges overlap or touch, payload of the logged
+ * entry is extended at the end of the slot. Returns 1 if update was merged.
+ */
+static int
+tx_slot_merge_update(struct _pmb_handle *store, uint64_t tx_slot_id,
+        uint64_t blk_id, const void *data, uint32_t offset, uint32_t size)
+{
+    tx_entry *last = store->op_log.last_upd[tx_slot_id - 1];
+    if (last == NULL || last->blk_id1 != blk_id) {
+        return 0;
+    }
+
+    uint64_t last_offset = last->blk_id2 & 0xffffffff;
+    uint64_t last_end = last_offset + (last->blk_id2 >> 32);
+    if (offset > last_end || (uint64_t)offset + size < last_offset) {
+        return 0;
+    }
+
+    uint64_t begin = offset < last_offset ? offset : last_offset;
+    uint64_t end = (uint64_t)offset + size > last_end ? offset + size : last_end;
+    size_t grow = (end - begin) - (last_end - last_offset);
+
+    tx_slot *slot = backend_tx_direct(store->backend, tx_slot_id - 1);
+    tx_slot *next;
+    while ((next = tx_slot_next(store, slot, NULL)) != NULL) {
+        slot = next;
+    }
+    void *payload = (void *)last + sizeof(tx_entry);
+    if (payload + (last_end - last_offset) != (void *)slot + slot->size ||
+            slot->size + grow > store->op_log.tx_slot_size) {
+        return 0;
+    }
+
+    memmove(payload + (last_offset - begin), payload, last_end - last_offset);
+    memcpy(payload + (offset - begin), data, size);
+    last->blk_id2 = ((end - begin) << 32) | begin;
+    slot->size += grow;
+
+    return 1;
+}
+
+/*
+ * Payload larger than free space of the last slot is split into several
+ * entries, which continue in chained slots, so in-place update of any size
+ * writes only the modified range of the block. When slots run out, pieces
+ * logged so far are dropped and PMB_ENOSPC is returned, so the caller can
+ * copy the object instead.
+ */
 uint8_t
 tx_slot_op_small_update(struct _pmb_handle *store, uint64_t tx_slot_id,
         uint64_t blk_id, void *data, uint32_t offset, uint32_t size)
 {
-    tx_slot_id--;
-    void *slot_ptr = backend_tx_direct(store->backend, tx_slot_id);
-
-    if (slot_ptr == NULL)
+    if (tx_slot_id == 0 || tx_slot_id > store->op_log.tx_slots_count) {
         return PMB_ERR;
+    }
 
-    tx_slot *slot = slot_ptr;
-    tx_entry *entry = slot_ptr + slot->size;
+    if (tx_slot_merge_update(store, tx_slot_id, blk_id, data, offset, size)) {
+        return PMB_OK;
+    }
 
-    if (slot->status != PROCESSING) {
-        return PMB_ERR;
+    uint8_t ret = tx_metalist_reserve(
+            &store->op_log.upd_id_list[tx_slot_id - 1]);
+    if (ret != PMB_OK) {
+        return ret;
     }
 
-    entry->type = UPDINPLACE;
-    entry->blk_id1 = blk_id;
-    entry->blk_id2 = ((uint64_t) size << 32) | offset;
-    backend_memcpy(store->backend, (void *) entry + sizeof(tx_entry), data,
-            size);
-    slot->size += sizeof(tx_entry) + size;
+    tx_slot *tail = backend_tx_direct(store->backend, tx_slot_id - 1);
+    tx_slot *next;
+    while ((next = tx_slot_next(store, tail, NULL)) != NULL) {
+        tail = next;
+    }
+    size_t tail_size = tail->size;
+    tx_entry *last_upd = store->op_log.last_upd[tx_slot_id - 1];
+
+    do {
+        tx_slot *slot;
+        uint32_t piece = size < TX_UPDATE_MIN_PIECE ? size : TX_UPDATE_MIN_PIECE;
+        ret = tx_slot_reserve(store, tx_slot_id, sizeof(tx_entry) + piece,
+                &slot);
+        if (ret != PMB_OK) {
+            tail->size = tail_size;
+            tx_chain_clear(store, tail, 1);
+            store->op_log.last_upd[tx_slot_id - 1] = last_upd;
+            return ret;
+        }
+
+        // take whole free space of the slot
+        size_t room = store->op_log.tx_slot_size - slot->size - sizeof(tx_entry);
+        piece = size < room ? size : room;
+
+        tx_entry *entry = (void *)slot + slot->size;
+
+        entry->type = UPDINPLACE;
+        entry->blk_id1 = blk_id;
+        entry->blk_id2 = ((uint64_t) piece << 32) | offset;
+        backend_memcpy(store->backend, (void *) entry + sizeof(tx_entry), data,
+                piece);
+        slot->size += sizeof(tx_entry) + piece;
+        store->op_log.last_upd[tx_slot_id - 1] = entry;
+
+        data += piece;
+        offset += piece;
+        size -= piece;
+    } while (size);
 
     return PMB_OK;
 }
@@ -396,143 +1460,349 @@ uint8_t
 tx_slot_op_update(struct _pmb_handle *store, uint64_t tx_slot_id,
         uint64_t old_blk_id, uint64_t new_blk_id, uint32_t size)
 {
-    tx_slot_id--;
-    void *slot_ptr = backend_tx_direct(store->backend, tx_slot_id);
-
-    if (slot_ptr == NULL)
-        return PMB_ERR;
-
-    tx_slot *slot = slot_ptr;
-    tx_entry *entry = slot_ptr + slot->size;
+    tx_slot *slot;
+    uint8_t ret = tx_slot_reserve(store, tx_slot_id, sizeof(tx_entry), &slot);
+    if (ret != PMB_OK)
+        return ret;
 
-    if (slot->status != PROCESSING) {
-        return PMB_ERR;
-    }
+    tx_entry *entry = (void *)slot + slot->size;
 
     entry->type = UPDATE;
     entry->blk_id1 = old_blk_id;
     entry->blk_id2 = new_blk_id;
     slot->size += sizeof(tx_entry);
+    store->op_log.last_upd[tx_slot_id - 1] = NULL;
 
     return PMB_OK;
 }
 
 uint8_t
-tx_slot_op_remove(struct _pmb_handle *store, uint64_t tx_slot_id,
-        uint64_t blk_id)
+tx_slot_op_write_n(struct _pmb_handle *store, uint64_t tx_slot_id,
+        const uint64_t *old_blk_ids, const uint64_t *new_blk_ids, size_t n,
+        size_t *done)
 {
-    tx_slot_id--;
-    void *slot_ptr = backend_tx_direct(store->backend, tx_slot_id);
-
-    if (slot_ptr == NULL)
-        return PMB_ERR;
+    size_t i = 0;
+    uint8_t ret = PMB_OK;
+    while (i < n) {
+        tx_slot *slot;
+        ret = tx_slot_reserve(store, tx_slot_id, sizeof(tx_entry), &slot);
+        if (ret != PMB_OK)
+            break;
 
-    tx_slot *slot = slot_ptr;
-    tx_entry *entry = slot_ptr + slot->size;
+        // fill whole free space of the slot before reserving again
+        size_t room = (store->op_log.tx_slot_size - slot->size) / sizeof(tx_entry);
+        tx_entry *entry = (void *)slot + slot->size;
+        for (size_t end = i + room < n ? i + room : n; i < end; i++, entry++) {
+            if (old_blk_ids[i]) {
+                entry->type = UPDATE;
+                entry->blk_id1 = old_blk_ids[i];
+                entry->blk_id2 = new_blk_ids[i];
+            } else {
+                entry->type = WRITE;
+                entry->blk_id1 = new_blk_ids[i];
+            }
+            slot->size += sizeof(tx_entry);
+        }
+    }
 
-    if (slot->status != PROCESSING) {
-        return PMB_ERR;
+    if (i) {
+        store->op_log.last_upd[tx_slot_id - 1] = NULL;
     }
+    *done = i;
+    return ret;
+}
+
+uint8_t
+tx_slot_op_remove(struct _pmb_handle *store, uint64_t tx_slot_id,
+        uint64_t blk_id)
+{
+    tx_slot *slot;
+    uint8_t ret = tx_slot_reserve(store, tx_slot_id, sizeof(tx_entry), &slot);
+    if (ret != PMB_OK)
+        return ret;
+
+    tx_entry *entry = (void *)slot + slot->size;
 
     entry->type = REMOVE;
     entry->blk_id1 = blk_id;
     slot->size += sizeof(tx_entry);
+    store->op_log.last_upd[tx_slot_id - 1] = NULL;
 
     return PMB_OK;
 }
 
-void tx_log_check(struct _pmb_handle *store)
+/*
+ * Shared state of tx log replay. Slots are handed out to replay threads one
+ * by one, changes of the same block are serialized with stripe locks.
+ */
+#define TX_CHECK_LOCKS 64
+
+typedef struct {
+    struct _pmb_handle *store;
+    uint32_t            next;
+    pthread_mutex_t     locks[TX_CHECK_LOCKS];
+} tx_check_state;
+
+/*
+ * Locks stripes of both blocks changed by entry, lower stripe first, so
+ * threads replaying entries with the same pair of blocks don't deadlock
+ */
+static void
+tx_check_lock(tx_check_state *state, tx_entry *entry, int lock)
 {
-    printf("TX_LOG_CHECK START\n");
-    void *slot_ptr = NULL;
+    // blk_id2 of in-place update holds its offset and size
+    uint64_t stripe1 = entry->blk_id1 % TX_CHECK_LOCKS;
+    uint64_t stripe2 = entry->type == UPDATE ?
+            entry->blk_id2 % TX_CHECK_LOCKS : stripe1;
+    if (stripe1 > stripe2) {
+        uint64_t tmp = stripe1;
+        stripe1 = stripe2;
+        stripe2 = tmp;
+    }
+
+    if (lock) {
+        pthread_mutex_lock(&state->locks[stripe1]);
+        if (stripe2 != stripe1) {
+            pthread_mutex_lock(&state->locks[stripe2]);
+        }
+    } else {
+        if (stripe2 != stripe1) {
+            pthread_mutex_unlock(&state->locks[stripe2]);
+        }
+        pthread_mutex_unlock(&state->locks[stripe1]);
+    }
+}
+
+/*
+ * Replays committed or reverts unfinished entries of single slot, blocks of
+ * the entry are changed under their stripe locks
+ */
+static void
+tx_log_check_slot(tx_check_state *state, uint32_t tx_slot_id,
+        tx_slot *slot, int commit)
+{
+    struct _pmb_handle *store = state->store;
     void *obj = NULL;
     uint32_t offset;
     uint32_t size;
+    void *slot_end = tx_slot_end(store, slot);
 
-    for(uint8_t tx_slot_id = 1; tx_slot_id <= store->op_log.tx_slots_count; tx_slot_id++) {
-        slot_ptr = backend_tx_direct(store->backend, tx_slot_id);
+    for (tx_entry *entry = tx_slot_first(slot); (void *)entry < slot_end;
+            entry = tx_entry_next(entry)) {
+        if (!entry->blk_id1 && !entry->blk_id2) {
+            break;
+        }
 
-        if (slot_ptr == NULL)
-            continue;
+        tx_check_lock(state, entry, 1);
+        switch (entry->type) {
+            case WRITE:
+                if (!commit) {
+                    obj = backend_direct(store->backend, entry->blk_id1);
+                    backend_set_zero(store->backend, obj);
+                    backend_block_flush(store->backend, entry->blk_id1, 0, 0);
+                } else {
+                    key_index_update(store, entry->blk_id1, 0);
+                }
+                backend_alloc_mark(store->backend, entry->blk_id1, commit);
+                break;
+            case REMOVE:
+                if (commit) {
+                    key_index_update(store, 0, entry->blk_id1);
+                    obj = backend_direct(store->backend, entry->blk_id1);
+                    backend_set_zero(store->backend, obj);
+                    backend_block_flush(store->backend, entry->blk_id1, 0, 0);
+                    backend_alloc_mark(store->backend, entry->blk_id1, 0);
+                }
+                break;
+            case UPDATE:
+                if (commit) {
+                    key_index_update(store, entry->blk_id2, entry->blk_id1);
+                    obj = backend_direct(store->backend, entry->blk_id1);
+                    backend_set_zero(store->backend, obj);
+                    backend_block_flush(store->backend, entry->blk_id1, 0, 0);
+                    backend_alloc_mark(store->backend, entry->blk_id1, 0);
+                    backend_alloc_mark(store->backend, entry->blk_id2, 1);
+                } else {
+                    obj = backend_direct(store->backend, entry->blk_id2);
+                    backend_set_zero(store->backend, obj);
+                    backend_block_flush(store->backend, entry->blk_id2, 0, 0);
+                    backend_alloc_mark(store->backend, entry->blk_id2, 0);
+                }
+                break;
+            case UPDINPLACE:
+                if (commit) {
+                    size = entry->blk_id2 >> 32;
+                    offset = entry->blk_id2 & 0xffffffff;
+                    obj = (void *) entry + sizeof(tx_entry);
+                    tx_update_block(store, tx_slot_id, entry->blk_id1, obj,
+                            offset, size);
+                }
+                break;
+            default:
+                break;
+        }
+        tx_check_lock(state, entry, 0);
+    }
+}
 
-        tx_slot *slot = slot_ptr;
-        tx_entry *entries = slot_ptr + sizeof(tx_slot);
+/*
+ * Replays transaction starting in head slot tx_slot_id and releases the slot
+ * together with its chain
+ */
+static void
+tx_check_head(tx_check_state *state, uint32_t tx_slot_id)
+{
+    struct _pmb_handle *store = state->store;
+    tx_slot *slot = backend_tx_direct(store->backend, tx_slot_id);
 
-        if (slot->status == EMPTY) {
-            continue;
+    // overflow slots are handled together with head of transaction
+    if (slot == NULL || slot->status == EMPTY || slot->status == CHAINED) {
+        return;
+    }
+
+    int commit = (slot->status == COMMITED) &&
+            slot->size <= store->op_log.tx_slot_size &&
+            backend_checksum(store->backend, slot, slot->size,
+                &(slot->flch64), 0) &&
+            tx_chain_valid(store, slot);
+
+    tx_log_check_slot(state, tx_slot_id, slot, commit);
+    uint32_t count = 0;
+    for (tx_slot *cur = tx_slot_next(store, slot, NULL);
+            cur != NULL && cur->status == CHAINED &&
+            count++ < store->op_log.tx_slots_count;
+            cur = tx_slot_next(store, cur, NULL)) {
+        tx_log_check_slot(state, tx_slot_id, cur, commit);
+    }
+
+    if (commit) {
+        tx_metalist *metalist = &(store->op_log.upd_id_list[tx_slot_id]);
+        pthread_mutex_t *lock;
+        for (size_t i = 0; i < metalist->count; i++) {
+            lock = &state->locks[metalist->list[i].id % TX_CHECK_LOCKS];
+            pthread_mutex_lock(lock);
+            tx_meta_apply(store, &(metalist->list[i]));
+            pthread_mutex_unlock(lock);
         }
+        tx_metalist_reset(metalist);
+    }
 
-        int commit = util_checksum(slot, sizeof(tx_slot) + slot->size,
-                &(slot->flch64), 0) && (slot->status == COMMITED);
+    slot->status = EMPTY;
+    slot->size = 0;
+    tx_slot_checksum(store, slot, tx_slot_id);
+    backend_tx_set_zero(store->backend, slot);
+    tx_chain_clear(store, slot, 0);
+}
 
-        for(void *position_ptr = entries; position_ptr < slot_ptr + slot->size;
-                position_ptr += sizeof(tx_entry)) {
-            tx_entry *entry = (tx_entry *) position_ptr;
-            if (!entry->blk_id1 && !entry->blk_id2) {
-                break;
-            }
+static void *
+tx_check_thread(void *arg)
+{
+    tx_check_state *state = arg;
+    uint32_t count = state->store->op_log.tx_slots_count;
+    uint32_t tx_slot_id;
 
-            switch (entry->type) {
-                case WRITE:
-                    if (!commit) {
-                        obj = backend_direct(store->backend, entry->blk_id1);
-                        backend_set_zero(store->backend, obj);
-                    }
-                    break;
-                case REMOVE:
-                    if (commit) {
-                        obj = backend_direct(store->backend, entry->blk_id1);
-                        backend_set_zero(store->backend, obj);
-                    }
-                    break;
-                case UPDATE:
-                    if (commit) {
-                        obj = backend_direct(store->backend, entry->blk_id1);
-                        backend_set_zero(store->backend, obj);
-                    } else {
-                        obj = backend_direct(store->backend, entry->blk_id2);
-                        backend_set_zero(store->backend, obj);
-                    }
-                    break;
-                case UPDINPLACE:
-                    if (commit){
-                        size = entry->blk_id2 >> 32;
-                        offset = entry->blk_id2 & 0xffffffff;
-                        obj = (void *) entries + sizeof(tx_entry);
-                        tx_update_block(store, tx_slot_id, entry->blk_id1, obj,
-                                offset, size);
-                    }
-                default:
-                    break;
-            }
+    while ((tx_slot_id = __sync_fetch_and_add(&state->next, 1)) < count) {
+        tx_check_head(state, tx_slot_id);
+    }
+
+    return NULL;
+}
+
+void tx_log_check(struct _pmb_handle *store)
+{
+    printf("TX_LOG_CHECK START\n");
+    tx_check_state state;
+    state.store = store;
+    state.next = 0;
+    for (int i = 0; i < TX_CHECK_LOCKS; i++) {
+        pthread_mutex_init(&state.locks[i], NULL);
+    }
+
+    // only slots holding head of transaction are worth a thread
+    uint64_t heads = 0;
+    for (uint32_t tx_slot_id = 0; tx_slot_id < store->op_log.tx_slots_count;
+            tx_slot_id++) {
+        tx_slot *slot = backend_tx_direct(store->backend, tx_slot_id);
+        if (slot != NULL && slot->status != EMPTY && slot->status != CHAINED) {
+            heads++;
+        }
+    }
+
+    uint64_t threads_num = store->recovery_threads;
+    if (threads_num == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_num = ncpu > 0 ? ncpu : 1;
+    }
+    if (threads_num > heads) {
+        threads_num = heads;
+    }
+
+    pthread_t *threads = NULL;
+    uint64_t started = 0;
+    if (threads_num > 1) {
+        threads = malloc(threads_num * sizeof(pthread_t));
+    }
+    if (threads != NULL) {
+        while (started < threads_num && pthread_create(&threads[started],
+                NULL, tx_check_thread, &state) == 0) {
+            started++;
+        }
+    }
+
+    // replay in the caller if there is nothing to parallelize or no threads
+    tx_check_thread(&state);
+
+    // all slots have to be replayed before recovery looks at the blocks
+    for (uint64_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    for (int i = 0; i < TX_CHECK_LOCKS; i++) {
+        pthread_mutex_destroy(&state.locks[i]);
+    }
+
+    // overflow slots left after crash in the middle of clearing the chain
+    for (uint32_t tx_slot_id = 0; tx_slot_id < store->op_log.tx_slots_count;
+            tx_slot_id++) {
+        tx_slot *slot = backend_tx_direct(store->backend, tx_slot_id);
+        if (slot != NULL && slot->status == CHAINED) {
+            backend_tx_set_zero(store->backend, slot);
         }
-        slot->status = EMPTY;
-        slot->size = 0;
-        tx_slot_checksum(store, slot, tx_slot_id);
-        backend_tx_set_zero(store->backend, slot_ptr);
     }
     printf("TX_LOG_CHECK END\n");
 }
 
+/*
+ * Writes updated header of single in-place updated block and rehashes
+ * the touched range
+ */
+static void
+tx_meta_apply(struct _pmb_handle *store, tx_meta *meta)
+{
+    pmb_data_hdr *obj_meta = backend_direct(store->backend, meta->id);
+    // block might be updated by other slot since its header was read
+    obj_meta->version += meta->version - meta->base;
+    if (obj_meta->val_len < meta->val_len) {
+        obj_meta->val_len = meta->val_len;
+    }
+
+    backend_block_checksum(store->backend, meta->id, meta->offset,
+            meta->end - meta->offset);
+    backend_block_flush(store->backend, meta->id, meta->offset,
+            meta->end - meta->offset);
+}
+
 static void
-tx_slot_meta_upd_process(struct _pmb_handle *store, uint8_t tx_id)
+tx_slot_meta_upd_process(struct _pmb_handle *store, uint32_t tx_id)
 {
     tracepoint(tx_log, tx_slot_meta_upd_process_enter);
     tx_metalist *metalist = &(store->op_log.upd_id_list[tx_id]);
-    tx_meta *meta;
     for (size_t i = 0; i < metalist->count; i++) {
-        meta = &(metalist->list[i]);
-        pmb_data_hdr *obj_meta = backend_direct(store->backend, meta->id);
-        obj_meta->version = meta->version;
-        obj_meta->val_len = meta->val_len;
-
-        util_checksum(obj_meta,
-                sizeof(pmb_data_hdr) + store->max_key_len + obj_meta->val_len,
-                &obj_meta->flch64, 1);
+        tx_meta_apply(store, &(metalist->list[i]));
     }
 
-    memset((void *) metalist->list, 0, metalist->count * sizeof(tx_meta));
-    metalist->count = 0;
+    tx_metalist_reset(metalist);
 
     tracepoint(tx_log, tx_slot_meta_upd_process_exit);
 }
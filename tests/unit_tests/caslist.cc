@@ -33,6 +33,12 @@
 #include <gtest/gtest.h>
 #include <caslist.h>
 
+#include <algorithm>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
 /*
  * Unit tests for caslist, interface:
  * - caslist* caslist_new (uint64_t begin, uint64_t end)
@@ -71,6 +77,53 @@
  *
  * - caslist_size
  *   - simple getter, tested with _new/_push/_pop
+ *
+ * - caslist_push, large fragmented workloads
+ *   - list <0, 0>, push every second id of <1, 200000> in random order
+ *     -> size = 100000, 100000 ranges, ranges sorted
+ *   - then push remaining ids in random order -> size = 200000, single range <1, 200000>
+ *   - list <1, 100000>, random pops and pushes -> list matches std::set model
+ *
+ * - caslist_pop_n
+ *   - list <1, 5>, <7, 8>, pop 6 -> 1, 2, 3, 4, 5, 7; size = 1, begin = 8, end = 8
+ *   - list <1, 5>, pop 10 -> 5 values; size = 0
+ *
+ * - caslist_pop_range
+ *   - list <1, 5>, <7, 8>, pop range max 3 -> <1, 3>; pop range max 10 -> <4, 5>,
+ *     pop range max 10 -> <7, 8>, pop range -> 1
+ *
+ * - caslist_push_range
+ *   - list <0, 0>, push <5, 10> -> begin = 5, end = 10, size = 6
+ *   - list <10, 20>, push <1, 5> -> head <1, 5>, n1: <10, 20>, size = 16
+ *   - list <10, 20>, push <30, 40>, <50, 60>, <25, 55> -> <10, 20>, <25, 60>, size = 47
+ *   - list <10, 20>, push <30, 40>, <21, 29> -> <10, 40>, size = 31
+ *   - list <10, 20>, push <30, 40>, <1, 100> -> <1, 100>, size = 100
+ *
+ * - caslist_push_n
+ *   - list <0, 0>, push 5, 3, 4, 9 -> <3, 5>, <9, 9>, size = 4
+ *
+ * - caslist_new_sharded
+ *   - <1, 1000>, pop all -> every id returned once, size = 0, pop -> 1
+ *   - <1, 1000>, pop 100, push 100 -> size = 1000
+ *   - <1, 10000>, 8 threads pop and push concurrently -> no id returned twice,
+ *     size = 10000 at the end
+ *   - <1, 10>, pop all, push, push_n and push_range every id again -> size = 10,
+ *     every id popped once
+ *   - <0, 0>, push 70, <60, 130>, <1, 100>, <190, 300> -> <1, 130>, <190, 300>,
+ *     size = 241
+ *
+ * - caslist_merge
+ *   - list <1, 5>, src <7, 8>, <10, 12> -> list <1, 5>, <7, 8>, <10, 12>, size = 10;
+ *     src empty
+ *   - list <1, 5>, src <6, 10>, <20, 20> -> list <1, 10>, <20, 20>, size = 11
+ *   - sharded list, 4 threads build own lists of interleaved ids and merge
+ *     -> single range <1, 4000>
+ *
+ * - caslist_ranges
+ *   - list <0, 0> -> 0 ranges
+ *   - list <1, 5>, push 7, 8, 10 -> <1, 5>, <7, 8>, <10, 10>; max 2 -> -1
+ *   - sharded <1, 1000>, pop 10, push 3 of them -> popped ids cached in
+ *     magazines are part of the ranges, size unchanged
  */
 
 TEST(caslist, new_empty) {
@@ -340,3 +393,449 @@ TEST(caslist, push713) {
 
     caslist_free(list);
 }
+
+TEST(caslist, pop_n) {
+    caslist *list = caslist_new(1, 5);
+    uint64_t vals[10];
+    caslist_push_range(list, 7, 8);
+
+    EXPECT_EQ(caslist_pop_n(list, vals, 6), 6);
+    EXPECT_EQ(vals[0], 1);
+    EXPECT_EQ(vals[4], 5);
+    EXPECT_EQ(vals[5], 7);
+    EXPECT_EQ(list->size, 1);
+    EXPECT_EQ(list->begin, 8);
+    EXPECT_EQ(list->end, 8);
+    EXPECT_TRUE(list->next == NULL);
+    caslist_free(list);
+
+    list = caslist_new(1, 5);
+    EXPECT_EQ(caslist_pop_n(list, vals, 10), 5);
+    EXPECT_EQ(list->size, 0);
+    caslist_free(list);
+}
+
+TEST(caslist, pop_range) {
+    caslist *list = caslist_new(1, 5);
+    uint64_t begin, end;
+    caslist_push_range(list, 7, 8);
+
+    EXPECT_EQ(caslist_pop_range(list, 3, &begin, &end), 0);
+    EXPECT_EQ(begin, 1);
+    EXPECT_EQ(end, 3);
+    EXPECT_EQ(caslist_pop_range(list, 10, &begin, &end), 0);
+    EXPECT_EQ(begin, 4);
+    EXPECT_EQ(end, 5);
+    EXPECT_EQ(caslist_pop_range(list, 10, &begin, &end), 0);
+    EXPECT_EQ(begin, 7);
+    EXPECT_EQ(end, 8);
+    EXPECT_EQ(caslist_pop_range(list, 10, &begin, &end), 1);
+    EXPECT_EQ(list->size, 0);
+
+    caslist_free(list);
+}
+
+TEST(caslist, push_range_empty) {
+    caslist *list = caslist_new(0, 0);
+    caslist_push_range(list, 5, 10);
+
+    EXPECT_EQ(list->begin, 5);
+    EXPECT_EQ(list->end, 10);
+    EXPECT_EQ(list->size, 6);
+
+    caslist_free(list);
+}
+
+TEST(caslist, push_range_before) {
+    caslist *list = caslist_new(10, 20);
+    caslist_push_range(list, 1, 5);
+
+    EXPECT_EQ(list->begin, 1);
+    EXPECT_EQ(list->end, 5);
+    EXPECT_EQ(list->size, 16);
+    EXPECT_TRUE(list->next != NULL);
+    EXPECT_EQ(list->next->begin, 10);
+    EXPECT_EQ(list->next->end, 20);
+
+    caslist_free(list);
+}
+
+TEST(caslist, push_range_overlap) {
+    caslist *list = caslist_new(10, 20);
+    caslist_push_range(list, 30, 40);
+    caslist_push_range(list, 50, 60);
+    caslist_push_range(list, 25, 55);
+
+    EXPECT_EQ(list->begin, 10);
+    EXPECT_EQ(list->end, 20);
+    EXPECT_EQ(list->size, 47);
+    EXPECT_TRUE(list->next != NULL);
+    EXPECT_EQ(list->next->begin, 25);
+    EXPECT_EQ(list->next->end, 60);
+    EXPECT_TRUE(list->next->next == NULL);
+
+    caslist_free(list);
+}
+
+TEST(caslist, push_range_gap) {
+    caslist *list = caslist_new(10, 20);
+    caslist_push_range(list, 30, 40);
+    caslist_push_range(list, 21, 29);
+
+    EXPECT_EQ(list->begin, 10);
+    EXPECT_EQ(list->end, 40);
+    EXPECT_EQ(list->size, 31);
+    EXPECT_TRUE(list->next == NULL);
+    EXPECT_TRUE(list->root == NULL);
+
+    caslist_free(list);
+}
+
+TEST(caslist, push_range_cover) {
+    caslist *list = caslist_new(10, 20);
+    caslist_push_range(list, 30, 40);
+    caslist_push_range(list, 1, 100);
+
+    EXPECT_EQ(list->begin, 1);
+    EXPECT_EQ(list->end, 100);
+    EXPECT_EQ(list->size, 100);
+    EXPECT_TRUE(list->next == NULL);
+    EXPECT_TRUE(list->root == NULL);
+
+    caslist_free(list);
+}
+
+TEST(caslist, push_n) {
+    caslist *list = caslist_new(0, 0);
+    uint64_t vals[] = {5, 3, 4, 9};
+    caslist_push_n(list, vals, 4);
+
+    EXPECT_EQ(list->begin, 3);
+    EXPECT_EQ(list->end, 5);
+    EXPECT_EQ(list->size, 4);
+    EXPECT_TRUE(list->next != NULL);
+    EXPECT_EQ(list->next->begin, 9);
+    EXPECT_EQ(list->next->end, 9);
+
+    caslist_free(list);
+}
+
+static size_t count_ranges(caslist *list) {
+    size_t ranges = list->begin ? 1 : 0;
+    uint64_t last = list->end;
+    for (caslist_link *link = list->next; link; link = link->next) {
+        EXPECT_GT(link->begin, last + 1);
+        EXPECT_LE(link->begin, link->end);
+        last = link->end;
+        ranges++;
+    }
+    return ranges;
+}
+
+TEST(caslist, push_fragmented) {
+    const uint64_t ids_num = 200000;
+    caslist *list = caslist_new(0, 0);
+    std::vector<uint64_t> odd, even;
+    std::mt19937_64 rng(42);
+
+    for (uint64_t i = 1; i <= ids_num; i++) {
+        if (i % 2)
+            odd.push_back(i);
+        else
+            even.push_back(i);
+    }
+    std::shuffle(odd.begin(), odd.end(), rng);
+    std::shuffle(even.begin(), even.end(), rng);
+
+    for (auto id : odd) {
+        caslist_push(list, id);
+    }
+    EXPECT_EQ(list->size, ids_num / 2);
+    EXPECT_EQ(count_ranges(list), ids_num / 2);
+    EXPECT_EQ(list->begin, 1);
+
+    for (auto id : even) {
+        caslist_push(list, id);
+    }
+    EXPECT_EQ(list->size, ids_num);
+    EXPECT_EQ(count_ranges(list), 1);
+    EXPECT_EQ(list->begin, 1);
+    EXPECT_EQ(list->end, ids_num);
+    EXPECT_TRUE(list->next == NULL);
+    EXPECT_TRUE(list->root == NULL);
+
+    caslist_free(list);
+}
+
+TEST(caslist, push_pop_random) {
+    const uint64_t ids_num = 100000;
+    caslist *list = caslist_new(1, ids_num);
+    std::set<uint64_t> model;
+    std::vector<uint64_t> taken;
+    std::mt19937_64 rng(7);
+    uint64_t val;
+
+    for (uint64_t i = 1; i <= ids_num; i++) {
+        model.insert(i);
+    }
+
+    for (int i = 0; i < 300000; i++) {
+        if (rng() % 2 && !taken.empty()) {
+            size_t pos = rng() % taken.size();
+            val = taken[pos];
+            taken[pos] = taken.back();
+            taken.pop_back();
+            caslist_push(list, val);
+            model.insert(val);
+        } else if (caslist_pop(list, &val) == 0) {
+            EXPECT_EQ(val, *model.begin());
+            model.erase(model.begin());
+            taken.push_back(val);
+        }
+    }
+    EXPECT_EQ(list->size, model.size());
+
+    while (caslist_pop(list, &val) == 0) {
+        EXPECT_EQ(val, *model.begin());
+        model.erase(model.begin());
+    }
+    EXPECT_TRUE(model.empty());
+    EXPECT_TRUE(list->root == NULL);
+
+    caslist_free(list);
+}
+
+TEST(caslist, sharded_pop_all) {
+    caslist *list = caslist_new_sharded(1, 1000, 1, 1000);
+    std::set<uint64_t> ids;
+    uint64_t output = 0;
+
+    EXPECT_TRUE(list != NULL);
+    EXPECT_EQ(caslist_size(list), 1000);
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(caslist_pop(list, &output), 0);
+        EXPECT_TRUE(ids.insert(output).second);
+    }
+    EXPECT_EQ(*ids.begin(), 1);
+    EXPECT_EQ(*ids.rbegin(), 1000);
+    EXPECT_EQ(caslist_size(list), 0);
+    EXPECT_EQ(caslist_pop(list, &output), 1);
+    EXPECT_EQ(output, 0);
+
+    caslist_free(list);
+}
+
+TEST(caslist, sharded_push_back) {
+    caslist *list = caslist_new_sharded(1, 1000, 1, 1000);
+    uint64_t ids[100];
+
+    for (int i = 0; i < 100; i++) {
+        EXPECT_EQ(caslist_pop(list, &ids[i]), 0);
+    }
+    EXPECT_EQ(caslist_size(list), 900);
+    for (int i = 0; i < 100; i++) {
+        caslist_push(list, ids[i]);
+    }
+    EXPECT_EQ(caslist_size(list), 1000);
+
+    caslist_free(list);
+}
+
+TEST(caslist, sharded_double_push) {
+    caslist *list = caslist_new_sharded(1, 10, 1, 10);
+    uint64_t ids[10];
+    uint64_t output = 0;
+    std::set<uint64_t> popped;
+
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(caslist_pop(list, &ids[i]), 0);
+    }
+    for (int i = 0; i < 10; i++) {
+        caslist_push(list, ids[i]);
+        caslist_push(list, ids[i]);
+    }
+    caslist_push_n(list, ids, 10);
+    caslist_push_range(list, 1, 10);
+    EXPECT_EQ(caslist_size(list), 10);
+    while (caslist_pop(list, &output) == 0) {
+        EXPECT_TRUE(popped.insert(output).second);
+    }
+    EXPECT_EQ(popped.size(), 10);
+
+    caslist_free(list);
+}
+
+TEST(caslist, sharded_double_push_range) {
+    caslist *list = caslist_new_sharded(0, 0, 1, 200);
+    uint64_t ranges[4];
+
+    caslist_push(list, 70);
+    caslist_push_range(list, 60, 130);
+    caslist_push_range(list, 1, 100);
+    caslist_push_range(list, 190, 300);
+    EXPECT_EQ(caslist_size(list), 241);
+    EXPECT_EQ(caslist_ranges(list, ranges, 2), 2);
+    EXPECT_EQ(ranges[0], 1);
+    EXPECT_EQ(ranges[1], 130);
+    EXPECT_EQ(ranges[2], 190);
+    EXPECT_EQ(ranges[3], 300);
+
+    caslist_free(list);
+}
+
+TEST(caslist, sharded_concurrent) {
+    const int threads_num = 8;
+    caslist *list = caslist_new_sharded(1, 10000, 1, 10000);
+    std::vector<std::vector<uint64_t> > popped(threads_num);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < threads_num; t++) {
+        threads.push_back(std::thread([list, &popped, t]() {
+            uint64_t val;
+            for (int i = 0; i < 2000; i++) {
+                if (caslist_pop(list, &val) == 0)
+                    popped[t].push_back(val);
+                if (i % 3 == 0 && !popped[t].empty()) {
+                    caslist_push(list, popped[t].back());
+                    popped[t].pop_back();
+                }
+            }
+        }));
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+
+    std::set<uint64_t> ids;
+    size_t total = 0;
+    for (int t = 0; t < threads_num; t++) {
+        for (auto id : popped[t]) {
+            EXPECT_TRUE(ids.insert(id).second);
+            total++;
+        }
+    }
+    EXPECT_EQ(caslist_size(list), 10000 - total);
+
+    caslist_free(list);
+}
+
+TEST(caslist, ranges) {
+    caslist *list = caslist_new(0, 0);
+    uint64_t ranges[6];
+
+    EXPECT_EQ(caslist_ranges(list, ranges, 3), 0);
+
+    caslist_push_range(list, 1, 5);
+    caslist_push(list, 7);
+    caslist_push(list, 8);
+    caslist_push(list, 10);
+    EXPECT_EQ(caslist_ranges(list, ranges, 3), 3);
+    EXPECT_EQ(ranges[0], 1);
+    EXPECT_EQ(ranges[1], 5);
+    EXPECT_EQ(ranges[2], 7);
+    EXPECT_EQ(ranges[3], 8);
+    EXPECT_EQ(ranges[4], 10);
+    EXPECT_EQ(ranges[5], 10);
+    EXPECT_EQ(caslist_ranges(list, ranges, 2), (size_t)-1);
+
+    caslist_free(list);
+}
+
+TEST(caslist, ranges_sharded) {
+    caslist *list = caslist_new_sharded(1, 1000, 1, 1000);
+    uint64_t ids[10];
+    uint64_t ranges[2 * 8];
+
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(caslist_pop(list, &ids[i]), 0);
+    }
+    for (int i = 0; i < 3; i++) {
+        caslist_push(list, ids[i]);
+    }
+
+    size_t n = caslist_ranges(list, ranges, 8);
+    ASSERT_NE(n, (size_t)-1);
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        EXPECT_LE(ranges[2 * i], ranges[2 * i + 1]);
+        if (i > 0) {
+            EXPECT_GT(ranges[2 * i], ranges[2 * i - 1] + 1);
+        }
+        total += ranges[2 * i + 1] - ranges[2 * i] + 1;
+    }
+    EXPECT_EQ(total, 993);
+    EXPECT_EQ(caslist_size(list), 993);
+
+    caslist_free(list);
+}
+
+TEST(caslist, merge) {
+    caslist *list = caslist_new(1, 5);
+    caslist *src = caslist_new(0, 0);
+    uint64_t ranges[6];
+
+    caslist_push_range(src, 7, 8);
+    caslist_push_range(src, 10, 12);
+    caslist_merge(list, src);
+
+    EXPECT_EQ(caslist_size(list), 10);
+    EXPECT_EQ(caslist_ranges(list, ranges, 3), 3);
+    EXPECT_EQ(ranges[2], 7);
+    EXPECT_EQ(ranges[3], 8);
+    EXPECT_EQ(ranges[4], 10);
+    EXPECT_EQ(ranges[5], 12);
+    EXPECT_EQ(caslist_size(src), 0);
+    EXPECT_EQ(src->begin, 0);
+    EXPECT_EQ(src->end, 0);
+    EXPECT_EQ(src->next, (caslist_link *) NULL);
+
+    caslist_free(list);
+    caslist_free(src);
+}
+
+TEST(caslist, merge_touching) {
+    caslist *list = caslist_new(1, 5);
+    caslist *src = caslist_new(6, 10);
+    uint64_t ranges[4];
+
+    caslist_push(src, 20);
+    caslist_merge(list, src);
+
+    EXPECT_EQ(caslist_size(list), 11);
+    EXPECT_EQ(caslist_ranges(list, ranges, 2), 2);
+    EXPECT_EQ(ranges[0], 1);
+    EXPECT_EQ(ranges[1], 10);
+    EXPECT_EQ(ranges[2], 20);
+    EXPECT_EQ(ranges[3], 20);
+
+    caslist_free(list);
+    caslist_free(src);
+}
+
+TEST(caslist, merge_concurrent) {
+    const int threads_num = 4;
+    caslist *list = caslist_new_sharded(0, 0, 1, 4000);
+    std::vector<std::thread> threads;
+    uint64_t ranges[2];
+
+    for (int t = 0; t < threads_num; t++) {
+        threads.push_back(std::thread([list, t, threads_num]() {
+            caslist *local = caslist_new(0, 0);
+            for (uint64_t id = t + 1; id <= 4000; id += threads_num) {
+                caslist_push(local, id);
+            }
+            caslist_merge(list, local);
+            caslist_free(local);
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(caslist_size(list), 4000);
+    EXPECT_EQ(caslist_ranges(list, ranges, 1), 1);
+    EXPECT_EQ(ranges[0], 1);
+    EXPECT_EQ(ranges[1], 4000);
+
+    caslist_free(list);
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY LOG OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <checksum.h>
+
+#include <string.h>
+
+/*
+ * Unit tests for CRC32C checksum, interface:
+ * - uint32_t crc32c (uint32_t crc, const void* buf, size_t len)
+ * - int checksum_crc32c (void* addr, size_t len, uint64_t* csump, int insert)
+ *
+ * Test plan:
+ * - crc32c:
+ *   - empty buffer -> 0
+ *   - "123456789" -> 0xE3069283 (check value of CRC-32C)
+ *   - buffer split in unaligned parts -> same as whole buffer
+ *
+ * - checksum_crc32c:
+ *   - insert -> tag set, verify -> 1
+ *   - one bit flipped -> verify -> 0
+ *   - stored checksum doesn't change result
+ */
+
+TEST(crc32c, empty) {
+	EXPECT_EQ(0, crc32c(0, "", 0));
+}
+
+TEST(crc32c, check_value) {
+	EXPECT_EQ(0xE3069283, crc32c(0, "123456789", 9));
+}
+
+TEST(crc32c, continued) {
+	char buf[1031];
+	for (size_t i = 0; i < sizeof(buf); ++i)
+		buf[i] = (char)(i * 7 + 3);
+	uint32_t whole = crc32c(0, buf, sizeof(buf));
+	for (size_t split = 0; split < 20; ++split) {
+		uint32_t crc = crc32c(0, buf + 1, split);
+		crc = crc32c(crc, buf + 1 + split, sizeof(buf) - 1 - split);
+		EXPECT_EQ(crc32c(0, buf + 1, sizeof(buf) - 1), crc);
+	}
+	EXPECT_NE(0, whole);
+}
+
+TEST(checksum_crc32c, insert_verify) {
+	uint64_t buf[64];
+	memset(buf, 0xab, sizeof(buf));
+	buf[1] = 0;
+	EXPECT_EQ(1, checksum_crc32c(buf, sizeof(buf), &buf[1], 1));
+	EXPECT_EQ(CHECKSUM_CRC32C_TAG, buf[1] & ~0xffffffffULL);
+	EXPECT_EQ(1, checksum_crc32c(buf, sizeof(buf), &buf[1], 0));
+}
+
+TEST(checksum_crc32c, corrupted) {
+	uint64_t buf[64];
+	memset(buf, 0x5a, sizeof(buf));
+	checksum_crc32c(buf, sizeof(buf), &buf[0], 1);
+	((char*)buf)[300] ^= 0x10;
+	EXPECT_EQ(0, checksum_crc32c(buf, sizeof(buf), &buf[0], 0));
+}
+
+TEST(checksum_crc32c, csum_field_ignored) {
+	uint64_t buf[16];
+	memset(buf, 0x11, sizeof(buf));
+	buf[3] = 0;
+	checksum_crc32c(buf, sizeof(buf), &buf[3], 1);
+	uint64_t first = buf[3];
+	buf[3] = 0xdeadbeef;
+	checksum_crc32c(buf, sizeof(buf), &buf[3], 1);
+	EXPECT_EQ(first, buf[3]);
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY LOG OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+
+#include "unit_test_utils.h"
+
+#include <string>
+#include <vector>
+
+TEST(GetBatch, ReturnErrorCauseArgsAreInvalid) {
+	pmb_handle* handle = create_handle();
+	uint64_t blk_id = 1;
+	pmb_pair pair;
+	uint8_t status;
+	EXPECT_EQ(PMB_EARGS, pmb_get_batch(NULL, &blk_id, &pair, &status, 1));
+	EXPECT_EQ(PMB_EARGS, pmb_get_batch(handle, NULL, &pair, &status, 1));
+	EXPECT_EQ(PMB_EARGS, pmb_get_batch(handle, &blk_id, NULL, &status, 1));
+	EXPECT_EQ(PMB_EARGS, pmb_get_batch(handle, &blk_id, &pair, NULL, 1));
+	EXPECT_EQ(PMB_OK, pmb_get_batch(handle, &blk_id, &pair, &status, 0));
+	remove_handle(handle);
+}
+
+/*
+ * Objects from both regions are read at once, missing ones are reported per
+ * item
+ */
+TEST(GetBatch, SuccessMixedObjects) {
+	const int nobjs = 16;
+	char key[MAX_KEY_LEN] = "key";
+	pmb_handle* handle = create_handle();
+
+	uint64_t tx_slot;
+	std::vector<uint64_t> blk_ids;
+	std::vector<std::string> vals;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	for (int i = 0; i < nobjs; ++i) {
+		vals.push_back(std::string(MAX_VAL_LEN, 'a' + i));
+		pmb_pair pair = generate_put_input(0, 0, key,
+				(void *)vals[i].c_str(), MAX_KEY_LEN, MAX_VAL_LEN);
+		if (i % 2) {
+			EXPECT_EQ(PMB_OK, pmb_tput_meta(handle, tx_slot, &pair));
+		} else {
+			EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+		}
+		blk_ids.push_back(pair.blk_id);
+	}
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+
+	// object never written, invalid and out of range ids
+	blk_ids.push_back(blk_ids[0] + 1000);
+	blk_ids.push_back(0);
+	blk_ids.push_back(UINT64_MAX);
+
+	std::vector<pmb_pair> pairs(blk_ids.size());
+	std::vector<uint8_t> status(blk_ids.size());
+	EXPECT_EQ(PMB_ENOENT, pmb_get_batch(handle, blk_ids.data(), pairs.data(),
+				status.data(), blk_ids.size()));
+	for (int i = 0; i < nobjs; ++i) {
+		pmb_pair readed;
+		EXPECT_EQ(PMB_OK, status[i]);
+		EXPECT_EQ(PMB_OK, pmb_get(handle, blk_ids[i], &readed));
+		EXPECT_EQ(blk_ids[i], pairs[i].blk_id);
+		EXPECT_EQ(readed.val, pairs[i].val);
+		EXPECT_EQ(readed.val_len, pairs[i].val_len);
+		EXPECT_EQ(0, memcmp(pairs[i].val, vals[i].c_str(), pairs[i].val_len));
+	}
+	for (size_t i = nobjs; i < blk_ids.size(); ++i) {
+		EXPECT_EQ(PMB_ENOENT, status[i]);
+	}
+
+	blk_ids.resize(nobjs);
+	EXPECT_EQ(PMB_OK, pmb_get_batch(handle, blk_ids.data(), pairs.data(),
+				status.data(), nobjs));
+	remove_handle(handle);
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY LOG OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <backend.h>
+
+#include "unit_test_utils.h"
+
+#include <string>
+#include <vector>
+
+static pmb_handle*
+open_with_key_index(uint8_t sync_type = PMB_SYNC,
+		uint8_t recovery_mode = PMB_RECOVERY_SYNC)
+{
+	pmb_opts opts = PMB_OPTS_INIT;
+	opts.path = "single_thread.pool";
+	opts.data_size = 1024UL * 1024 * 1024;
+	opts.meta_size = 1024UL * 1024;
+	opts.write_log_entries = 16;
+	opts.max_key_len = MAX_KEY_LEN;
+	opts.max_val_len = MAX_VAL_LEN;
+	opts.meta_max_key_len = MAX_KEY_LEN;
+	opts.meta_max_val_len = MAX_VAL_LEN;
+	opts.sync_type = sync_type;
+	opts.recovery_mode = recovery_mode;
+	opts.key_index = 1;
+	uint8_t error = 0;
+	return pmb_open(&opts, &error);
+}
+
+static uint64_t
+put(pmb_handle* handle, uint64_t blk_id, const std::string& key,
+		const std::string& val, bool execute = true)
+{
+	uint64_t tx_slot;
+	pmb_pair pair = generate_put_input(blk_id, 0, (void *)key.c_str(),
+			(void *)val.c_str(), key.size(), val.size());
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	if (execute) {
+		EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	}
+	return pair.blk_id;
+}
+
+static uint64_t
+get_by_key(pmb_handle* handle, const std::string& key)
+{
+	pmb_pair pair;
+	if (pmb_get_by_key(handle, key.c_str(), key.size(), &pair) != PMB_OK) {
+		return 0;
+	}
+	EXPECT_EQ(key.size(), pair.key_len);
+	EXPECT_EQ(0, memcmp(pair.key, key.c_str(), key.size()));
+	return pair.blk_id;
+}
+
+TEST(GetByKey, ReturnErrorCauseArgsAreInvalid) {
+	pmb_handle* handle = open_with_key_index();
+	ASSERT_TRUE(NULL != handle);
+	pmb_pair pair;
+	EXPECT_EQ(PMB_EARGS, pmb_get_by_key(NULL, "key", 3, &pair));
+	EXPECT_EQ(PMB_EARGS, pmb_get_by_key(handle, NULL, 3, &pair));
+	EXPECT_EQ(PMB_EARGS, pmb_get_by_key(handle, "key", 0, &pair));
+	EXPECT_EQ(PMB_EARGS, pmb_get_by_key(handle, "key", MAX_KEY_LEN + 1, &pair));
+	EXPECT_EQ(PMB_EARGS, pmb_get_by_key(handle, "key", 3, NULL));
+	EXPECT_EQ(PMB_ENOENT, pmb_get_by_key(handle, "key", 3, &pair));
+	remove_handle(handle);
+}
+
+TEST(GetByKey, ReturnErrorCauseIndexIsDisabled) {
+	pmb_handle* handle = create_handle();
+	put(handle, 0, "key", "val");
+	pmb_pair pair;
+	EXPECT_EQ(PMB_ERR, pmb_get_by_key(handle, "key", 3, &pair));
+	remove_handle(handle);
+}
+
+/*
+ * Index follows writes, updates and removes of objects
+ */
+TEST(GetByKey, SuccessFollowsObjects) {
+	pmb_handle* handle = open_with_key_index();
+	ASSERT_TRUE(NULL != handle);
+
+	uint64_t blk_id = put(handle, 0, "key", "val");
+	EXPECT_EQ(blk_id, get_by_key(handle, "key"));
+	EXPECT_EQ(0u, get_by_key(handle, "ke"));
+
+	// not executed write isn't visible yet
+	put(handle, 0, "other", "val", false);
+	EXPECT_EQ(0u, get_by_key(handle, "other"));
+
+	// copy to new block
+	std::string val(MAX_VAL_LEN, 'a');
+	uint64_t new_blk_id = put(handle, blk_id, "key", val);
+	EXPECT_NE(blk_id, new_blk_id);
+	EXPECT_EQ(new_blk_id, get_by_key(handle, "key"));
+
+	// update in place keeps block
+	EXPECT_EQ(new_blk_id, put(handle, new_blk_id, "key", "b"));
+	EXPECT_EQ(new_blk_id, get_by_key(handle, "key"));
+
+	uint64_t tx_slot;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tdel(handle, tx_slot, new_blk_id));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	EXPECT_EQ(0u, get_by_key(handle, "key"));
+
+	pmb_pair pair = generate_put_input(0, 0, (void *)"atomic",
+			(void *)"val", 6, 3);
+	EXPECT_EQ(PMB_OK, pmb_put_atomic(handle, &pair));
+	EXPECT_EQ(pair.blk_id, get_by_key(handle, "atomic"));
+	uint64_t atomic_blk_id = pair.blk_id;
+	EXPECT_EQ(PMB_EARGS, pmb_put_atomic(handle, &pair));
+	EXPECT_EQ(atomic_blk_id, get_by_key(handle, "atomic"));
+
+	remove_handle(handle);
+}
+
+/*
+ * Index is kept in the pool, transactions committed before close are
+ * indexed by replay
+ */
+TEST(GetByKey, SuccessAfterReopen) {
+	const int nobjs = 500;
+	pmb_handle* handle = open_with_key_index();
+	ASSERT_TRUE(NULL != handle);
+
+	std::vector<uint64_t> blk_ids;
+	for (int i = 0; i < nobjs; ++i) {
+		blk_ids.push_back(put(handle, 0, "key" + std::to_string(i), "val"));
+	}
+	// removed keys leave entries to be reused
+	for (int i = 0; i < nobjs; i += 2) {
+		uint64_t tx_slot;
+		EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tdel(handle, tx_slot, blk_ids[i]));
+		EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	}
+	uint64_t replayed = put(handle, 0, "replayed", "val", false);
+	EXPECT_EQ(PMB_OK, pmb_close(handle));
+
+	handle = open_with_key_index();
+	ASSERT_TRUE(NULL != handle);
+	for (int i = 0; i < nobjs; ++i) {
+		EXPECT_EQ(i % 2 ? blk_ids[i] : 0u,
+				get_by_key(handle, "key" + std::to_string(i)));
+	}
+	EXPECT_EQ(replayed, get_by_key(handle, "replayed"));
+	remove_handle(handle);
+}
+
+/*
+ * Index updated without sync is persisted at close
+ */
+TEST(GetByKey, SuccessAfterReopenAsync) {
+	const int nobjs = 100;
+	pmb_handle* handle = open_with_key_index(PMB_ASYNC);
+	ASSERT_TRUE(NULL != handle);
+
+	std::vector<uint64_t> blk_ids;
+	for (int i = 0; i < nobjs; ++i) {
+		blk_ids.push_back(put(handle, 0, "key" + std::to_string(i), "val"));
+	}
+	EXPECT_EQ(PMB_OK, pmb_close(handle));
+
+	handle = open_with_key_index(PMB_ASYNC);
+	ASSERT_TRUE(NULL != handle);
+	for (int i = 0; i < nobjs; ++i) {
+		EXPECT_EQ(blk_ids[i], get_by_key(handle, "key" + std::to_string(i)));
+	}
+	remove_handle(handle);
+}
+
+/*
+ * Entries lost with dirty allocation bitmap are added back by full recovery,
+ * also when blocks are validated in background
+ */
+TEST(GetByKey, SuccessRebuiltAfterCrash) {
+	const int nobjs = 100;
+	const uint8_t modes[] = {PMB_RECOVERY_SYNC, PMB_RECOVERY_LAZY};
+	for (uint8_t mode : modes) {
+		pmb_handle* handle = open_with_key_index(PMB_ASYNC);
+		ASSERT_TRUE(NULL != handle);
+		std::vector<uint64_t> blk_ids;
+		for (int i = 0; i < nobjs; ++i) {
+			blk_ids.push_back(put(handle, 0, "key" + std::to_string(i), "val"));
+		}
+		EXPECT_EQ(PMB_OK, pmb_close(handle));
+
+		backend* bck = backend_open("single_thread.pool",
+				1024UL * 1024 * 1024, 1024UL * 1024, 16,
+				128UL * 1024 * 1024 / 16, MAX_KEY_LEN, MAX_VAL_LEN,
+				MAX_KEY_LEN, MAX_VAL_LEN, PMB_ASYNC);
+		ASSERT_TRUE(NULL != bck);
+		for (uint64_t blk_id : blk_ids) {
+			backend_key_index_remove(bck, blk_id);
+		}
+		backend_free_snap_invalidate(bck);
+		backend_alloc_set_state(bck, BACKEND_ALLOC_DIRTY);
+		backend_close(bck);
+
+		handle = open_with_key_index(PMB_ASYNC, mode);
+		ASSERT_TRUE(NULL != handle);
+		for (int i = 0; i < nobjs; ++i) {
+			EXPECT_EQ(blk_ids[i], get_by_key(handle, "key" + std::to_string(i)));
+		}
+		remove_handle(handle);
+	}
+}
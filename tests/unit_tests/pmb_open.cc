@@ -33,6 +33,8 @@
 #include <gtest/gtest.h>
 #include <pmbackend.h>
 
+#include <checksum.h>
+
 #include "unit_test_utils.h"
 
 #include <sys/types.h>
@@ -40,12 +42,14 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <vector>
+
 /*
  * Fail on creating new handle cause path is null
  */
 TEST(OpenHandle, CreateFailNullPath) {
 	pmb_handle *handle;
-	pmb_opts opts;
+	pmb_opts opts = PMB_OPTS_INIT;
 	uint8_t error;
 
 	opts.max_key_len = MAX_KEY_LEN;
@@ -174,6 +178,182 @@ TEST(OpenHandle, SuccessOpenNotEmpty) {
 	remove_handle(handle);
 }
 
+/*
+ * Reopen cleanly closed handle twice, object and free lists are restored
+ * from the free-list snapshot, removed object must not come back
+ */
+TEST(OpenHandle, SuccessReopenClean) {
+	pmb_handle *handle = create_handle();
+
+	pmb_pair to_put[3];
+	uint64_t tx_slot;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	for (int i = 0; i < 3; i++) {
+		to_put[i] = generate_put_input();
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &to_put[i]));
+	}
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tdel(handle, tx_slot, to_put[1].blk_id));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	uint64_t nfree = pmb_nfree(handle, PMB_DATA);
+
+	for (int i = 0; i < 2; i++) {
+		EXPECT_EQ(PMB_OK, pmb_close(handle));
+		EXPECT_EQ(PMB_OK, open_handle(handle, 4, "single_thread.pool"));
+		EXPECT_TRUE(NULL != handle);
+		EXPECT_EQ(2, count(handle, PMB_DATA));
+		EXPECT_EQ(nfree, pmb_nfree(handle, PMB_DATA));
+		EXPECT_EQ(0, count(handle, PMB_META));
+	}
+
+	remove_handle(handle);
+}
+
+/*
+ * Marks store as not closed cleanly, next open has to validate every block
+ */
+static void
+mark_dirty(const char* path)
+{
+	backend* bck = backend_open(path, 4UL * 1024 * 1024 * 1024,
+			4UL * 1024 * 1024, 16, 128UL * 1024 * 1024 / 16,
+			MAX_KEY_LEN, MAX_VAL_LEN, MAX_KEY_LEN, MAX_VAL_LEN, PMB_SYNC);
+	ASSERT_TRUE(NULL != bck);
+	backend_free_snap_invalidate(bck);
+	backend_alloc_set_state(bck, BACKEND_ALLOC_DIRTY);
+	backend_close(bck);
+}
+
+/*
+ * Puts n objects in single transaction, ids are stored in blk_ids
+ */
+static void
+put_objects(pmb_handle* handle, uint64_t* blk_ids, int n)
+{
+	uint64_t tx_slot;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	for (int i = 0; i < n; i++) {
+		pmb_pair to_put = generate_put_input();
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &to_put));
+		blk_ids[i] = to_put.blk_id;
+	}
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+}
+
+/*
+ * Open store which wasn't closed cleanly, all blocks are validated before
+ * pmb_open returns
+ */
+TEST(OpenHandle, SuccessOpenDirty) {
+	pmb_handle *handle = create_handle();
+	uint64_t blk_ids[3];
+
+	put_objects(handle, blk_ids, 3);
+	EXPECT_EQ(PMB_OK, pmb_close(handle));
+	mark_dirty("single_thread.pool");
+
+	EXPECT_EQ(PMB_OK, open_handle(handle, 4, "single_thread.pool"));
+	EXPECT_TRUE(NULL != handle);
+	EXPECT_EQ(3, count(handle, PMB_DATA));
+
+	remove_handle(handle);
+}
+
+/*
+ * Full recovery gives the same result regardless of number of threads
+ */
+TEST(OpenHandle, SuccessOpenDirtyThreads) {
+	pmb_handle *handle = create_handle();
+	uint64_t blk_ids[5];
+
+	put_objects(handle, blk_ids, 5);
+	uint64_t nfree = pmb_nfree(handle, PMB_DATA);
+	uint64_t meta_nfree = pmb_nfree(handle, PMB_META);
+	EXPECT_EQ(PMB_OK, pmb_close(handle));
+
+	uint32_t threads[] = {1, 3, 64};
+	for (int i = 0; i < 3; i++) {
+		mark_dirty("single_thread.pool");
+		EXPECT_EQ(PMB_OK, open_handle(handle, 4, "single_thread.pool",
+				MAX_KEY_LEN, MAX_VAL_LEN, 16, PMB_RECOVERY_SYNC, threads[i]));
+		EXPECT_TRUE(NULL != handle);
+		EXPECT_EQ(5, count(handle, PMB_DATA));
+		EXPECT_EQ(nfree, pmb_nfree(handle, PMB_DATA));
+		EXPECT_EQ(meta_nfree, pmb_nfree(handle, PMB_META));
+		EXPECT_EQ(PMB_OK, pmb_close(handle));
+	}
+
+	EXPECT_EQ(PMB_OK, open_handle(handle, 4, "single_thread.pool"));
+	remove_handle(handle);
+}
+
+/*
+ * Store created with CRC32C checksums keeps using them after reopen, blocks
+ * are validated with CRC32C in full recovery
+ */
+TEST(OpenHandle, SuccessOpenDirtyCrc32c) {
+	pmb_handle *handle;
+	uint64_t blk_ids[3];
+	pmb_pair pair;
+
+	EXPECT_EQ(PMB_OK, open_handle(handle, 4, "single_thread.pool",
+			MAX_KEY_LEN, MAX_VAL_LEN, 16, PMB_RECOVERY_SYNC, 0,
+			PMB_CSUM_CRC32C));
+	ASSERT_TRUE(NULL != handle);
+	put_objects(handle, blk_ids, 3);
+	EXPECT_EQ(PMB_OK, pmb_close(handle));
+	mark_dirty("single_thread.pool");
+
+	// checksum option is ignored for existing store
+	EXPECT_EQ(PMB_OK, open_handle(handle, 4, "single_thread.pool"));
+	ASSERT_TRUE(NULL != handle);
+	EXPECT_EQ(3, count(handle, PMB_DATA));
+	EXPECT_EQ(PMB_OK, pmb_get(handle, blk_ids[0], &pair));
+	EXPECT_EQ(CHECKSUM_CRC32C_TAG, ((pmb_data_hdr *)
+			backend_direct(handle->backend, blk_ids[0]))->flch64 & ~0xffffffffULL);
+
+	remove_handle(handle);
+}
+
+/*
+ * Open store which wasn't closed cleanly with lazy recovery, objects are
+ * readable and writes succeed while blocks are validated in background
+ */
+TEST(OpenHandle, SuccessOpenLazy) {
+	pmb_handle *handle = create_handle();
+	uint64_t blk_ids[4];
+	uint64_t validated, total;
+	pmb_pair pair;
+
+	put_objects(handle, blk_ids, 3);
+	EXPECT_EQ(PMB_OK, pmb_close(handle));
+	mark_dirty("single_thread.pool");
+
+	EXPECT_EQ(PMB_OK, open_handle(handle, 4, "single_thread.pool",
+			MAX_KEY_LEN, MAX_VAL_LEN, 16, PMB_RECOVERY_LAZY));
+	EXPECT_TRUE(NULL != handle);
+	EXPECT_EQ(PMB_OK, pmb_get(handle, blk_ids[1], &pair));
+	EXPECT_EQ(MAX_VAL_LEN, pair.val_len);
+
+	put_objects(handle, &blk_ids[3], 1);
+	for (int i = 0; i < 3; i++) {
+		EXPECT_NE(blk_ids[i], blk_ids[3]);
+	}
+
+	EXPECT_EQ(PMB_OK, pmb_recovery_wait(handle));
+	EXPECT_EQ(PMB_OK, pmb_recovery_progress(handle, &validated, &total));
+	EXPECT_EQ(total, validated);
+	EXPECT_EQ(pmb_ntotal(handle, PMB_DATA) + pmb_ntotal(handle, PMB_META), total);
+	EXPECT_EQ(4, count(handle, PMB_DATA));
+
+	remove_handle(handle);
+}
+
 //TODO: checking restored values
 
 TEST(DISABLED_OpenHandle, SuccessOpenNotEmptyObjAndMeta) {
@@ -227,3 +407,92 @@ TEST(DISABLED_OpenHandle, OpenFailSlotsLenChanged) {
 
 	EXPECT_EQ(0, remove("/nvml/single_thread.pool"));
 }
+
+/*
+ * More than 255 transaction slots, layout of transaction log is taken from the
+ * superblock when store is reopened
+ */
+TEST(OpenHandle, SuccessWideTxLog) {
+	const uint32_t nslots = 300;
+	pmb_opts opts = PMB_OPTS_INIT;
+	opts.path = "single_thread.pool";
+	opts.data_size = 1024UL * 1024 * 1024;
+	opts.meta_size = 1024UL * 1024;
+	opts.tx_slots = nslots;
+	opts.tx_log_size = nslots * 8192UL;
+	opts.max_key_len = MAX_KEY_LEN;
+	opts.max_val_len = MAX_VAL_LEN;
+	opts.meta_max_key_len = MAX_KEY_LEN;
+	opts.meta_max_val_len = MAX_VAL_LEN;
+	opts.sync_type = PMB_SYNC;
+	uint8_t error = 0;
+	pmb_handle *handle = pmb_open(&opts, &error);
+	ASSERT_TRUE(NULL != handle);
+	EXPECT_EQ(nslots, handle->op_log.tx_slots_count);
+
+	std::vector<uint64_t> slots(nslots);
+	for (uint32_t i = 0; i < nslots; ++i) {
+		EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &slots[i]));
+	}
+	uint64_t tx_slot;
+	EXPECT_EQ(PMB_ERR, pmb_tx_begin(handle, &tx_slot));
+
+	char key[MAX_KEY_LEN] = "key";
+	char val[MAX_VAL_LEN] = "val";
+	for (uint32_t i = 0; i < nslots; ++i) {
+		pmb_pair pair = generate_put_input(0, 0, key, val);
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, slots[i], &pair));
+		EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, slots[i]));
+		EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, slots[i]));
+	}
+	EXPECT_EQ(PMB_OK, pmb_close(handle));
+
+	opts.write_log_entries = 16;
+	opts.tx_log_size = 0;
+	handle = pmb_open(&opts, &error);
+	ASSERT_TRUE(NULL != handle);
+	EXPECT_EQ(nslots, handle->op_log.tx_slots_count);
+	EXPECT_EQ(nslots, count(handle, PMB_DATA));
+	remove_handle(handle);
+}
+
+/*
+ * Options without size are rejected
+ */
+TEST(OpenHandle, FailOptsWithoutSize) {
+	pmb_opts opts = {};
+	opts.path = "single_thread.pool";
+	opts.data_size = 1024UL * 1024 * 1024;
+	opts.meta_size = 1024UL * 1024;
+	opts.write_log_entries = 16;
+	opts.max_key_len = MAX_KEY_LEN;
+	opts.max_val_len = MAX_VAL_LEN;
+	opts.meta_max_key_len = MAX_KEY_LEN;
+	opts.meta_max_val_len = MAX_VAL_LEN;
+	uint8_t error = 0;
+	EXPECT_TRUE(NULL == pmb_open(&opts, &error));
+	EXPECT_EQ(PMB_EARGS, error);
+}
+
+/*
+ * Fields past size of the caller's structure are ignored, tx_slots set after
+ * it doesn't override write_log_entries
+ */
+TEST(OpenHandle, SuccessOptsOlderSize) {
+	pmb_opts opts = PMB_OPTS_INIT;
+	opts.size = offsetof(pmb_opts, tx_slots);
+	opts.path = "single_thread.pool";
+	opts.data_size = 1024UL * 1024 * 1024;
+	opts.meta_size = 1024UL * 1024;
+	opts.write_log_entries = 16;
+	opts.tx_slots = 300;
+	opts.max_key_len = MAX_KEY_LEN;
+	opts.max_val_len = MAX_VAL_LEN;
+	opts.meta_max_key_len = MAX_KEY_LEN;
+	opts.meta_max_val_len = MAX_VAL_LEN;
+	uint8_t error = 0;
+	pmb_handle *handle = pmb_open(&opts, &error);
+	ASSERT_TRUE(NULL != handle);
+	EXPECT_EQ(16, handle->op_log.tx_slots_count);
+	remove_handle(handle);
+}
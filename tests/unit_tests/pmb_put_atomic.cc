@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY LOG OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <gtest/gtest.h>
+#include <backend.h>
+
+#include "unit_test_utils.h"
+
+#include <string.h>
+#include <vector>
+
+static void
+mark_dirty(const char* path)
+{
+	backend* bck = backend_open(path, 4UL * 1024 * 1024 * 1024,
+			4UL * 1024 * 1024, 16, 128UL * 1024 * 1024 / 16,
+			MAX_KEY_LEN, MAX_VAL_LEN, MAX_KEY_LEN, MAX_VAL_LEN, PMB_SYNC);
+	ASSERT_TRUE(NULL != bck);
+	backend_free_snap_invalidate(bck);
+	backend_alloc_set_state(bck, BACKEND_ALLOC_DIRTY);
+	backend_close(bck);
+}
+
+TEST(PutAtomic, ReturnErrorCauseKeyIsNull) {
+	pmb_handle* handle = create_handle();
+	pmb_pair to_put = generate_put_input(0, 0, NULL);
+	EXPECT_EQ(PMB_EARGS, pmb_put_atomic(handle, &to_put));
+	EXPECT_EQ(PMB_EARGS, pmb_put_atomic(NULL, &to_put));
+	remove_handle(handle);
+}
+
+TEST(PutAtomic, ReturnErrorCauseObjectToUpdateDoesntExist) {
+	pmb_handle* handle = create_handle();
+	pmb_pair to_put = generate_put_input(123);
+	EXPECT_EQ(PMB_EARGS, pmb_put_atomic(handle, &to_put));
+	remove_handle(handle);
+}
+
+/*
+ * Write is visible right after the call, no tx slot is used
+ */
+TEST(PutAtomic, Success) {
+	pmb_handle* handle = create_handle();
+	std::vector<uint64_t> slots(handle->op_log.tx_slots_count);
+	for (auto& slot : slots) {
+		EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &slot));
+	}
+
+	pmb_pair to_put = generate_put_input();
+	EXPECT_EQ(PMB_OK, pmb_put_atomic(handle, &to_put));
+	EXPECT_NE(0, to_put.blk_id);
+	validate_save(handle, to_put.blk_id, to_put);
+	EXPECT_EQ(PMB_OK, pmb_verify(handle, to_put.blk_id, 0, MAX_VAL_LEN));
+	EXPECT_EQ(1, count(handle, PMB_DATA));
+	remove_handle(handle);
+}
+
+/*
+ * Update is rejected, object stays in its block unchanged
+ */
+TEST(PutAtomic, ReturnErrorCauseUpdate) {
+	pmb_handle* handle = create_handle();
+	char key[MAX_KEY_LEN] = "key";
+	char val[MAX_VAL_LEN];
+	memset(val, 'a', sizeof(val));
+
+	pmb_pair to_put = generate_put_input(0, 0, key, val);
+	EXPECT_EQ(PMB_OK, pmb_put_atomic(handle, &to_put));
+	uint64_t blk_id = to_put.blk_id;
+	int64_t nfree = pmb_nfree(handle, PMB_DATA);
+
+	char upd[16];
+	memset(upd, 'b', sizeof(upd));
+	to_put = generate_put_input(blk_id, 100, key, upd, MAX_KEY_LEN,
+			sizeof(upd));
+	EXPECT_EQ(PMB_EARGS, pmb_put_atomic(handle, &to_put));
+	EXPECT_EQ(blk_id, to_put.blk_id);
+	EXPECT_EQ(nfree, pmb_nfree(handle, PMB_DATA));
+
+	pmb_pair to_read;
+	EXPECT_EQ(PMB_OK, pmb_get(handle, blk_id, &to_read));
+	EXPECT_EQ(0, memcmp(to_read.val, val, MAX_VAL_LEN));
+	EXPECT_EQ(1, count(handle, PMB_DATA));
+	remove_handle(handle);
+}
+
+/*
+ * Block with broken checksum, as left by torn write, isn't recovered
+ */
+TEST(PutAtomic, SuccessTornWriteIsAbsent) {
+	pmb_handle* handle = create_handle();
+	pmb_pair first = generate_put_input();
+	pmb_pair torn = generate_put_input();
+	EXPECT_EQ(PMB_OK, pmb_put_atomic(handle, &first));
+	EXPECT_EQ(PMB_OK, pmb_put_atomic(handle, &torn));
+
+	pmb_pair to_read;
+	EXPECT_EQ(PMB_OK, pmb_get(handle, torn.blk_id, &to_read));
+	((char *)to_read.val)[MAX_VAL_LEN - 1] ^= 0xff;
+	EXPECT_EQ(PMB_ECSUM, pmb_verify(handle, torn.blk_id, 0, MAX_VAL_LEN));
+	EXPECT_EQ(PMB_OK, pmb_close(handle));
+	mark_dirty("single_thread.pool");
+
+	EXPECT_EQ(PMB_OK, open_handle(handle, 4, "single_thread.pool"));
+	ASSERT_TRUE(NULL != handle);
+	EXPECT_EQ(1, count(handle, PMB_DATA));
+	validate_save(handle, first.blk_id, first);
+	remove_handle(handle);
+}
@@ -31,6 +31,7 @@
  */
 
 #include <gtest/gtest.h>
+#include <backend.h>
 
 #include "unit_test_utils.h"
 
@@ -429,3 +430,360 @@ TEST(TPut, SuccessfullyUpdateObjectWithObjectOfTheBiggerSize) {
 
 	remove_handle(handle);
 }
+
+TEST(TPutBatch, ReturnErrorCauseValLenIsTooBig) {
+	pmb_handle *handle = create_handle();
+	char key[MAX_KEY_LEN] = "5";
+	pmb_pair to_put[2] = {generate_put_input(),
+			generate_put_input(0, 0, key, (void *)"6", MAX_KEY_LEN, MAX_VAL_LEN+100)};
+	uint64_t tx_slot;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_ESIZE, pmb_tput_batch(handle, tx_slot, to_put, 2));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	EXPECT_EQ(0, count(handle, PMB_DATA));
+	remove_handle(handle);
+}
+
+TEST(TPutBatch, ReturnErrorCauseKeyIsNull) {
+	pmb_handle *handle = create_handle();
+	pmb_pair to_put[2] = {generate_put_input(), generate_put_input(0, 0, NULL)};
+	uint64_t tx_slot;
+	int64_t nfree = pmb_nfree(handle, PMB_DATA);
+
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_EARGS, pmb_tput_batch(handle, tx_slot, to_put, 2));
+	EXPECT_EQ(PMB_EARGS, pmb_tput_batch(handle, tx_slot, to_put, 0));
+	EXPECT_EQ(nfree, pmb_nfree(handle, PMB_DATA));
+	EXPECT_EQ(0, count(handle, PMB_DATA));
+
+	remove_handle(handle);
+}
+
+TEST(TPutBatch, ReturnErrorCauseObjectToUpdateDoesntHavePreviousVersion) {
+	pmb_handle *handle = create_handle();
+	pmb_pair to_put[2] = {generate_put_input(), generate_put_input(1030)};
+	uint64_t tx_slot;
+	int64_t nfree = pmb_nfree(handle, PMB_DATA);
+
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_ENOENT, pmb_tput_batch(handle, tx_slot, to_put, 2));
+	EXPECT_EQ(nfree, pmb_nfree(handle, PMB_DATA));
+	EXPECT_EQ(0, count(handle, PMB_DATA));
+
+	remove_handle(handle);
+}
+
+TEST(TPutBatch, SuccessfullyWriteNewData) {
+	const int n = 10;
+	pmb_handle *handle = create_handle();
+	pmb_pair to_put[n];
+	for (int i = 0; i < n; i++) {
+		to_put[i] = generate_put_input();
+	}
+	uint64_t tx_slot;
+
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput_batch(handle, tx_slot, to_put, n));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+
+	for (int i = 0; i < n; i++) {
+		validate_save(handle, to_put[i].blk_id, to_put[i]);
+	}
+	EXPECT_EQ(n, count(handle, PMB_DATA));
+
+	remove_handle(handle);
+}
+
+TEST(TPutBatch, SuccessfullyWriteAndUpdateWithOffsetNotAligned) {
+	std::string oval1 = std::string(768, '1');
+	std::string oval2 = std::string(768, '2');
+	void *val1 = (void *)oval1.c_str();
+	void *val2 = (void *)oval2.c_str();
+	uint64_t tx_slot;
+
+	char key1[MAX_KEY_LEN] = "120";
+	char key2[MAX_KEY_LEN] = "121";
+
+	pmb_handle *handle = create_handle();
+	pmb_pair to_put[2] = {
+			generate_put_input(0, 0, key1, val1, MAX_KEY_LEN, 768),
+			generate_put_input(0, 0, key2, val1, MAX_KEY_LEN, 768)};
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput_batch(handle, tx_slot, to_put, 1));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	uint64_t blk_id = to_put[0].blk_id;
+
+	// update of the first object along with write of the second one
+	to_put[0].offset = 256;
+	to_put[0].val = val2;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput_batch(handle, tx_slot, to_put, 2));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+
+	EXPECT_NE(to_put[0].blk_id, blk_id);
+	EXPECT_EQ(2, count(handle, PMB_DATA));
+
+	pmb_pair readed;
+	EXPECT_EQ(PMB_ENOENT, pmb_get(handle, blk_id, &readed));
+	EXPECT_EQ(PMB_OK, pmb_get(handle, to_put[0].blk_id, &readed));
+	EXPECT_EQ(readed.val_len, MAX_VAL_LEN);
+	EXPECT_EQ(0, memcmp(readed.val, val1,  256));
+	EXPECT_EQ(0, memcmp((char *)readed.val + 256, val2, 768));
+	EXPECT_EQ(PMB_OK, pmb_verify(handle, to_put[0].blk_id, 0, MAX_VAL_LEN));
+	validate_save(handle, to_put[1].blk_id, to_put[1]);
+
+	remove_handle(handle);
+}
+
+TEST(TPutBatch, SuccessfullyAbort) {
+	const int n = 10;
+	pmb_handle *handle = create_handle();
+	pmb_pair to_put[n];
+	for (int i = 0; i < n; i++) {
+		to_put[i] = generate_put_input();
+	}
+	uint64_t tx_slot;
+	int64_t nfree = pmb_nfree(handle, PMB_DATA);
+
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput_batch(handle, tx_slot, to_put, n));
+	EXPECT_EQ(PMB_OK, pmb_tx_abort(handle, tx_slot));
+
+	EXPECT_EQ(nfree, pmb_nfree(handle, PMB_DATA));
+	EXPECT_EQ(0, count(handle, PMB_DATA));
+
+	remove_handle(handle);
+}
+
+/*
+ * In-place update with payload larger than tx slot continues in chained slots
+ * and doesn't copy the object
+ */
+TEST(TPut, SuccessfullyUpdateLargeValueInPlace) {
+	const uint32_t val_len = 64 * 1024;
+	const uint32_t upd_offset = 8 * 1024 + 100;
+	const uint32_t upd_len = 20 * 1024;
+	pmb_opts opts = PMB_OPTS_INIT;
+	opts.path = "single_thread.pool";
+	opts.data_size = 1024UL * 1024 * 1024;
+	opts.meta_size = 1024UL * 1024;
+	opts.write_log_entries = 16;
+	opts.tx_log_size = 16 * 8192UL;
+	opts.max_key_len = MAX_KEY_LEN;
+	opts.max_val_len = val_len;
+	opts.meta_max_key_len = MAX_KEY_LEN;
+	opts.meta_max_val_len = MAX_VAL_LEN;
+	opts.sync_type = PMB_SYNC;
+	opts.chunk_csum = 1;
+	uint8_t error = 0;
+	pmb_handle *handle = pmb_open(&opts, &error);
+	ASSERT_TRUE(NULL != handle);
+
+	std::string oval1 = std::string(val_len, '1');
+	std::string oval2 = std::string(upd_len, '2');
+	char key[MAX_KEY_LEN] = "120";
+	pmb_pair to_put = generate_put_input(0, 0, key,
+			(void *)oval1.c_str(), MAX_KEY_LEN, val_len);
+	uint64_t tx_slot;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &to_put));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	uint64_t blk_id = to_put.blk_id;
+
+	to_put.offset = upd_offset;
+	to_put.val = (void *)oval2.c_str();
+	to_put.val_len = upd_len;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &to_put));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	EXPECT_EQ(blk_id, to_put.blk_id);
+
+	std::string expected = oval1;
+	expected.replace(upd_offset, upd_len, oval2);
+	pmb_pair readed;
+	EXPECT_EQ(PMB_OK, pmb_get(handle, blk_id, &readed));
+	EXPECT_EQ(val_len, readed.val_len);
+	EXPECT_EQ(0, memcmp(readed.val, expected.c_str(), val_len));
+	EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_id, 0, val_len));
+	EXPECT_EQ(1, count(handle, PMB_DATA));
+	EXPECT_EQ(16, caslist_size(handle->op_log.tx_slots_list));
+
+	remove_handle(handle);
+}
+
+/*
+ * In-place update which doesn't fit into free tx slots copies the object to
+ * new block, slots chained for its first pieces are released
+ */
+TEST(TPut, SuccessfullyCopyLargeUpdateWithoutFreeSlots) {
+	const uint32_t val_len = 64 * 1024;
+	const uint32_t upd_offset = 8 * 1024 + 100;
+	const uint32_t upd_len = 20 * 1024;
+	pmb_opts opts = PMB_OPTS_INIT;
+	opts.path = "single_thread.pool";
+	opts.data_size = 1024UL * 1024 * 1024;
+	opts.meta_size = 1024UL * 1024;
+	opts.write_log_entries = 2;
+	opts.tx_log_size = 2 * 8192UL;
+	opts.max_key_len = MAX_KEY_LEN;
+	opts.max_val_len = val_len;
+	opts.meta_max_key_len = MAX_KEY_LEN;
+	opts.meta_max_val_len = MAX_VAL_LEN;
+	opts.sync_type = PMB_SYNC;
+	uint8_t error = 0;
+	pmb_handle *handle = pmb_open(&opts, &error);
+	ASSERT_TRUE(NULL != handle);
+
+	std::string oval1 = std::string(val_len, '1');
+	std::string oval2 = std::string(upd_len, '2');
+	char key[MAX_KEY_LEN] = "120";
+	pmb_pair to_put = generate_put_input(0, 0, key,
+			(void *)oval1.c_str(), MAX_KEY_LEN, val_len);
+	uint64_t tx_slot;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &to_put));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	uint64_t blk_id = to_put.blk_id;
+
+	to_put.offset = upd_offset;
+	to_put.val = (void *)oval2.c_str();
+	to_put.val_len = upd_len;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &to_put));
+	EXPECT_NE(blk_id, to_put.blk_id);
+	EXPECT_EQ(1, caslist_size(handle->op_log.tx_slots_list));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+
+	std::string expected = oval1;
+	expected.replace(upd_offset, upd_len, oval2);
+	pmb_pair readed;
+	EXPECT_EQ(PMB_OK, pmb_get(handle, to_put.blk_id, &readed));
+	EXPECT_EQ(val_len, readed.val_len);
+	EXPECT_EQ(0, memcmp(readed.val, expected.c_str(), val_len));
+	EXPECT_EQ(PMB_ENOENT, pmb_get(handle, blk_id, &readed));
+	EXPECT_EQ(1, count(handle, PMB_DATA));
+	EXPECT_EQ(2, caslist_size(handle->op_log.tx_slots_list));
+
+	remove_handle(handle);
+}
+
+static pmb_handle*
+open_with_inplace_max_len(uint32_t inplace_max_len)
+{
+	pmb_opts opts = PMB_OPTS_INIT;
+	opts.path = "single_thread.pool";
+	opts.data_size = 1024UL * 1024 * 1024;
+	opts.meta_size = 1024UL * 1024;
+	opts.write_log_entries = 16;
+	opts.max_key_len = MAX_KEY_LEN;
+	opts.max_val_len = MAX_VAL_LEN;
+	opts.meta_max_key_len = MAX_KEY_LEN;
+	opts.meta_max_val_len = MAX_VAL_LEN;
+	opts.sync_type = PMB_SYNC;
+	opts.inplace_max_len = inplace_max_len;
+	uint8_t error = 0;
+	return pmb_open(&opts, &error);
+}
+
+/*
+ * Updates not shorter than inplace_max_len are copied to new block
+ */
+TEST(TPut, SuccessfullyUpdateObjectOverInplaceMaxLen) {
+	char key[MAX_KEY_LEN] = "120";
+	std::string oval1 = std::string(MAX_VAL_LEN, '1');
+	std::string oval2 = std::string(100, '2');
+	pmb_handle *handle = open_with_inplace_max_len(64);
+	ASSERT_TRUE(NULL != handle);
+	pmb_pair to_put = generate_put_input(0, 0, key,
+			(void *)oval1.c_str(), MAX_KEY_LEN, MAX_VAL_LEN);
+	uint64_t tx_slot;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &to_put));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	uint64_t blk_id = to_put.blk_id;
+
+	// shorter than inplace_max_len
+	to_put = generate_put_input(blk_id, 10, key,
+			(void *)oval2.c_str(), MAX_KEY_LEN, 32);
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &to_put));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	EXPECT_EQ(blk_id, to_put.blk_id);
+
+	to_put = generate_put_input(blk_id, 100, key,
+			(void *)oval2.c_str(), MAX_KEY_LEN, 100);
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &to_put));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	EXPECT_NE(blk_id, to_put.blk_id);
+
+	std::string expected = oval1;
+	expected.replace(10, 32, oval2, 0, 32);
+	expected.replace(100, 100, oval2);
+	pmb_pair readed;
+	EXPECT_EQ(PMB_OK, pmb_get(handle, to_put.blk_id, &readed));
+	EXPECT_EQ(0, memcmp(readed.val, expected.c_str(), MAX_VAL_LEN));
+	EXPECT_EQ(1, count(handle, PMB_DATA));
+
+	remove_handle(handle);
+}
+
+/*
+ * Consecutive in-place updates of the same object are merged in tx slot
+ */
+TEST(TPut, SuccessfullyMergeUpdatesInPlace) {
+	char key[MAX_KEY_LEN] = "120";
+	std::string oval1 = std::string(MAX_VAL_LEN, '1');
+	pmb_handle *handle = open_with_inplace_max_len(0);
+	ASSERT_TRUE(NULL != handle);
+	pmb_pair to_put = generate_put_input(0, 0, key,
+			(void *)oval1.c_str(), MAX_KEY_LEN, MAX_VAL_LEN);
+	uint64_t tx_slot;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &to_put));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	uint64_t blk_id = to_put.blk_id;
+
+	// adjacent, overlapping and preceding ranges
+	const uint32_t ranges[][2] = {{100, 50}, {150, 50}, {120, 10}, {90, 20}};
+	std::string expected = oval1;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	for (int i = 0; i < 4; i++) {
+		std::string upd = std::string(ranges[i][1], 'a' + i);
+		to_put = generate_put_input(blk_id, ranges[i][0], key,
+				(void *)upd.c_str(), MAX_KEY_LEN, ranges[i][1]);
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &to_put));
+		expected.replace(ranges[i][0], ranges[i][1], upd);
+	}
+	::tx_slot *slot = (::tx_slot *)backend_tx_direct(handle->backend, tx_slot - 1);
+	EXPECT_EQ(sizeof(*slot) + sizeof(tx_entry) + 110, slot->size);
+
+	// not adjacent one gets own entry
+	to_put = generate_put_input(blk_id, 500, key,
+			(void *)oval1.c_str(), MAX_KEY_LEN, 10);
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &to_put));
+	EXPECT_EQ(sizeof(*slot) + 2 * sizeof(tx_entry) + 120, slot->size);
+
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+
+	pmb_pair readed;
+	EXPECT_EQ(PMB_OK, pmb_get(handle, blk_id, &readed));
+	EXPECT_EQ(0, memcmp(readed.val, expected.c_str(), MAX_VAL_LEN));
+	EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_id, 0, MAX_VAL_LEN));
+	EXPECT_EQ(3u, ((pmb_data_hdr *)backend_direct(handle->backend, blk_id))->version);
+
+	remove_handle(handle);
+}
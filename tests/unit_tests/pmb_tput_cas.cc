@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY LOG OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <backend.h>
+
+#include "unit_test_utils.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+// keys are passed with MAX_KEY_LEN
+static char key[MAX_KEY_LEN] = "key";
+
+static uint32_t
+version(pmb_handle* handle, uint64_t blk_id)
+{
+	return ((pmb_data_hdr *)backend_direct(handle->backend, blk_id))->version;
+}
+
+static uint64_t
+put_object(pmb_handle* handle, const std::string& val)
+{
+	uint64_t tx_slot;
+	pmb_pair pair = generate_put_input(0, 0, key,
+			(void *)val.c_str(), MAX_KEY_LEN, MAX_VAL_LEN);
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput_cas(handle, tx_slot, &pair, 0));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	return pair.blk_id;
+}
+
+TEST(TPutCas, ReturnErrorCauseArgsAreInvalid) {
+	pmb_handle* handle = create_handle();
+	pmb_pair to_put = generate_put_input();
+	uint64_t tx_slot;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_EARGS, pmb_tput_cas(NULL, tx_slot, &to_put, 0));
+	EXPECT_EQ(PMB_EARGS, pmb_tput_cas(handle, tx_slot, NULL, 0));
+	EXPECT_EQ(PMB_EARGS, pmb_tput_cas(handle, 0, &to_put, 0));
+	EXPECT_EQ(PMB_EVERSION, pmb_tput_cas(handle, tx_slot, &to_put, 1));
+	EXPECT_EQ(PMB_OK, pmb_tx_abort(handle, tx_slot));
+	EXPECT_EQ(0, count(handle, PMB_DATA));
+	remove_handle(handle);
+}
+
+/*
+ * Update is done only when version of object matches
+ */
+TEST(TPutCas, SuccessUpdateWithExpectedVersion) {
+	std::string oval(MAX_VAL_LEN, 'a');
+	std::string nval(MAX_VAL_LEN, 'b');
+	pmb_handle* handle = create_handle();
+	uint64_t blk_id = put_object(handle, oval);
+	uint32_t ver = version(handle, blk_id);
+
+	uint64_t tx_slot;
+	pmb_pair pair = generate_put_input(blk_id, 0, key,
+			(void *)nval.c_str(), MAX_KEY_LEN, MAX_VAL_LEN);
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_EVERSION, pmb_tput_cas(handle, tx_slot, &pair, ver + 1));
+	EXPECT_EQ(blk_id, pair.blk_id);
+	EXPECT_EQ(PMB_OK, pmb_tput_cas(handle, tx_slot, &pair, ver));
+	EXPECT_NE(blk_id, pair.blk_id);
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+
+	pmb_pair readed;
+	EXPECT_EQ(PMB_OK, pmb_get(handle, pair.blk_id, &readed));
+	EXPECT_EQ(0, memcmp(readed.val, nval.c_str(), MAX_VAL_LEN));
+	EXPECT_EQ(ver + 1, version(handle, pair.blk_id));
+
+	// old version is released by execute
+	pair.blk_id = blk_id;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_ENOENT, pmb_tput_cas(handle, tx_slot, &pair, ver));
+	EXPECT_EQ(PMB_OK, pmb_tx_abort(handle, tx_slot));
+	EXPECT_EQ(1, count(handle, PMB_DATA));
+	remove_handle(handle);
+}
+
+/*
+ * Second transaction updating the same version fails until the first one
+ * is aborted
+ */
+TEST(TPutCas, ReturnErrorCauseObjectIsClaimed) {
+	std::string oval(MAX_VAL_LEN, 'a');
+	std::string nval(MAX_VAL_LEN, 'b');
+	pmb_handle* handle = create_handle();
+	uint64_t blk_id = put_object(handle, oval);
+	uint32_t ver = version(handle, blk_id);
+
+	uint64_t tx1, tx2;
+	pmb_pair pair1 = generate_put_input(blk_id, 0, key,
+			(void *)nval.c_str(), MAX_KEY_LEN, MAX_VAL_LEN);
+	pmb_pair pair2 = pair1;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx1));
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx2));
+	EXPECT_EQ(PMB_OK, pmb_tput_cas(handle, tx1, &pair1, ver));
+	EXPECT_EQ(PMB_EVERSION, pmb_tput_cas(handle, tx2, &pair2, ver));
+	EXPECT_EQ(blk_id, pair2.blk_id);
+
+	EXPECT_EQ(PMB_OK, pmb_tx_abort(handle, tx1));
+	EXPECT_EQ(PMB_OK, pmb_tput_cas(handle, tx2, &pair2, ver));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx2));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx2));
+	EXPECT_EQ(1, count(handle, PMB_DATA));
+	remove_handle(handle);
+}
+
+/*
+ * In-place updates keep object id, transaction holding the claim can update
+ * object many times, version moves at execute
+ */
+TEST(TPutCas, SuccessUpdateInPlace) {
+	std::string oval(MAX_VAL_LEN, 'a');
+	std::string upd(16, 'b');
+	pmb_handle* handle = create_handle();
+	uint64_t blk_id = put_object(handle, oval);
+	uint32_t ver = version(handle, blk_id);
+
+	uint64_t tx_slot, other;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &other));
+	for (uint32_t offset = 0; offset < 64; offset += 32) {
+		pmb_pair pair = generate_put_input(blk_id, offset, key,
+				(void *)upd.c_str(), MAX_KEY_LEN, upd.size());
+		EXPECT_EQ(PMB_OK, pmb_tput_cas(handle, tx_slot, &pair, ver));
+		EXPECT_EQ(blk_id, pair.blk_id);
+		EXPECT_EQ(PMB_EVERSION, pmb_tput_cas(handle, other, &pair, ver));
+	}
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	EXPECT_NE(ver, version(handle, blk_id));
+
+	pmb_pair pair = generate_put_input(blk_id, 0, key,
+			(void *)upd.c_str(), MAX_KEY_LEN, upd.size());
+	EXPECT_EQ(PMB_EVERSION, pmb_tput_cas(handle, other, &pair, ver));
+	EXPECT_EQ(PMB_OK, pmb_tput_cas(handle, other, &pair,
+				version(handle, blk_id)));
+	EXPECT_EQ(PMB_OK, pmb_tx_abort(handle, other));
+	EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_id, 0, MAX_VAL_LEN));
+	remove_handle(handle);
+}
+
+/*
+ * Threads incrementing the same object with retries never create second copy
+ * and none of successful updates is lost
+ */
+TEST(TPutCas, SuccessConcurrentUpdates) {
+	const int nthreads = 4;
+	const int nupdates = 50;
+	std::string oval(MAX_VAL_LEN, 'a');
+	pmb_handle* handle = create_handle();
+	uint64_t blk_id = put_object(handle, oval);
+	uint32_t ver = version(handle, blk_id);
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < nthreads; ++t) {
+		threads.emplace_back([handle, blk_id, t]() {
+			std::string upd(16, 'b' + t);
+			for (int i = 0; i < nupdates; ) {
+				uint64_t tx_slot;
+				pmb_pair pair = generate_put_input(blk_id, t * 16,
+						key, (void *)upd.c_str(), MAX_KEY_LEN,
+						upd.size());
+				ASSERT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+				uint8_t ret = pmb_tput_cas(handle, tx_slot, &pair,
+						version(handle, blk_id));
+				if (ret != PMB_OK) {
+					EXPECT_EQ(PMB_EVERSION, ret);
+					EXPECT_EQ(PMB_OK, pmb_tx_abort(handle, tx_slot));
+					continue;
+				}
+				EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+				EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+				i++;
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	EXPECT_EQ(ver + nthreads * nupdates, version(handle, blk_id));
+	EXPECT_EQ(1, count(handle, PMB_DATA));
+	EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_id, 0, MAX_VAL_LEN));
+	remove_handle(handle);
+}
@@ -34,6 +34,10 @@
 
 #include "unit_test_utils.h"
 
+#include <algorithm>
+#include <thread>
+#include <vector>
+
 /*
  * Successfully begin transaction
  */
@@ -44,3 +48,109 @@ TEST(TxBegin, Success) {
 	EXPECT_TRUE(0<tx_slot && tx_slot<=handle->op_log.tx_slots_count);
 	remove_handle(handle);
 }
+
+static pmb_handle*
+open_with_slot_cache(void)
+{
+	pmb_opts opts = PMB_OPTS_INIT;
+	opts.path = "single_thread.pool";
+	opts.data_size = 1024UL * 1024 * 1024;
+	opts.meta_size = 1024UL * 1024;
+	opts.write_log_entries = 16;
+	opts.max_key_len = MAX_KEY_LEN;
+	opts.max_val_len = MAX_VAL_LEN;
+	opts.meta_max_key_len = MAX_KEY_LEN;
+	opts.meta_max_val_len = MAX_VAL_LEN;
+	opts.sync_type = PMB_SYNC;
+	opts.tx_slot_cache = 1;
+	uint8_t error = 0;
+	return pmb_open(&opts, &error);
+}
+
+/*
+ * With per-CPU slot cache every slot is still handed out exactly once
+ */
+TEST(TxBegin, SuccessSlotCache) {
+	pmb_handle* handle = open_with_slot_cache();
+	ASSERT_TRUE(NULL != handle);
+	ASSERT_TRUE(NULL != handle->op_log.tx_slots_list->shards);
+
+	std::vector<uint64_t> slots(handle->op_log.tx_slots_count);
+	for (auto& slot : slots) {
+		EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &slot));
+	}
+	uint64_t tx_slot;
+	EXPECT_EQ(PMB_ERR, pmb_tx_begin(handle, &tx_slot));
+
+	std::sort(slots.begin(), slots.end());
+	for (size_t i = 0; i < slots.size(); ++i) {
+		EXPECT_EQ(i + 1, slots[i]);
+	}
+
+	EXPECT_EQ(PMB_OK, pmb_tx_abort(handle, slots[3]));
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(slots[3], tx_slot);
+	remove_handle(handle);
+}
+
+/*
+ * Slots released on one CPU are taken by threads running on other ones
+ */
+TEST(TxBegin, SuccessSlotCacheThreads) {
+	const int nthreads = 8;
+	const int ntx = 100;
+	pmb_handle* handle = open_with_slot_cache();
+	ASSERT_TRUE(NULL != handle);
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < nthreads; ++t) {
+		threads.emplace_back([handle, ntx]() {
+			char key[MAX_KEY_LEN] = "key";
+			char val[MAX_VAL_LEN] = "val";
+			for (int i = 0; i < ntx; ++i) {
+				uint64_t tx_slot;
+				pmb_pair pair = generate_put_input(0, 0, key, val);
+				ASSERT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+				EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+				EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+				EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	EXPECT_EQ(nthreads * ntx, count(handle, PMB_DATA));
+	EXPECT_EQ(handle->op_log.tx_slots_count,
+			caslist_size(handle->op_log.tx_slots_list));
+	remove_handle(handle);
+}
+
+/*
+ * Repeated execute or abort of released slot fails and doesn't release the
+ * slot again, while it's used by another transaction
+ */
+TEST(TxBegin, SuccessSlotCacheRepeatedRelease) {
+	pmb_handle* handle = open_with_slot_cache();
+	ASSERT_TRUE(NULL != handle);
+
+	std::vector<uint64_t> slots(handle->op_log.tx_slots_count);
+	for (auto& slot : slots) {
+		EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &slot));
+	}
+
+	uint64_t tx_slot;
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, slots[0]));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, slots[0]));
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(slots[0], tx_slot);
+	EXPECT_EQ(PMB_ERR, pmb_tx_execute(handle, slots[0]));
+	EXPECT_EQ(PMB_ERR, pmb_tx_begin(handle, &tx_slot));
+
+	EXPECT_EQ(PMB_OK, pmb_tx_abort(handle, slots[1]));
+	EXPECT_EQ(PMB_ERR, pmb_tx_abort(handle, slots[1]));
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(slots[1], tx_slot);
+	EXPECT_EQ(PMB_ERR, pmb_tx_begin(handle, &tx_slot));
+	remove_handle(handle);
+}
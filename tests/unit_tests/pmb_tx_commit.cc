@@ -31,9 +31,14 @@
  */
 
 #include <gtest/gtest.h>
+#include <backend.h>
 
 #include "unit_test_utils.h"
 
+#include <string>
+#include <thread>
+#include <vector>
+
 /*
  * Successfully commit transaction
  */
@@ -45,3 +50,212 @@ TEST(TxCommit, Success) {
 	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
 	remove_handle(handle);
 }
+
+/*
+ * Commits from concurrent threads are persisted by group commit thread
+ */
+TEST(TxCommit, SuccessGroupCommit) {
+	const int nthreads = 8;
+	const int ntx = 50;
+	pmb_opts opts = PMB_OPTS_INIT;
+	opts.path = "single_thread.pool";
+	opts.data_size = 1024UL * 1024 * 1024;
+	opts.meta_size = 1024UL * 1024;
+	opts.write_log_entries = 16;
+	opts.max_key_len = MAX_KEY_LEN;
+	opts.max_val_len = MAX_VAL_LEN;
+	opts.meta_max_key_len = MAX_KEY_LEN;
+	opts.meta_max_val_len = MAX_VAL_LEN;
+	opts.sync_type = PMB_SYNC;
+	opts.group_commit_us = 200;
+	opts.group_commit_max = 4;
+	uint8_t error = 0;
+	pmb_handle *handle = pmb_open(&opts, &error);
+	ASSERT_TRUE(NULL != handle);
+	ASSERT_TRUE(NULL != handle->op_log.group);
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < nthreads; ++t) {
+		threads.emplace_back([handle, ntx]() {
+			char key[MAX_KEY_LEN] = "key";
+			char val[MAX_VAL_LEN] = "val";
+			for (int i = 0; i < ntx; ++i) {
+				uint64_t tx_slot;
+				pmb_pair pair = generate_put_input(0, 0, key, val);
+				EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+				EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+				EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+				EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	EXPECT_EQ(nthreads * ntx, count(handle, PMB_DATA));
+	EXPECT_EQ(PMB_OK, pmb_close(handle));
+
+	opts.group_commit_us = 0;
+	handle = pmb_open(&opts, &error);
+	ASSERT_TRUE(NULL != handle);
+	EXPECT_EQ(nthreads * ntx, count(handle, PMB_DATA));
+	remove_handle(handle);
+}
+
+static pmb_handle*
+open_small_tx_log(uint32_t recovery_threads = 0)
+{
+	pmb_opts opts = PMB_OPTS_INIT;
+	opts.path = "single_thread.pool";
+	opts.data_size = 1024UL * 1024 * 1024;
+	opts.meta_size = 1024UL * 1024;
+	opts.write_log_entries = 16;
+	opts.tx_log_size = 16 * 8192UL;
+	opts.recovery_threads = recovery_threads;
+	opts.max_key_len = MAX_KEY_LEN;
+	opts.max_val_len = MAX_VAL_LEN;
+	opts.meta_max_key_len = MAX_KEY_LEN;
+	opts.meta_max_val_len = MAX_VAL_LEN;
+	opts.sync_type = PMB_SYNC;
+	uint8_t error = 0;
+	return pmb_open(&opts, &error);
+}
+
+/*
+ * Transaction larger than single slot continues in overflow slots, which are
+ * released after execute
+ */
+TEST(TxCommit, SuccessChainedSlots) {
+	const int nwrites = 1000;
+	const int nupdates = 200;
+	pmb_handle *handle = open_small_tx_log();
+	ASSERT_TRUE(NULL != handle);
+
+	char key[MAX_KEY_LEN] = "key";
+	char val[MAX_VAL_LEN] = "val";
+	uint64_t tx_slot;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	pmb_pair pair = generate_put_input(0, 0, key, val);
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	uint64_t blk_id = pair.blk_id;
+
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	for (int i = 0; i < nwrites; ++i) {
+		pair = generate_put_input(0, 0, key, val);
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+	}
+	// in-place updates carry their payload in the slot
+	for (int i = 0; i < nupdates; ++i) {
+		memset(val, 'a' + i % 26, 100);
+		pair = generate_put_input(blk_id, 100, key, val, MAX_KEY_LEN, 100);
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+	}
+	EXPECT_TRUE(caslist_size(handle->op_log.tx_slots_list) < 15);
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	EXPECT_EQ(nwrites + 1, count(handle, PMB_DATA));
+
+	pair = generate_put_input(0, 0, key, NULL);
+	EXPECT_EQ(PMB_OK, pmb_get(handle, blk_id, &pair));
+	EXPECT_EQ(0, memcmp((char *)pair.val + 100, val, 100));
+	EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_id, 0, MAX_VAL_LEN));
+
+	std::vector<uint64_t> slots(16);
+	for (auto& slot : slots) {
+		EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &slot));
+	}
+	remove_handle(handle);
+}
+
+/*
+ * Committed chain of slots is replayed at open, aborted chain is reverted
+ */
+TEST(TxCommit, SuccessChainedSlotsReplay) {
+	const int nwrites = 1000;
+	pmb_handle *handle = open_small_tx_log();
+	ASSERT_TRUE(NULL != handle);
+
+	char key[MAX_KEY_LEN] = "key";
+	char val[MAX_VAL_LEN] = "val";
+	uint64_t tx_slot;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	for (int i = 0; i < nwrites; ++i) {
+		pmb_pair pair = generate_put_input(0, 0, key, val);
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+	}
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+
+	uint64_t aborted;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &aborted));
+	for (int i = 0; i < nwrites; ++i) {
+		pmb_pair pair = generate_put_input(0, 0, key, val);
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, aborted, &pair));
+	}
+	EXPECT_EQ(PMB_OK, pmb_tx_abort(handle, aborted));
+	EXPECT_EQ(PMB_OK, pmb_close(handle));
+
+	handle = open_small_tx_log();
+	ASSERT_TRUE(NULL != handle);
+	EXPECT_EQ(nwrites, count(handle, PMB_DATA));
+
+	std::vector<uint64_t> slots(16);
+	for (auto& slot : slots) {
+		EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &slot));
+	}
+	remove_handle(handle);
+}
+
+/*
+ * Committed in-place updates of the same blocks from many slots are replayed
+ * by parallel threads without losing any of them
+ */
+TEST(TxCommit, SuccessParallelReplay) {
+	const int nobjs = 4;
+	const int nslots = 12;
+	const int len = 16;
+	pmb_handle *handle = open_small_tx_log(4);
+	ASSERT_TRUE(NULL != handle);
+
+	char key[MAX_KEY_LEN] = "key";
+	std::string oval(MAX_VAL_LEN, '0');
+	uint64_t blk_ids[nobjs];
+	uint32_t versions[nobjs];
+	uint64_t tx_slot;
+	for (int i = 0; i < nobjs; ++i) {
+		pmb_pair pair = generate_put_input(0, 0, key,
+				(void *)oval.c_str(), MAX_KEY_LEN, MAX_VAL_LEN);
+		EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+		EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+		blk_ids[i] = pair.blk_id;
+		versions[i] = ((pmb_data_hdr *)
+				backend_direct(handle->backend, pair.blk_id))->version;
+	}
+
+	// every slot writes own range, slots are left committed only
+	std::vector<std::string> expected(nobjs, oval);
+	for (int i = 0; i < nslots; ++i) {
+		std::string upd(len, 'a' + i);
+		pmb_pair pair = generate_put_input(blk_ids[i % nobjs], i * len,
+				key, (void *)upd.c_str(), MAX_KEY_LEN, len);
+		EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+		EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+		expected[i % nobjs].replace(i * len, len, upd);
+	}
+	EXPECT_EQ(PMB_OK, pmb_close(handle));
+
+	handle = open_small_tx_log(4);
+	ASSERT_TRUE(NULL != handle);
+	for (int i = 0; i < nobjs; ++i) {
+		pmb_pair readed;
+		EXPECT_EQ(PMB_OK, pmb_get(handle, blk_ids[i], &readed));
+		EXPECT_EQ(0, memcmp(readed.val, expected[i].c_str(), MAX_VAL_LEN));
+		EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_ids[i], 0, MAX_VAL_LEN));
+		EXPECT_EQ(versions[i] + nslots / nobjs, ((pmb_data_hdr *)
+				backend_direct(handle->backend, blk_ids[i]))->version);
+	}
+	remove_handle(handle);
+}
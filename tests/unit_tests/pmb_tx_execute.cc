@@ -31,9 +31,13 @@
  */
 
 #include <gtest/gtest.h>
+#include <backend.h>
 
 #include "unit_test_utils.h"
 
+#include <string>
+#include <vector>
+
 TEST(TxExecute, SuccessSlotNotCommited) {
 	uint64_t tx_slot;
 	pmb_handle* handle = create_handle();
@@ -55,3 +59,315 @@ TEST(TxExecute, Success) {
 	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
 	remove_handle(handle);
 }
+
+static pmb_handle*
+open_with_executor(uint32_t execute_threads, uint32_t execute_batch = 0)
+{
+	pmb_opts opts = PMB_OPTS_INIT;
+	opts.path = "single_thread.pool";
+	opts.data_size = 1024UL * 1024 * 1024;
+	opts.meta_size = 1024UL * 1024;
+	opts.write_log_entries = 16;
+	opts.max_key_len = MAX_KEY_LEN;
+	opts.max_val_len = MAX_VAL_LEN;
+	opts.meta_max_key_len = MAX_KEY_LEN;
+	opts.meta_max_val_len = MAX_VAL_LEN;
+	opts.sync_type = PMB_SYNC;
+	opts.execute_threads = execute_threads;
+	opts.execute_batch = execute_batch;
+	uint8_t error = 0;
+	return pmb_open(&opts, &error);
+}
+
+/*
+ * Execute in background, old version of object is released after wait
+ */
+TEST(TxExecute, SuccessBackground) {
+	uint64_t tx_slot;
+	char key[MAX_KEY_LEN] = "key";
+	char val[MAX_VAL_LEN] = "val";
+	pmb_pair pair = generate_put_input(0, 0, key, val);
+	pmb_pair readed;
+	pmb_handle* handle = open_with_executor(2);
+	ASSERT_TRUE(NULL != handle);
+	ASSERT_TRUE(NULL != handle->op_log.executor);
+
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_ERR, pmb_tx_execute(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_wait(handle, tx_slot));
+
+	uint64_t old_blk_id = pair.blk_id;
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+	EXPECT_NE(old_blk_id, pair.blk_id);
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_wait(handle, tx_slot));
+
+	EXPECT_EQ(PMB_ENOENT, pmb_get(handle, old_blk_id, &readed));
+	EXPECT_EQ(PMB_OK, pmb_get(handle, pair.blk_id, &readed));
+	EXPECT_EQ(1, count(handle, PMB_DATA));
+	remove_handle(handle);
+}
+
+/*
+ * Transactions queued for background execute are finished at close
+ */
+TEST(TxExecute, SuccessBackgroundClose) {
+	const int ntx = 100;
+	char key[MAX_KEY_LEN] = "key";
+	char val[MAX_VAL_LEN] = "val";
+	pmb_handle* handle = open_with_executor(4);
+	ASSERT_TRUE(NULL != handle);
+
+	for (int i = 0; i < ntx; ++i) {
+		uint64_t tx_slot;
+		pmb_pair pair = generate_put_input(0, 0, key, val);
+		ASSERT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+		EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	}
+	EXPECT_EQ(PMB_OK, pmb_close(handle));
+
+	handle = open_with_executor(0);
+	ASSERT_TRUE(NULL != handle);
+	EXPECT_TRUE(NULL == handle->op_log.executor);
+	EXPECT_EQ(ntx, count(handle, PMB_DATA));
+	remove_handle(handle);
+}
+
+/*
+ * In-place updates of many blocks in single transaction, tracking of updated
+ * blocks is reused by following transactions
+ */
+TEST(TxExecute, SuccessManyInPlaceUpdates) {
+	const int nobjs = 300;
+	const int nrounds = 3;
+	char key[MAX_KEY_LEN] = "key";
+	char val[MAX_VAL_LEN] = "val";
+	pmb_handle* handle = open_with_executor(0);
+	ASSERT_TRUE(NULL != handle);
+
+	uint64_t tx_slot;
+	std::vector<uint64_t> blk_ids(nobjs);
+	ASSERT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	for (auto& blk_id : blk_ids) {
+		pmb_pair pair = generate_put_input(0, 0, key, val);
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+		blk_id = pair.blk_id;
+	}
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+
+	for (int round = 0; round < nrounds; ++round) {
+		ASSERT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+		for (int i = 0; i < nobjs; ++i) {
+			memset(val, 'a' + (round + i) % 26, 100);
+			pmb_pair pair = generate_put_input(blk_ids[i], 0, key, val,
+					MAX_KEY_LEN, 50);
+			EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+			pair = generate_put_input(blk_ids[i], 50, key, val + 50,
+					MAX_KEY_LEN, 50);
+			EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+		}
+		EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+
+		for (int i = 0; i < nobjs; ++i) {
+			memset(val, 'a' + (round + i) % 26, 100);
+			pmb_pair pair = generate_put_input(0, 0, key, NULL);
+			EXPECT_EQ(PMB_OK, pmb_get(handle, blk_ids[i], &pair));
+			EXPECT_EQ(0, memcmp(pair.val, val, 100));
+			EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_ids[i], 0, MAX_VAL_LEN));
+		}
+	}
+	EXPECT_EQ(nobjs, count(handle, PMB_DATA));
+	remove_handle(handle);
+}
+
+/*
+ * In-place updates executed in batches are visible to pmb_get right after
+ * pmb_tx_execute, none of them is lost
+ */
+TEST(TxExecute, SuccessBatchedInPlaceUpdates) {
+	const int nobjs = 8;
+	const int ntx = 64;
+	const int len = 32;
+	char key[MAX_KEY_LEN] = "key";
+	std::string oval(MAX_VAL_LEN, '0');
+	pmb_handle* handle = open_with_executor(2, 8);
+	ASSERT_TRUE(NULL != handle);
+	ASSERT_TRUE(NULL != handle->op_log.executor);
+
+	uint64_t tx_slot;
+	std::vector<uint64_t> blk_ids(nobjs);
+	std::vector<uint32_t> versions(nobjs);
+	ASSERT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	for (auto& blk_id : blk_ids) {
+		pmb_pair pair = generate_put_input(0, 0, key, (void *)oval.c_str(),
+				MAX_KEY_LEN, MAX_VAL_LEN);
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+		blk_id = pair.blk_id;
+	}
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_wait(handle, tx_slot));
+	for (int i = 0; i < nobjs; ++i) {
+		versions[i] = ((pmb_data_hdr *)
+				backend_direct(handle->backend, blk_ids[i]))->version;
+	}
+
+	// every transaction updates two blocks, ranges of one block overlap
+	std::vector<std::string> expected(nobjs, oval);
+	for (int t = 0; t < ntx; ++t) {
+		std::string upd(len, 'a' + t % 26);
+		ASSERT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+		for (int j = 0; j < 2; ++j) {
+			int obj = (t + j * 3) % nobjs;
+			uint32_t offset = (t * len / 2) % (MAX_VAL_LEN - len);
+			pmb_pair pair = generate_put_input(blk_ids[obj], offset, key,
+					(void *)upd.c_str(), MAX_KEY_LEN, len);
+			EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+			expected[obj].replace(offset, len, upd);
+		}
+		EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+
+		pmb_pair readed;
+		int obj = t % nobjs;
+		EXPECT_EQ(PMB_OK, pmb_get(handle, blk_ids[obj], &readed));
+		EXPECT_EQ(0, memcmp(readed.val, expected[obj].c_str(), MAX_VAL_LEN));
+	}
+
+	for (int i = 0; i < nobjs; ++i) {
+		pmb_pair readed;
+		EXPECT_EQ(PMB_OK, pmb_get(handle, blk_ids[i], &readed));
+		EXPECT_EQ(0, memcmp(readed.val, expected[i].c_str(), MAX_VAL_LEN));
+		EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_ids[i], 0, MAX_VAL_LEN));
+		EXPECT_EQ(versions[i] + 2 * ntx / nobjs, ((pmb_data_hdr *)
+				backend_direct(handle->backend, blk_ids[i]))->version);
+	}
+	EXPECT_EQ(nobjs, count(handle, PMB_DATA));
+	remove_handle(handle);
+}
+
+
+/*
+ * Block removed by transaction executed in the same batch as earlier in-place
+ * update of the block stays removed
+ */
+TEST(TxExecute, SuccessBatchedRemoveAfterInPlaceUpdate) {
+	const int rounds = 32;
+	char key[MAX_KEY_LEN] = "key";
+	std::string oval(MAX_VAL_LEN, '0');
+	std::string upd(32, 'a');
+	pmb_handle* handle = open_with_executor(1, 8);
+	ASSERT_TRUE(NULL != handle);
+	ASSERT_TRUE(NULL != handle->op_log.executor);
+
+	for (int r = 0; r < rounds; ++r) {
+		uint64_t tx_slot;
+		pmb_pair pair = generate_put_input(0, 0, key, (void *)oval.c_str(),
+				MAX_KEY_LEN, MAX_VAL_LEN);
+		ASSERT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+		EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tx_wait(handle, tx_slot));
+		uint64_t blk_id = pair.blk_id;
+
+		// both transactions are committed before any of them is queued
+		uint64_t tx_upd, tx_del;
+		pair = generate_put_input(blk_id, 16, key, (void *)upd.c_str(),
+				MAX_KEY_LEN, upd.size());
+		ASSERT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_upd));
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_upd, &pair));
+		EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_upd));
+		ASSERT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_del));
+		EXPECT_EQ(PMB_OK, pmb_tdel(handle, tx_del, blk_id));
+		EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_del));
+		EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_upd));
+		EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_del));
+		EXPECT_EQ(PMB_OK, pmb_tx_wait(handle, tx_del));
+
+		pmb_pair readed;
+		EXPECT_EQ(PMB_ENOENT, pmb_get(handle, blk_id, &readed));
+		EXPECT_EQ(0, count(handle, PMB_DATA));
+	}
+	remove_handle(handle);
+}
+
+/*
+ * Changes of transaction executed by one of many threads are visible right
+ * after pmb_tx_execute without pmb_tx_wait, in-place updates of the same block
+ * are not lost
+ */
+TEST(TxExecute, SuccessBackgroundReadAfterExecute) {
+	const int nobjs = 4;
+	const int ntx = 200;
+	const int len = 32;
+	char key[MAX_KEY_LEN] = "key";
+	std::string oval(MAX_VAL_LEN, '0');
+	pmb_handle* handle = open_with_executor(4);
+	ASSERT_TRUE(NULL != handle);
+	ASSERT_TRUE(NULL != handle->op_log.executor);
+
+	uint64_t tx_slot;
+	std::vector<uint64_t> blk_ids(nobjs);
+	std::vector<std::string> expected(nobjs, oval);
+	ASSERT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	for (auto& blk_id : blk_ids) {
+		pmb_pair pair = generate_put_input(0, 0, key, (void *)oval.c_str(),
+				MAX_KEY_LEN, MAX_VAL_LEN);
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+		blk_id = pair.blk_id;
+	}
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+
+	for (int t = 0; t < ntx; ++t) {
+		int obj = t % nobjs;
+		std::string upd(len, 'a' + t % 26);
+		uint32_t offset = (t * len / 2) % (MAX_VAL_LEN - len);
+		uint64_t old_blk_id = blk_ids[obj];
+		pmb_pair pair;
+		expected[obj].replace(offset, len, upd);
+		if (t % 10 == 9) {
+			// whole value is copied to new block
+			pair = generate_put_input(old_blk_id, 0, key,
+					(void *)expected[obj].c_str(), MAX_KEY_LEN, MAX_VAL_LEN);
+		} else {
+			pair = generate_put_input(old_blk_id, offset, key,
+					(void *)upd.c_str(), MAX_KEY_LEN, len);
+		}
+		ASSERT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+		EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+		blk_ids[obj] = pair.blk_id;
+
+		pmb_pair readed;
+		if (old_blk_id != pair.blk_id) {
+			EXPECT_EQ(PMB_ENOENT, pmb_get(handle, old_blk_id, &readed));
+		}
+		EXPECT_EQ(PMB_OK, pmb_get(handle, blk_ids[obj], &readed));
+		EXPECT_EQ(0, memcmp(readed.val, expected[obj].c_str(), MAX_VAL_LEN));
+	}
+
+	for (int i = 0; i < nobjs; ++i) {
+		EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_ids[i], 0, MAX_VAL_LEN));
+		ASSERT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tdel(handle, tx_slot, blk_ids[i]));
+		EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+		EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+
+		pmb_pair readed;
+		EXPECT_EQ(PMB_ENOENT, pmb_get(handle, blk_ids[i], &readed));
+	}
+	EXPECT_EQ(0, count(handle, PMB_DATA));
+	remove_handle(handle);
+}
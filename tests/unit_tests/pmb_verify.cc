@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY LOG OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <backend.h>
+
+#include "unit_test_utils.h"
+
+#include <string.h>
+#include <vector>
+
+#define VERIFY_VAL_LEN (16 * BACKEND_CSUM_CHUNK)
+
+/*
+ * puts object with VERIFY_VAL_LEN long value
+ */
+static uint64_t
+put_large(pmb_handle* handle, std::vector<char>& val)
+{
+	uint64_t tx_slot;
+	char key[MAX_KEY_LEN] = "large";
+	val.resize(VERIFY_VAL_LEN);
+	for (size_t i = 0; i < val.size(); ++i)
+		val[i] = (char)(i * 31);
+	pmb_pair pair = generate_put_input(0, 0, key, val.data(), MAX_KEY_LEN,
+			VERIFY_VAL_LEN);
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+	return pair.blk_id;
+}
+
+/*
+ * updates object in place with data at given offset
+ */
+static void
+update_in_place(pmb_handle* handle, uint64_t blk_id, uint32_t offset,
+		uint32_t len)
+{
+	uint64_t tx_slot;
+	char key[MAX_KEY_LEN] = "large";
+	std::vector<char> data(len, 'x');
+	pmb_pair pair = generate_put_input(blk_id, offset, key, data.data(),
+			MAX_KEY_LEN, len);
+	EXPECT_EQ(PMB_OK, pmb_tx_begin(handle, &tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tput(handle, tx_slot, &pair));
+	EXPECT_EQ(PMB_OK, pmb_tx_commit(handle, tx_slot));
+	EXPECT_EQ(PMB_OK, pmb_tx_execute(handle, tx_slot));
+}
+
+static char*
+value_ptr(pmb_handle* handle, uint64_t blk_id)
+{
+	pmb_pair pair;
+	EXPECT_EQ(PMB_OK, pmb_get(handle, blk_id, &pair));
+	return (char *)pair.val;
+}
+
+TEST(Verify, ReturnErrorCauseObjectDoesntExist) {
+	pmb_handle *handle;
+	EXPECT_EQ(PMB_OK, open_handle(handle, 1, "single_thread.pool",
+			MAX_KEY_LEN, VERIFY_VAL_LEN, 16, PMB_RECOVERY_SYNC, 0,
+			PMB_CSUM_FLETCHER64, 1));
+	ASSERT_TRUE(NULL != handle);
+	EXPECT_EQ(PMB_ENOENT, pmb_verify(handle, 1, 0, UINT32_MAX));
+	EXPECT_EQ(PMB_EARGS, pmb_verify(NULL, 1, 0, UINT32_MAX));
+	remove_handle(handle);
+}
+
+TEST(Verify, SuccessChunkedInPlaceUpdate) {
+	pmb_handle *handle;
+	std::vector<char> val;
+	EXPECT_EQ(PMB_OK, open_handle(handle, 1, "single_thread.pool",
+			MAX_KEY_LEN, VERIFY_VAL_LEN, 16, PMB_RECOVERY_SYNC, 0,
+			PMB_CSUM_CRC32C, 1));
+	ASSERT_TRUE(NULL != handle);
+	uint64_t blk_id = put_large(handle, val);
+	EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_id, 0, UINT32_MAX));
+
+	// spans chunk boundary
+	update_in_place(handle, blk_id, 3 * BACKEND_CSUM_CHUNK - 10, 100);
+	EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_id, 0, UINT32_MAX));
+	EXPECT_EQ(0, memcmp(value_ptr(handle, blk_id), val.data(),
+			3 * BACKEND_CSUM_CHUNK - 10));
+	EXPECT_EQ('x', value_ptr(handle, blk_id)[3 * BACKEND_CSUM_CHUNK + 50]);
+
+	// checksums survive reopen with full recovery
+	EXPECT_EQ(PMB_OK, pmb_close(handle));
+	EXPECT_EQ(PMB_OK, open_handle(handle, 1, "single_thread.pool",
+			MAX_KEY_LEN, VERIFY_VAL_LEN));
+	ASSERT_TRUE(NULL != handle);
+	EXPECT_EQ(1, count(handle, PMB_DATA));
+	EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_id, 0, UINT32_MAX));
+
+	remove_handle(handle);
+}
+
+TEST(Verify, ReturnErrorCauseChunkCorrupted) {
+	pmb_handle *handle;
+	std::vector<char> val;
+	EXPECT_EQ(PMB_OK, open_handle(handle, 1, "single_thread.pool",
+			MAX_KEY_LEN, VERIFY_VAL_LEN, 16, PMB_RECOVERY_SYNC, 0,
+			PMB_CSUM_FLETCHER64, 1));
+	ASSERT_TRUE(NULL != handle);
+	uint64_t blk_id = put_large(handle, val);
+
+	value_ptr(handle, blk_id)[10 * BACKEND_CSUM_CHUNK + 4] ^= 1;
+	EXPECT_EQ(PMB_ECSUM, pmb_verify(handle, blk_id, 0, UINT32_MAX));
+	EXPECT_EQ(PMB_ECSUM, pmb_verify(handle, blk_id,
+			10 * BACKEND_CSUM_CHUNK, 8));
+	// ranges outside of corrupted chunk are still valid
+	EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_id, 0, 10 * BACKEND_CSUM_CHUNK));
+	EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_id, 11 * BACKEND_CSUM_CHUNK,
+			UINT32_MAX));
+
+	remove_handle(handle);
+}
+
+TEST(Verify, ReturnErrorCauseObjectCorrupted) {
+	pmb_handle *handle;
+	std::vector<char> val;
+	EXPECT_EQ(PMB_OK, open_handle(handle, 1, "single_thread.pool",
+			MAX_KEY_LEN, VERIFY_VAL_LEN));
+	ASSERT_TRUE(NULL != handle);
+	uint64_t blk_id = put_large(handle, val);
+	EXPECT_EQ(PMB_OK, pmb_verify(handle, blk_id, 0, 8));
+
+	// without chunks whole object is verified regardless of range
+	value_ptr(handle, blk_id)[10 * BACKEND_CSUM_CHUNK + 4] ^= 1;
+	EXPECT_EQ(PMB_ECSUM, pmb_verify(handle, blk_id, 0, 8));
+
+	remove_handle(handle);
+}
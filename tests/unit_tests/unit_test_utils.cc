@@ -46,8 +46,8 @@ count(pmb_handle* handle, uint8_t region){
  * open or create handle and return error/success code
  */
 int
-open_handle(pmb_handle*& handle, int size, std::string path, uint32_t max_key_len, uint32_t max_val_len, uint8_t write_log_entries) {
-	pmb_opts opts;
+open_handle(pmb_handle*& handle, int size, std::string path, uint32_t max_key_len, uint32_t max_val_len, uint8_t write_log_entries, uint8_t recovery_mode, uint32_t recovery_threads, uint8_t checksum, uint8_t chunk_csum) {
+	pmb_opts opts = PMB_OPTS_INIT;
 	opts.max_key_len = max_key_len;
 	opts.max_val_len = max_val_len;
 	opts.write_log_entries = write_log_entries;
@@ -57,6 +57,10 @@ open_handle(pmb_handle*& handle, int size, std::string path, uint32_t max_key_le
 	opts.meta_max_key_len = max_key_len;
 	opts.meta_max_val_len = max_val_len;
 	opts.sync_type = PMB_SYNC;
+	opts.recovery_mode = recovery_mode;
+	opts.recovery_threads = recovery_threads;
+	opts.checksum = checksum;
+	opts.chunk_csum = chunk_csum;
 	uint8_t error = 0;
 	handle = pmb_open(&opts, &error);
 
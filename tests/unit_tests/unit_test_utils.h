@@ -48,7 +48,11 @@ uint64_t count(pmb_handle* handle, uint8_t region);
 int open_handle(pmb_handle*& handle, int size, std::string path,
 		uint32_t max_key_len=MAX_KEY_LEN,
 		uint32_t max_val_len=MAX_VAL_LEN,
-		uint8_t write_log_entries=16);
+		uint8_t write_log_entries=16,
+		uint8_t recovery_mode=PMB_RECOVERY_SYNC,
+		uint32_t recovery_threads=0,
+		uint8_t checksum=PMB_CSUM_FLETCHER64,
+		uint8_t chunk_csum=0);
 
 pmb_handle* create_handle(void);
 